@@ -0,0 +1,276 @@
+/*
+ ============================================================================
+ Name        : bench_parse.c
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Micro-benchmark of the numeric field parsers
+ ============================================================================
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "siftr_parse.h"
+
+enum {
+    BENCH_FIELDS = (1 << 20),
+    BENCH_ROUNDS = 20,
+    BENCH_FIELD_SIZE = 24,
+    BENCH_HEX_MAX_DIGITS = 8,
+};
+
+/* What the fields went through before: strtol() with the errno checks */
+static long int
+old_atol(const char *str)
+{
+    char *endptr;
+    long int number;
+
+    errno = 0;
+    number = strtol(str, &endptr, 10);
+    if (errno == ERANGE || str == endptr || *endptr != '\0') {
+        printf("bad number: %s\n", str);
+    }
+    return number;
+}
+
+/* A 32 bit hex value, with or without a "0x" prefix. */
+static inline int
+parse_hex_u32(const char *ptr, size_t len, uint32_t *value)
+{
+    uint32_t number = 0;
+    bool is_bad = false;
+
+    if (len >= 2 && ptr[0] == '0' && (ptr[1] | 0x20) == 'x') {
+        ptr += 2;
+        len -= 2;
+    }
+    if (len == 0 || len > BENCH_HEX_MAX_DIGITS) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < len; i++) {
+        uint32_t c = (unsigned char)ptr[i];
+        uint32_t digit = c - '0';
+        /* fold to lower case, 'a' to 'f' become 0 to 5 */
+        uint32_t letter = (c | 0x20) - 'a';
+
+        /* no branch on the digit, hex strings mix both kinds at random */
+        is_bad |= (digit > 9) & (letter > 5);
+        number = (number << 4) | ((digit <= 9) ? digit : letter + 10);
+    }
+    if (is_bad) {
+        return EXIT_FAILURE;
+    }
+    *value = number;
+    return EXIT_SUCCESS;
+}
+
+/* Inputs at the edges of the parsers, with what they must give */
+struct parse_case {
+    const char  *str;
+    int         ret;
+    int64_t     value;
+};
+
+static const struct parse_case u32_cases[] = {
+    {"0", EXIT_SUCCESS, 0},
+    {"4294967295", EXIT_SUCCESS, 4294967295},
+    {"4294967296", EXIT_FAILURE, 0},
+    {"99999999999", EXIT_FAILURE, 0},
+    {"", EXIT_FAILURE, 0},
+    {"12a", EXIT_FAILURE, 0},
+    {"-1", EXIT_FAILURE, 0},
+    {"1 ", EXIT_FAILURE, 0},
+};
+
+static const struct parse_case usec_cases[] = {
+    {"1700000000.123456", EXIT_SUCCESS, 1700000000123456},
+    {"1.5", EXIT_SUCCESS, 1500000},
+    {".5", EXIT_SUCCESS, 500000},
+    {"7", EXIT_SUCCESS, 7000000},
+    /* a 7th fraction digit is cut off, as strtod() then "%.6f" would */
+    {"1.1234567", EXIT_SUCCESS, 1123456},
+    {"1.123456a", EXIT_FAILURE, 0},
+    {"1.1234567a", EXIT_FAILURE, 0},
+    {"", EXIT_FAILURE, 0},
+    {".", EXIT_FAILURE, 0},
+    {"12a", EXIT_FAILURE, 0},
+    {"1.-5", EXIT_FAILURE, 0},
+};
+
+/* Returns how many of the cases the parsers got wrong */
+static int
+check_cases(void)
+{
+    int bad = 0;
+
+    for (size_t i = 0; i < sizeof(u32_cases) / sizeof(u32_cases[0]); i++) {
+        const struct parse_case *c = &u32_cases[i];
+        uint32_t value = 0;
+        int ret = parse_u32(c->str, strlen(c->str), &value);
+
+        if (ret != c->ret || (ret == EXIT_SUCCESS && value != c->value)) {
+            printf("parse_u32(\"%s\") gave %d, %u\n", c->str, ret, value);
+            bad++;
+        }
+    }
+    for (size_t i = 0; i < sizeof(usec_cases) / sizeof(usec_cases[0]); i++) {
+        const struct parse_case *c = &usec_cases[i];
+        int64_t usec = 0;
+        int ret = parse_usec(c->str, strlen(c->str), &usec);
+
+        if (ret != c->ret || (ret == EXIT_SUCCESS && usec != c->value)) {
+            printf("parse_usec(\"%s\") gave %d, %" PRId64 "\n", c->str, ret,
+                   usec);
+            bad++;
+        }
+    }
+    return bad;
+}
+
+/* The fast parser must sum to the same as the one it replaced */
+static int
+check_sum(const char *name, uint64_t sum, uint64_t expected)
+{
+    if (sum != expected) {
+        printf("%s checksum %" PRIu64 " != %" PRIu64 "\n", name, sum, expected);
+        return 1;
+    }
+    return 0;
+}
+
+static double
+now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report(const char *name, double secs, uint64_t sum)
+{
+    printf("%-28s %8.2f ns/field  (checksum %" PRIu64 ")\n", name,
+           secs * 1e9 / ((double)BENCH_FIELDS * BENCH_ROUNDS), sum);
+}
+
+int
+main(void)
+{
+    char (*flowids)[BENCH_FIELD_SIZE] = malloc(BENCH_FIELDS * BENCH_FIELD_SIZE);
+    char (*stamps)[BENCH_FIELD_SIZE] = malloc(BENCH_FIELDS * BENCH_FIELD_SIZE);
+    char (*hexes)[BENCH_FIELD_SIZE] = malloc(BENCH_FIELDS * BENCH_FIELD_SIZE);
+    uint8_t *flowid_len = malloc(BENCH_FIELDS);
+    uint8_t *stamp_len = malloc(BENCH_FIELDS);
+    uint8_t *hex_len = malloc(BENCH_FIELDS);
+    uint64_t sum, ref_sum, stamp_sum = 0;
+    double start;
+    int bad = check_cases();
+
+    if (flowids == NULL || stamps == NULL || hexes == NULL ||
+        flowid_len == NULL || stamp_len == NULL || hex_len == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+    for (uint32_t i = 0; i < BENCH_FIELDS; i++) {
+        uint32_t id = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+        flowid_len[i] = (uint8_t)snprintf(flowids[i], BENCH_FIELD_SIZE,
+                                          "%u", id);
+        uint32_t frac = (uint32_t)rand() % 1000000;
+
+        stamp_len[i] = (uint8_t)snprintf(stamps[i], BENCH_FIELD_SIZE,
+                                         "%u.%06u", 1700000000 + i / 1000,
+                                         frac);
+        stamp_sum += (uint64_t)(1700000000 + i / 1000) * 1000000 + frac;
+        hex_len[i] = (uint8_t)snprintf(hexes[i], BENCH_FIELD_SIZE,
+                                       "0x%x", id);
+    }
+
+    sum = 0;
+    start = now_secs();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (uint32_t i = 0; i < BENCH_FIELDS; i++) {
+            sum += (uint64_t)old_atol(flowids[i]);
+        }
+    }
+    report("flowid  strtol+errno", now_secs() - start, sum);
+    ref_sum = sum;
+
+    sum = 0;
+    start = now_secs();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (uint32_t i = 0; i < BENCH_FIELDS; i++) {
+            uint32_t value = 0;
+
+            parse_u32(flowids[i], flowid_len[i], &value);
+            sum += value;
+        }
+    }
+    report("flowid  parse_u32", now_secs() - start, sum);
+    bad += check_sum("parse_u32", sum, ref_sum);
+
+    sum = 0;
+    start = now_secs();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (uint32_t i = 0; i < BENCH_FIELDS; i++) {
+            sum += (uint64_t)(atof(stamps[i]) * 1000000.0);
+        }
+    }
+    report("stamp   atof", now_secs() - start, sum);
+
+    sum = 0;
+    start = now_secs();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (uint32_t i = 0; i < BENCH_FIELDS; i++) {
+            int64_t usec = 0;
+
+            parse_usec(stamps[i], stamp_len[i], &usec);
+            sum += (uint64_t)usec;
+        }
+    }
+    report("stamp   parse_usec", now_secs() - start, sum);
+    /* atof() rounds, so the timestamps are checked against their integers */
+    bad += check_sum("parse_usec", sum, stamp_sum * BENCH_ROUNDS);
+
+    sum = 0;
+    start = now_secs();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (uint32_t i = 0; i < BENCH_FIELDS; i++) {
+            sum += strtoul(hexes[i], NULL, 16);
+        }
+    }
+    report("hex     strtoul", now_secs() - start, sum);
+    ref_sum = sum;
+
+    sum = 0;
+    start = now_secs();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (uint32_t i = 0; i < BENCH_FIELDS; i++) {
+            uint32_t value = 0;
+
+            parse_hex_u32(hexes[i], hex_len[i], &value);
+            sum += value;
+        }
+    }
+    report("hex     parse_hex_u32", now_secs() - start, sum);
+    bad += check_sum("parse_hex_u32", sum, ref_sum);
+
+    free(flowids);
+    free(stamps);
+    free(hexes);
+    free(flowid_len);
+    free(stamp_len);
+    free(hex_len);
+    if (bad > 0) {
+        printf("%d parser checks failed\n", bad);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
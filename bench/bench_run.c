@@ -0,0 +1,222 @@
+/*
+ ============================================================================
+ Name        : bench_run.c
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Time review_siftr_log over logs: MB/s, records/s, peak RSS
+ ============================================================================
+ */
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+enum {
+    BENCH_MAX_ARGS = 64,
+};
+
+struct bench_result {
+    double      secs;           /* best wall time of the repeats */
+    long        max_rss_kb;     /* largest peak RSS of the repeats */
+};
+
+static double
+now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Size and record count of a log; the records exclude the head and foot note */
+static int
+log_size(const char *name, uint64_t *bytes, uint64_t *records)
+{
+    struct stat st;
+    const char *map;
+    uint64_t lines = 0;
+    int fd = open(name, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(name);
+        return EXIT_FAILURE;
+    }
+    *bytes = (uint64_t)st.st_size;
+    map = (st.st_size > 0) ?
+          mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    for (const char *p = map, *end = map + st.st_size;
+         p != NULL && p < end; lines++) {
+        p = memchr(p, '\n', (size_t)(end - p));
+        p = (p == NULL) ? NULL : p + 1;
+    }
+    if (map != NULL) {
+        munmap((void *)map, (size_t)st.st_size);
+    }
+    *records = (lines > 2) ? lines - 2 : 0;
+    return EXIT_SUCCESS;
+}
+
+/* Run argv with its output thrown away, wait4() gives its peak RSS */
+static int
+run_once(char *const argv[], double *secs, long *max_rss_kb)
+{
+    struct rusage usage;
+    double start = now_secs();
+    int status;
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+        }
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return EXIT_FAILURE;
+    }
+    *secs = now_secs() - start;
+    *max_rss_kb = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s exited with status %d\n", argv[0], status);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int
+run_case(char *const argv[], uint32_t repeats, struct bench_result *result)
+{
+    result->secs = 0;
+    result->max_rss_kb = 0;
+    for (uint32_t i = 0; i < repeats; i++) {
+        double secs;
+        long rss;
+
+        if (run_once(argv, &secs, &rss) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        if (i == 0 || secs < result->secs) {
+            result->secs = secs;
+        }
+        if (rss > result->max_rss_kb) {
+            result->max_rss_kb = rss;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+static void
+usage(const char *name)
+{
+    printf("Usage: %s [-r repeats] [-o out_dir] [-x option]... binary log...\n",
+           name);
+    printf(" -r N       Run each case N times and keep the best (default 3)\n");
+    printf(" -o DIR     Directory for the plot files (default bench/out)\n");
+    printf(" -x OPTION  Pass OPTION to the binary, e.g. -x -j4\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *out_dir = "bench/out";
+    const char *extra[BENCH_MAX_ARGS];
+    uint32_t extra_cnt = 0, repeats = 3;
+    int ret = EXIT_SUCCESS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "+r:o:x:h")) != -1) {
+        switch (opt) {
+            case 'r':
+                repeats = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 'x':
+                if (extra_cnt == BENCH_MAX_ARGS - 8) {
+                    fprintf(stderr, "too many -x options\n");
+                    return EXIT_FAILURE;
+                }
+                extra[extra_cnt++] = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (argc - optind < 2 || repeats == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-28s %-10s %9s %10s %12s %10s\n", "log", "case", "secs",
+           "MB/s", "records/s", "peak RSS");
+    for (int l = optind + 1; l < argc; l++) {
+        const char *log_name = argv[l];
+        const char *base = strrchr(log_name, '/');
+        uint64_t bytes, records;
+
+        base = (base == NULL) ? log_name : base + 1;
+        if (log_size(log_name, &bytes, &records) != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        /* -f alone is the body pass, -s all adds writing every plot file */
+        for (int with_stats = 0; with_stats <= 1; with_stats++) {
+            const char *args[BENCH_MAX_ARGS];
+            struct bench_result result;
+            uint32_t n = 0;
+
+            args[n++] = argv[optind];
+            for (uint32_t i = 0; i < extra_cnt; i++) {
+                args[n++] = extra[i];
+            }
+            args[n++] = "-o";
+            args[n++] = out_dir;
+            args[n++] = "-f";
+            args[n++] = log_name;
+            if (with_stats) {
+                args[n++] = "-s";
+                args[n++] = "all";
+            }
+            args[n] = NULL;
+
+            if (run_case((char *const *)args, repeats, &result) !=
+                EXIT_SUCCESS) {
+                ret = EXIT_FAILURE;
+                continue;
+            }
+            printf("%-28s %-10s %9.3f %10.1f %12.0f %7ld MB\n", base,
+                   with_stats ? "-s all" : "-f", result.secs,
+                   (double)bytes / (1 << 20) / result.secs,
+                   (double)records / result.secs, result.max_rss_kb / 1024);
+        }
+    }
+    return ret;
+}
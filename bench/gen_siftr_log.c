@@ -0,0 +1,347 @@
+/*
+ ============================================================================
+ Name        : gen_siftr_log.c
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Write synthetic siftr logs of a given size and flow layout
+ ============================================================================
+ */
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    GEN_MSS = 1448,
+    GEN_BUF_SIZE = (1 << 20),
+    GEN_MAX_RECORD = 512,
+    GEN_START_SECS = 1700000000,
+    /* t_flags bits of a typical established connection */
+    GEN_TF_BASE = 0x00000200 | 0x00000020 | 0x00000040 | 0x00000080 |
+                  0x00000100 | 0x01000000,
+    GEN_TF_FASTRECOVERY = 0x00100000,
+    GEN_TF2_ECN_PERMIT = 0x00000020,
+};
+
+enum interleave {
+    INTERLEAVE_RANDOM,      /* each record from any flow */
+    INTERLEAVE_RR,          /* flows take turns */
+    INTERLEAVE_BURST,       /* runs of records from one flow */
+};
+
+struct gen_flow {
+    uint32_t    flowid;
+    uint16_t    lport;
+    uint32_t    cwnd;
+    uint32_t    ssthresh;
+    uint32_t    srtt;
+    uint32_t    recovery;       /* records left in fast recovery */
+    char        laddr[48];
+    char        faddr[48];
+};
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+/* xorshift64*, plenty for test data and the same on every platform */
+static inline uint64_t
+rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static inline uint32_t
+rng_below(uint32_t bound)
+{
+    return (uint32_t)(((rng_next() >> 32) * bound) >> 32);
+}
+
+static inline char *
+put_u64(char *p, uint64_t value)
+{
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+static inline char *
+put_str(char *p, const char *str)
+{
+    size_t len = strlen(str);
+
+    memcpy(p, str, len);
+    return p + len;
+}
+
+/* One record in the field order of siftr 1.3, see the enum in the tool. */
+static size_t
+format_record(char *buf, struct gen_flow *flow, bool is_in, uint64_t usec)
+{
+    uint32_t inflight = rng_below(flow->cwnd);
+    uint32_t t_flags = GEN_TF_BASE;
+    char *p = buf;
+
+    /* additive increase, and a loss now and then */
+    if (rng_below(1000) < 3) {
+        flow->ssthresh = (flow->cwnd / 2 > 2 * GEN_MSS) ? flow->cwnd / 2 :
+                         2 * GEN_MSS;
+        flow->cwnd = flow->ssthresh;
+        flow->recovery = 8;
+    } else if (flow->cwnd < flow->ssthresh) {
+        flow->cwnd += GEN_MSS;
+    } else {
+        flow->cwnd += GEN_MSS * GEN_MSS / flow->cwnd + 1;
+    }
+    if (flow->recovery > 0) {
+        flow->recovery--;
+        t_flags |= GEN_TF_FASTRECOVERY;
+    }
+    flow->srtt = flow->srtt - flow->srtt / 16 + 1000 + rng_below(3000);
+
+    *p++ = is_in ? 'i' : 'o';
+    *p++ = ',';
+    p = put_u64(p, usec / 1000000);
+    *p++ = '.';
+    snprintf(p, 7, "%06u", (uint32_t)(usec % 1000000));
+    p += 6;
+    *p++ = ',';
+    p = put_str(p, flow->laddr);
+    *p++ = ',';
+    p = put_u64(p, flow->lport);
+    p = put_str(p, ",");
+    p = put_str(p, flow->faddr);
+    p = put_str(p, ",5201,");
+    p = put_u64(p, flow->ssthresh);
+    *p++ = ',';
+    p = put_u64(p, flow->cwnd);
+    *p++ = ',';
+    p = put_u64(p, GEN_TF2_ECN_PERMIT);
+    p = put_str(p, ",65535,65535,6,6,4,1448,");
+    p = put_u64(p, flow->srtt);
+    p = put_str(p, ",1,");
+    p = put_u64(p, t_flags);
+    *p++ = ',';
+    p = put_u64(p, 200000 + flow->srtt / 8);
+    p = put_str(p, ",32768,");
+    p = put_u64(p, rng_below(65536));
+    p = put_str(p, ",65536,0,");
+    p = put_u64(p, inflight);
+    p = put_str(p, ",0,");
+    p = put_u64(p, flow->flowid);
+    p = put_str(p, ",2\n");
+    return (size_t)(p - buf);
+}
+
+static void
+usage(const char *name)
+{
+    printf("Usage: %s -o file [options]\n", name);
+    printf(" -o, --out FILE          Write the log to FILE\n");
+    printf(" -n, --records N         Write N records (default 1000000)\n");
+    printf(" -S, --size MB           Write records until the log has MB\n"
+           "                         megabytes, instead of -n\n");
+    printf(" -c, --flows N           Number of flows (default 16)\n");
+    printf(" -6, --ipv6              IPv6 addresses, ipmode=6\n");
+    printf(" -m, --interleave MODE   random, rr or burst (default random)\n");
+    printf(" -b, --burst N           Records per run with burst (default 64)\n");
+    printf(" -s, --seed N            Random seed\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *out_name = NULL;
+    uint64_t nrecords = 1000000, size_limit = 0;
+    uint32_t nflows = 16, burst = 64;
+    enum interleave mode = INTERLEAVE_RANDOM;
+    bool ipv6 = false;
+    struct gen_flow *flows;
+    uint64_t nin = 0, nout = 0, bytes = 0, usec;
+    uint32_t cur = 0, run = 0;
+    char *buf;
+    size_t len = 0;
+    FILE *out;
+    int opt;
+    struct option long_opts[] = {
+        {"out", required_argument, 0, 'o'},
+        {"records", required_argument, 0, 'n'},
+        {"size", required_argument, 0, 'S'},
+        {"flows", required_argument, 0, 'c'},
+        {"ipv6", no_argument, 0, '6'},
+        {"interleave", required_argument, 0, 'm'},
+        {"burst", required_argument, 0, 'b'},
+        {"seed", required_argument, 0, 's'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "o:n:S:c:6m:b:s:h", long_opts,
+                              NULL)) != -1) {
+        switch (opt) {
+            case 'o':
+                out_name = optarg;
+                break;
+            case 'n':
+                nrecords = strtoull(optarg, NULL, 10);
+                break;
+            case 'S':
+                size_limit = strtoull(optarg, NULL, 10) << 20;
+                break;
+            case 'c':
+                nflows = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case '6':
+                ipv6 = true;
+                break;
+            case 'm':
+                if (strcmp(optarg, "random") == 0) {
+                    mode = INTERLEAVE_RANDOM;
+                } else if (strcmp(optarg, "rr") == 0) {
+                    mode = INTERLEAVE_RR;
+                } else if (strcmp(optarg, "burst") == 0) {
+                    mode = INTERLEAVE_BURST;
+                } else {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                burst = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                rng_state ^= strtoull(optarg, NULL, 10) * 0xBF58476D1CE4E5B9ULL;
+                if (rng_state == 0) {
+                    rng_state = 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (out_name == NULL || nflows == 0 || burst == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (size_limit > 0) {
+        nrecords = UINT64_MAX;
+    }
+
+    flows = (struct gen_flow *)calloc(nflows, sizeof(*flows));
+    buf = (char *)malloc(GEN_BUF_SIZE);
+    out = fopen(out_name, "w");
+    if (flows == NULL || buf == NULL || out == NULL) {
+        perror("gen_siftr_log");
+        return EXIT_FAILURE;
+    }
+
+    for (uint32_t i = 0; i < nflows; i++) {
+        struct gen_flow *flow = &flows[i];
+        bool is_dup;
+
+        do {
+            flow->flowid = (uint32_t)(rng_next() >> 32);
+            is_dup = (flow->flowid == 0);
+            for (uint32_t k = 0; k < i && !is_dup; k++) {
+                is_dup = (flows[k].flowid == flow->flowid);
+            }
+        } while (is_dup);
+        flow->lport = (uint16_t)(10000 + i % 50000);
+        flow->cwnd = 10 * GEN_MSS;
+        flow->ssthresh = 1073725440;
+        flow->srtt = 16000 + rng_below(64000);
+        if (ipv6) {
+            snprintf(flow->laddr, sizeof(flow->laddr), "2001:db8::%x:%x",
+                     i >> 16, i & 0xFFFF);
+            snprintf(flow->faddr, sizeof(flow->faddr), "2001:db8:1::%x:%x",
+                     i >> 16, i & 0xFFFF);
+        } else {
+            snprintf(flow->laddr, sizeof(flow->laddr), "10.%u.%u.%u",
+                     (i >> 16) & 0xFF, (i >> 8) & 0xFF, i & 0xFF);
+            snprintf(flow->faddr, sizeof(flow->faddr), "192.168.%u.%u",
+                     (i >> 8) & 0xFF, i & 0xFF);
+        }
+    }
+
+    bytes += (uint64_t)fprintf(out, "enable_time_secs=%u\tenable_time_usecs=%06u"
+                               "\tsiftrver=1.3.0\tsysname=FreeBSD"
+                               "\tsysver=1500000\tipmode=%c\n",
+                               GEN_START_SECS, 0, ipv6 ? '6' : '4');
+    usec = (uint64_t)GEN_START_SECS * 1000000 + 1000;
+
+    for (uint64_t r = 0; r < nrecords; r++) {
+        bool is_in = (rng_below(2) == 0);
+
+        if (size_limit > 0 && bytes + len >= size_limit) {
+            break;
+        }
+        switch (mode) {
+            case INTERLEAVE_RANDOM:
+                cur = rng_below(nflows);
+                break;
+            case INTERLEAVE_RR:
+                cur = (uint32_t)(r % nflows);
+                break;
+            case INTERLEAVE_BURST:
+                if (run == 0) {
+                    cur = rng_below(nflows);
+                    run = burst;
+                }
+                run--;
+                break;
+        }
+        usec += 1 + rng_below(200);
+        len += format_record(buf + len, &flows[cur], is_in, usec);
+        if (is_in) {
+            nin++;
+        } else {
+            nout++;
+        }
+        if (len > GEN_BUF_SIZE - GEN_MAX_RECORD) {
+            fwrite(buf, 1, len, out);
+            bytes += len;
+            len = 0;
+        }
+    }
+    fwrite(buf, 1, len, out);
+    bytes += len;
+
+    usec += 1000;
+    fprintf(out, "disable_time_secs=%" PRIu64 "\tdisable_time_usecs=%06" PRIu64
+            "\tnum_inbound_tcp_pkts=%" PRIu64 "\tnum_outbound_tcp_pkts=%" PRIu64
+            "\ttotal_tcp_pkts=%" PRIu64 "\tnum_inbound_skipped_pkts_malloc=0"
+            "\tnum_outbound_skipped_pkts_malloc=0"
+            "\tnum_inbound_skipped_pkts_tcpcb=0"
+            "\tnum_outbound_skipped_pkts_tcpcb=0"
+            "\tnum_inbound_skipped_pkts_inpcb=0"
+            "\tnum_outbound_skipped_pkts_inpcb=0"
+            "\ttotal_skipped_tcp_pkts=0\tflow_list=",
+            usec / 1000000, usec % 1000000, nin, nout, nin + nout);
+    for (uint32_t i = 0; i < nflows; i++) {
+        fprintf(out, "%s%u", (i > 0) ? "," : "", flows[i].flowid);
+    }
+    fprintf(out, "\n");
+
+    if (fclose(out) != 0) {
+        perror("fclose");
+        return EXIT_FAILURE;
+    }
+    printf("%s: %" PRIu64 " records, %u flows\n", out_name, nin + nout,
+           nflows);
+    free(flows);
+    free(buf);
+    return EXIT_SUCCESS;
+}
@@ -8,158 +8,564 @@
  ============================================================================
  */
 #include <getopt.h>
+#include <sys/stat.h>
 #include "review_siftr_log.h"
 
 bool verbose = false;
+uint32_t jobs = 1;
+bool use_index = false;
+bool show_tflags = false;
+const char *out_dir = NULL;
+bool use_writer_thread = false;
+bool show_metrics = false;
+bool use_columns = false;
+bool select_flows = false;      /* the body is read again for the -s flows */
+int64_t bucket_usec = 0;
+uint32_t max_points = 0;
+bool show_events = false;
+bool show_occupancy = false;
+const char *export_file_name = NULL;
+struct time_window time_window;
+enum profile_format profile_format = PROFILE_OFF;
+struct run_profile run_profile;
 
 void
 stats_into_plot_file(struct file_basic_stats *f_basics, uint32_t flowid)
 {
-    char line[MAX_LINE_LENGTH];
-    char cwnd_plot_file_name[MAX_NAME_LENGTH];
-    double first_flow_start_time = 0;
-    double relative_time_stamp = 0;
-    uint32_t current_line;
+    stats_into_plot_files(f_basics, &flowid, 1);
+}
 
-    /* Restart seeking and go back to the beginning of the file */
-    rewind(f_basics->file);
+struct plot_seek {
+    uint64_t    offset;
+    uint32_t    out;
+};
 
-    current_line = 1; // Line counter (start from 1 for 1-based index)
+static int
+cmp_plot_seek(const void *a, const void *b)
+{
+    const struct plot_seek *x = a, *y = b;
 
-    /* Read and discard the first line */
-    if(fgets(line, MAX_LINE_LENGTH, f_basics->file) == NULL) {
-        PERROR_FUNCTION("Failed to read first line");
-        return;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/*
+ * Visit only the records of the requested flows, through their offset lists,
+ * instead of reading the whole body. Returns false if it could not be done.
+ */
+static bool
+plot_by_offsets(struct file_basic_stats *f_basics, struct plot_outputs *plots,
+                const uint32_t *flowids, uint32_t count, uint64_t nrecords)
+{
+    struct log_reader *reader = &f_basics->reader;
+    struct plot_seek *seeks;
+    struct line_view record;
+    struct record_fields rf;
+    int64_t first_usec = f_basics->first_usec;
+    int64_t lo, hi;
+    uint64_t n = 0, k = 0;
+
+    seeks = (struct plot_seek *)malloc((nrecords + 1) * sizeof(*seeks));
+    if (seeks == NULL) {
+        return false;
     }
-    current_line++; // Increment line counter, now shall be at the 2nd line
+    for (uint32_t i = 0; i < count; i++) {
+        const struct offset_list *list;
+        uint64_t offset = 0;
+        size_t pos = 0;
+        uint32_t idx;
 
-    // Combine the strings into the cwnd_plot_file buffer
-    snprintf(cwnd_plot_file_name, MAX_NAME_LENGTH, "cwnd_%u.txt", flowid);
-    printf("cwnd_plot_file_name: %s\n", cwnd_plot_file_name);
+        if (!flow_table_find(&f_basics->flow_table, flowids[i], &idx)) {
+            continue;
+        }
+        list = &f_basics->flow_offsets[idx];
+        while (n < nrecords && offset_list_next(list, &pos, &offset)) {
+            seeks[n].offset = offset;
+            seeks[n++].out = i;
+        }
+    }
+    if (count > 1) {
+        /* each list is in file order, interleave them */
+        qsort(seeks, n, sizeof(*seeks), cmp_plot_seek);
+    }
 
-    FILE *cwnd_file = fopen(cwnd_plot_file_name, "w");
-    if (!cwnd_file) {
-        PERROR_FUNCTION("Failed to open cwnd plot file for writing");
-        return;
+    /* relative timestamps start at the first record of the log */
+    if (first_usec < 0) {
+        if (reader_rewind_body(reader) != EXIT_SUCCESS) {
+            free(seeks);
+            return false;
+        }
+        first_usec = 0;
+        while (reader_next_record(reader, &record)) {
+            if (fill_fields_from_view(&rf, &record)) {
+                field_usec(&rf, TIMESTAMP, &first_usec);
+                break;
+            }
+        }
     }
+    plot_window(f_basics, first_usec, &lo, &hi);
+    if (time_window.has_from) {
+        uint64_t from = time_index_seek(&f_basics->time_index, lo, 0);
+        uint64_t high = n;
 
-    fprintf(cwnd_file, "##direction" TAB "relative_timestamp" TAB "cwnd" TAB
-            "ssthresh\n");
+        /* the first record at or after where the window starts */
+        while (k < high) {
+            uint64_t mid = k + (high - k) / 2;
 
-    while ((fgets(line, MAX_LINE_LENGTH, f_basics->file) != NULL) &&
-           (current_line != f_basics->num_lines)) {
-        char *fields[TOTAL_FIELDS];
+            if (seeks[mid].offset < from) {
+                k = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+    }
 
-        fill_fields_from_line(fields, line);
+    for (; k < n; k++) {
+        const char *line = reader->map + seeks[k].offset;
+        const char *nl = memchr(line, '\n',
+                                reader->footer_start - seeks[k].offset);
+        int64_t usec = 0;
 
-        if (first_flow_start_time == 0) {
-            first_flow_start_time = atof(fields[TIMESTAMP]);
-            relative_time_stamp = 0;
-        } else {
-            relative_time_stamp = atof(fields[TIMESTAMP]) - first_flow_start_time;
+        profile_count(PROF_BYTES_READ, (uint64_t)(nl - line) + 1);
+        if (!split_fields(line, strip_cr(line, (size_t)(nl - line)), &rf)) {
+            continue;
+        }
+        field_usec(&rf, TIMESTAMP, &usec);
+        if (usec < lo) {
+            continue;
         }
+        if (usec > hi) {
+            break;
+        }
+        plot_cwnd_record(plots, &plots->outs[seeks[k].out], &rf,
+                         usec - first_usec);
+    }
 
-        if (my_atol(fields[FLOW_ID]) == flowid) {
-            char t_flags_arr[TF_ARRAY_MAX_LENGTH] = {0};
-            char t_flags2_arr[TF2_ARRAY_MAX_LENGTH] = {0};
-            uint32_t t_flags = my_atol(fields[FLAG]);
-            uint32_t t_flags2 = my_atol(fields[FLAG2]);
+    free(seeks);
+    return true;
+}
 
-            translate_tflags(t_flags, t_flags_arr, sizeof(t_flags_arr));
-            translate_tflags2(t_flags2, t_flags2_arr, sizeof(t_flags2_arr));
+/* Write the cwnd plot files of many flows in one pass over the body */
+void
+stats_into_plot_files(struct file_basic_stats *f_basics,
+                      const uint32_t *flowids, uint32_t count)
+{
+    struct record_batch *batch;
+    struct plot_outputs plots;
+    uint32_t *out_of_flow;      /* flow_list index -> plots.outs index + 1 */
+    int64_t first_usec = f_basics->first_usec;  /* of the first record */
+    int64_t lo = INT64_MIN, hi = INT64_MAX;
+    uint64_t nrecords = 0;
+    bool past_window = false;
 
-            fprintf(cwnd_file, "%s" TAB "%.6f" TAB "%s" TAB "%s\n",
-                    fields[DIRECTION], relative_time_stamp, fields[CWND],
-                    fields[SSTHRESH]);
+    if (f_basics->sidx != NULL) {
+        sidx_into_plot_files(f_basics, flowids, count);
+        return;
+    }
+    if (use_columns) {
+        columns_into_plot_files(f_basics, flowids, count);
+        return;
+    }
+
+    out_of_flow = (uint32_t *)calloc(f_basics->flow_count, sizeof(uint32_t));
+    if (out_of_flow == NULL) {
+        PERROR_FUNCTION("calloc failed for out_of_flow");
+        return;
+    }
+    if (plot_outputs_init(&plots, flowids, count,
+                          cwnd_plot_header()) != EXIT_SUCCESS) {
+        plot_outputs_close(&plots);
+        free(out_of_flow);
+        return;
+    }
+    cwnd_decimate_init(f_basics, &plots);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t idx;
+
+        if (flow_table_find(&f_basics->flow_table, flowids[i], &idx)) {
+            out_of_flow[idx] = i + 1;
+            nrecords += f_basics->flow_list[idx].record_cnt;
         }
-        current_line++; // Increment line counter
     }
 
-    if (fclose(cwnd_file) == EOF) {
-        PERROR_FUNCTION("Failed to close cwnd_file");
+    /* sparse flows: jump straight to their records */
+    if (f_basics->flow_offsets != NULL &&
+        nrecords * PLOT_SEEK_RATIO < f_basics->num_lines &&
+        plot_by_offsets(f_basics, &plots, flowids, count, nrecords)) {
+        cwnd_decimate_flush(&plots);
+        plot_outputs_close(&plots);
+        free(out_of_flow);
+        return;
+    }
+
+    /* Go back to the first record, right after the head note */
+    batch = (struct record_batch *)malloc(sizeof(*batch));
+    if (batch == NULL ||
+        reader_rewind_body(&f_basics->reader) != EXIT_SUCCESS) {
+        PERROR_FUNCTION("Failed to read the log body");
+        plot_outputs_close(&plots);
+        free(out_of_flow);
+        free(batch);
+        return;
+    }
+
+    if (first_usec >= 0) {
+        plot_window(f_basics, first_usec, &lo, &hi);
+    }
+    if (time_window.has_from && first_usec >= 0 &&
+        f_basics->reader.is_mapped) {
+        /* jump close to where the window starts */
+        f_basics->reader.pos = time_index_seek(&f_basics->time_index, lo,
+                                               f_basics->reader.pos);
+    }
+
+    /* The reader stops at the foot note, or the end of the window */
+    batch->block.len = 0;
+    while (!past_window && next_record_batch(&f_basics->reader, batch)) {
+        for (size_t r = 0; r < batch->count; r++) {
+            struct record_fields *rf = &batch->records[r];
+            uint32_t flowid;
+            int64_t usec = 0;
+            uint32_t idx;
+
+            if (rf->field_cnt != TOTAL_FIELDS) {
+                continue;
+            }
+
+            field_usec(rf, TIMESTAMP, &usec);
+            if (first_usec < 0) {
+                first_usec = usec;
+                plot_window(f_basics, first_usec, &lo, &hi);
+            }
+            if (usec < lo) {
+                continue;
+            }
+            if (usec > hi) {
+                past_window = true;
+                break;
+            }
+
+            if (field_u32(rf, FLOW_ID, &flowid) == EXIT_SUCCESS &&
+                flow_table_find_cached(&f_basics->flow_table, flowid, &idx) &&
+                out_of_flow[idx] != 0) {
+                plot_cwnd_record(&plots, &plots.outs[out_of_flow[idx] - 1], rf,
+                                 usec - first_usec);
+            }
+        }
     }
+
+    cwnd_decimate_flush(&plots);
+    plot_outputs_close(&plots);
+    free(out_of_flow);
+    free(batch);
 }
 
+/* Options that only have a long name */
+enum {
+    OPT_FROM = 256,
+    OPT_TO,
+    OPT_MAX_POINTS,
+    OPT_EXPORT,
+};
+
 int main(int argc, char *argv[]) {
     /* Record the start time */
     struct timeval start, end;
 
     gettimeofday(&start, NULL);
+    profile_init();
 
     struct file_basic_stats f_basics = {0};
 
-    int opt, idx;
+    int opt;
     int opt_idx = 0;
     bool opt_match = false, f_opt_match = false;
+    bool follow = false, stream = false, batch;
+    const char *file_name = NULL, *flow_spec = NULL;
     struct option long_opts[] = {
         {"help", no_argument, 0, 'h'},
         {"file", required_argument, 0, 'f'},
         {"stats", required_argument, 0, 's'},
         {"verbose", no_argument, 0, 'v'},
+        {"jobs", required_argument, 0, 'j'},
+        {"index", no_argument, 0, 'i'},
+        {"follow", no_argument, 0, 'F'},
+        {"tflags", no_argument, 0, 't'},
+        {"out-dir", required_argument, 0, 'o'},
+        {"writer-thread", no_argument, 0, 'w'},
+        {"metrics", no_argument, 0, 'm'},
+        {"profile", optional_argument, 0, 'P'},
+        {"columns", no_argument, 0, 'c'},
+        {"bucket", required_argument, 0, 'b'},
+        {"events", no_argument, 0, 'e'},
+        {"occupancy", no_argument, 0, 'O'},
+        {"from", required_argument, 0, OPT_FROM},
+        {"to", required_argument, 0, OPT_TO},
+        {"max-points", required_argument, 0, OPT_MAX_POINTS},
+        {"export", required_argument, 0, OPT_EXPORT},
         {0, 0, 0, 0}
     };
 
     // Process command-line arguments
-    while ((opt = getopt_long(argc, argv, "vhf:s:", long_opts, &opt_idx)) != -1) {
+    while ((opt = getopt_long(argc, argv, "vhf:s:j:iFto:wmP::cb:eO", long_opts, &opt_idx)) != -1) {
         switch (opt) {
             case 'v':
                 verbose = opt_match = true;
                 printf("verbose mode enabled\n");
                 break;
+            case 'j':
+                opt_match = true;
+                if (parse_u32(optarg, strlen(optarg), &jobs) != EXIT_SUCCESS ||
+                    jobs == 0) {
+                    printf("invalid number of jobs: %s\n", optarg);
+                    printf("Usage: %s [-v | h] [-j jobs] [-F] [-f file_name] [-s flow_id] [log|dir]...\n", argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'i':
+                use_index = opt_match = true;
+                break;
+            case 'F':
+                follow = opt_match = true;
+                break;
+            case 't':
+                show_tflags = opt_match = true;
+                break;
+            case 'o':
+                opt_match = true;
+                if (mkdir(optarg, 0755) != 0 && errno != EEXIST) {
+                    PERROR_FUNCTION("Failed to create the output directory");
+                    return EXIT_FAILURE;
+                }
+                out_dir = optarg;
+                break;
+            case 'w':
+                use_writer_thread = opt_match = true;
+                break;
+            case 'm':
+                show_metrics = opt_match = true;
+                break;
+            case 'c':
+                use_columns = opt_match = true;
+                break;
+            case 'b':
+                opt_match = true;
+                if (parse_interval(optarg, &bucket_usec) != EXIT_SUCCESS) {
+                    printf("invalid bucket interval: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_FROM:
+            case OPT_TO:
+                opt_match = true;
+                if (parse_seconds(optarg, (opt == OPT_FROM) ?
+                                  &time_window.from_usec :
+                                  &time_window.to_usec) != EXIT_SUCCESS) {
+                    printf("invalid time: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                time_window.has_from |= (opt == OPT_FROM);
+                time_window.has_to |= (opt == OPT_TO);
+                break;
+            case OPT_MAX_POINTS:
+                opt_match = true;
+                if (parse_u32(optarg, strlen(optarg), &max_points) !=
+                    EXIT_SUCCESS) {
+                    printf("invalid number of points: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                if (max_points < DECIMATE_MIN_POINTS) {
+                    printf("--max-points needs at least %d points\n",
+                           DECIMATE_MIN_POINTS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_EXPORT:
+                opt_match = true;
+                export_file_name = optarg;
+                break;
+            case 'e':
+                show_events = opt_match = true;
+                break;
+            case 'O':
+                show_occupancy = opt_match = true;
+                break;
+            case 'P':
+                opt_match = true;
+                if (optarg == NULL || strcmp(optarg, "table") == 0) {
+                    profile_format = PROFILE_TABLE;
+                } else if (strcmp(optarg, "json") == 0) {
+                    profile_format = PROFILE_JSON;
+                } else {
+                    printf("unknown profile format: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
             case 'h':
                 opt_match = true;
                 printf("Usage: %s [options]\n", argv[0]);
+                printf("       %s [-j N] [-i] log|dir|glob...\n", argv[0]);
                 printf(" -h, --help          Display this help message\n");
-                printf(" -f, --file          Get siftr log basics\n");
-                printf(" -s, --stats flowid  Get stats from flowid\n");
+                printf(" -f, --file          Get siftr log basics, \"-\" or a pipe is\n"
+                       "                     read in a single pass\n");
+                printf(" -s, --stats flowids Get stats from flowids, given as\n"
+                       "                     id[,id|,low-high]... or all\n");
                 printf(" -v, --verbose       Verbose mode\n");
+                printf(" -j, --jobs N        Parse the log body with N threads\n");
+                printf(" -i, --index         Use <file>.sidx, created if missing or\n"
+                       "                     stale\n");
+                printf(" -F, --follow        Follow a log that is still being\n"
+                       "                     written until its foot note shows up\n");
+                printf(" -t, --tflags        Add the decoded t_flags and t_flags2\n"
+                       "                     to the cwnd plot files\n");
+                printf(" -o, --out-dir DIR   Write the plot files to DIR, created if\n"
+                       "                     missing\n");
+                printf(" -w, --writer-thread Write the plot files from a separate\n"
+                       "                     thread\n");
+                printf(" -m, --metrics       Show min, max, mean, time weighted\n"
+                       "                     mean and p50/p95/p99 of cwnd, srtt,\n"
+                       "                     rto, inflight, windows and send buffer\n"
+                       "                     per flow\n");
+                printf(" -P, --profile[=json] Time each phase and count bytes,\n"
+                       "                     records and probes, shown at the end\n"
+                       "                     as a table or as JSON\n");
+                printf(" -c, --columns       Load the records into per-flow columns\n"
+                       "                     that -s and -m are served from\n");
+                printf(" -b, --bucket INTERVAL Write per flow mean/max cwnd, max\n"
+                       "                     inflight and packet counts every\n"
+                       "                     INTERVAL (10ms, 1s, ...) to\n"
+                       "                     bucket_<flowid>.txt\n");
+                printf(" -e, --events        Find when each flow was in fast or\n"
+                       "                     congestion recovery, sent ECN CWR or\n"
+                       "                     ECE, or had an RTO cut cwnd, written\n"
+                       "                     to events_<flowid>.txt\n");
+                printf(" -O, --occupancy     Show the share of the records and of\n"
+                       "                     the time each t_flags and t_flags2\n"
+                       "                     bit was set per flow\n");
+                printf("     --from SECS     Only plot the records from SECS on,\n"
+                       "     --to SECS       and up to SECS, in seconds after the\n"
+                       "                     first record or as a unix time\n");
+                printf("     --max-points N  Write at most N cwnd plot points per\n"
+                       "                     flow, keeping the first, last, min\n"
+                       "                     and max cwnd of each stretch of\n"
+                       "                     records of a direction\n");
+                printf("     --export FILE   Write the records of the -s flows to\n"
+                       "                     FILE as an Arrow IPC stream, one typed\n"
+                       "                     column per field, instead of the cwnd\n"
+                       "                     plot files\n");
+                printf(" log|dir|glob...     Without -f, read every log given, in a\n"
+                       "                     directory or matching a glob, on -j\n"
+                       "                     threads and show one summary of their\n"
+                       "                     durations, flows and skipped packets\n");
                 break;
             case 'f':
+                /* the log is read once all the options are known */
                 f_opt_match = opt_match = true;
-                printf("input file name: %s\n", optarg);
-                if (get_file_basics(&f_basics, optarg) != EXIT_SUCCESS) {
-                    PERROR_FUNCTION("get_file_basics() failed");
-                    return EXIT_FAILURE;
-                }
-                show_file_basic_stats(&f_basics);
+                file_name = optarg;
                 break;
             case 's':
                 opt_match = true;
-                printf("input flow id is: %s", optarg);
-                if (!f_opt_match) {
-                    printf(", but no data file is given\n");
-                    return EXIT_FAILURE;
-                } else {
-                    printf("\n");
-                }
-                uint32_t flowid = (uint32_t)my_atol(optarg);
-                if (is_flowid_in_file(&f_basics, flowid, &idx)) {
-                    read_body_by_flowid(&f_basics, flowid);
-                } else {
-                    printf("flow ID %u not found\n", flowid);
-                }
+                flow_spec = optarg;
                 break;
             default:
-                printf("Usage: %s [-v | h] [-f file_name] [-s flow_id]\n", argv[0]);
+                printf("Usage: %s [-v | h] [-j jobs] [-F] [-f file_name] [-s flow_id] [log|dir]...\n", argv[0]);
                 return EXIT_FAILURE;
         }
     }
 
-    /* Handle case where no options are provided or non-option arguments */
-    if (!opt_match) {
+    if (f_opt_match) {
+        printf("input file name: %s\n", file_name);
+        stream = !follow && is_stream_input(file_name);
+    }
+    if (flow_spec != NULL && !f_opt_match) {
+        printf("input flow id is: %s, but no data file is given\n", flow_spec);
+        return EXIT_FAILURE;
+    }
+    if (flow_spec != NULL && (follow || stream) && export_file_name != NULL) {
+        printf("--export needs a log that can be read again\n");
+        return EXIT_FAILURE;
+    }
+
+    /* The other arguments are logs, directories or globs to summarize */
+    batch = (optind < argc);
+    if (batch) {
+        if (f_opt_match || follow) {
+            printf("logs to summarize can not be given with -f or -F\n");
+            return EXIT_FAILURE;
+        }
+        if (batch_main(argv + optind, (uint32_t)(argc - optind)) !=
+            EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Handle case where no options are provided */
+    if (!opt_match && !batch) {
         printf("Un-expected argument!\n");
-        printf("Usage: %s [-v] [-h] [-f file_name] [-s flow_id]\n", argv[0]);
+        printf("Usage: %s [-v] [-h] [-j jobs] [-F] [-f file_name] [-s flow_id] [log|dir]...\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-    if (opt_match && !f_opt_match) {
+    if (opt_match && !f_opt_match && !batch) {
         return EXIT_SUCCESS;
     }
 
-    if (cleanup_file_basic_stats(&f_basics) != EXIT_SUCCESS) {
+    if (follow || stream) {
+        if (flow_spec != NULL) {
+            printf("input flow id is: %s\n", flow_spec);
+        }
+        if (follow_file(&f_basics, file_name, flow_spec, follow) !=
+            EXIT_SUCCESS) {
+            PERROR_FUNCTION("follow_file() failed");
+            return EXIT_FAILURE;
+        }
+    } else if (f_opt_match) {
+        select_flows = (flow_spec != NULL);
+        if (get_file_basics(&f_basics, file_name) != EXIT_SUCCESS) {
+            PERROR_FUNCTION("get_file_basics() failed");
+            return EXIT_FAILURE;
+        }
+        show_file_basic_stats(&f_basics);
+        if (bucket_usec > 0) {
+            write_flow_buckets(&f_basics);
+        }
+        if (show_events) {
+            write_flow_events(&f_basics);
+        }
+        if (show_occupancy) {
+            show_flow_occupancy(&f_basics);
+        }
+    }
+
+    if (flow_spec != NULL && !follow && !stream) {
+        uint32_t *flowids;
+        uint32_t flowid_cnt;
+
+        printf("input flow id is: %s\n", flow_spec);
+        if (select_flowids(&f_basics, flow_spec, &flowids,
+                           &flowid_cnt) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        if (flowid_cnt > 0) {
+            read_body_by_flowids(&f_basics, flowids, flowid_cnt);
+        }
+        free(flowids);
+    }
+
+    if (!batch && cleanup_file_basic_stats(&f_basics) != EXIT_SUCCESS) {
         PERROR_FUNCTION("terminate_file_basics() failed");
     }
 
+    if (run_profile.counters[PROF_MALFORMED] > 0) {
+        printf("\nskipped %" PRIu64 " malformed lines\n",
+               run_profile.counters[PROF_MALFORMED]);
+    }
+
+    if (profile_format != PROFILE_OFF) {
+        /* the probes of this thread, the workers have added theirs */
+        profile_count(PROF_HASH_PROBES, flow_probe_cnt);
+        profile_report();
+    }
+
     // Record the end time
     gettimeofday(&end, NULL);
     // Calculate the time taken in seconds and microseconds
@@ -19,12 +19,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 enum {
     INP_IPV4 = 0x1, INP_IPV6 = 0x2,
     MAX_LINE_LENGTH = 1000,
+    LAST_LINE_BLOCK_SIZE = (16 << 10),
     MAX_NAME_LENGTH = 100,
     INET6_ADDRSTRLEN = 46,
     TF_ARRAY_MAX_LENGTH = 550,
@@ -36,6 +38,10 @@ enum {
 #define TAB_DELIMITER       "\t"
 #define TAB         TAB_DELIMITER
 #define EQUAL_DELIMITER     "="
+#define CWND_PLOT_HEADER    "##direction" TAB "relative_timestamp" TAB "cwnd" \
+                            TAB "ssthresh\n"
+#define CWND_PLOT_HEADER_TFLAGS "##direction" TAB "relative_timestamp" TAB \
+                            "cwnd" TAB "ssthresh" TAB "t_flags" TAB "t_flags2\n"
 
 #define PERROR_FUNCTION(msg) \
         do {                                                                \
@@ -47,6 +53,16 @@ enum {
 #define GET_VALUE(field) \
         my_atol(next_sub_str_from(field, EQUAL_DELIMITER));
 
+#include "siftr_profile.h"
+#include "siftr_reader.h"
+#include "siftr_parse.h"
+#include "siftr_flow_table.h"
+#include "siftr_offsets.h"
+#include "siftr_plot.h"
+#include "siftr_stats.h"
+#include "siftr_bucket.h"
+#include "siftr_range.h"
+
 enum {
     ENABLE_TIME_SECS,
     ENABLE_TIME_USECS,
@@ -107,6 +123,24 @@ enum {
     TOTAL_FIELDS,
 };
 
+/* Field boundaries of one record, the record itself is not modified. */
+struct record_fields {
+    const char  *line;
+    uint32_t    field_cnt;
+    uint16_t    start[TOTAL_FIELDS + 1];    /* start[i + 1] - 1 ends field i */
+};
+
+#define FIELD_PTR(rf, i)    ((rf)->line + (rf)->start[(i)])
+#define FIELD_LEN(rf, i)    ((rf)->start[(i) + 1] - (rf)->start[(i)] - 1)
+
+#include "siftr_split.h"
+
+struct record_batch {
+    struct line_view        block;      /* records not split yet */
+    size_t                  count;
+    struct record_fields    records[RECORD_BATCH_SIZE];
+};
+
 struct flow_info {
     char        laddr[INET6_ADDRSTRLEN];    /* local IP address */
     char        faddr[INET6_ADDRSTRLEN];    /* foreign IP address */
@@ -116,15 +150,27 @@ struct flow_info {
     uint32_t    flowid;                 /* flowid of the connection */
     uint32_t    record_cnt;
     bool        is_info_set;
+    struct flow_stats *stats;           /* with -m, NULL until the 1st record */
+    struct flow_columns *cols;          /* with -c, NULL until the 1st record */
+    struct bucket_series *buckets;      /* with --bucket, NULL until the 1st */
+    struct flow_events *events;         /* with --events, NULL until the 1st */
+    struct flow_occupancy *occupancy;   /* with --occupancy, NULL until the 1st */
 };
 
 struct file_basic_stats {
     FILE                    *file;
+    struct log_reader       reader;
     uint32_t                num_lines;
     uint32_t                flow_count;
     struct flow_info        *flow_list;
+    struct flow_table       flow_table;     /* flowid -> flow_list index */
+    struct offset_list      *flow_offsets;  /* per flow record offsets, mmap */
     struct first_line_fields *first_line_stats;
     struct last_line_fields  *last_line_stats;
+    struct sidecar_index    *sidx;          /* set if loaded from <log>.sidx */
+    int64_t                 first_usec;     /* of the first record, -1 if not
+                                               known, the origin of times */
+    struct time_index       time_index;     /* sparse, of a mapped log */
 };
 
 /* Flags for the tp->t_flags field. */
@@ -161,113 +207,54 @@ enum {
     TF2_NO_ISS_CHECK = 0x00400000,
 };
 
+#include "siftr_tflags.h"
+#include "siftr_events.h"
+#include "siftr_occupancy.h"
+
 extern bool verbose;
+extern bool show_tflags;
+extern uint32_t jobs;
+extern bool use_index;
+extern bool show_metrics;
+extern bool use_columns;
+extern bool select_flows;
+extern const char *export_file_name;
 void stats_into_plot_file(struct file_basic_stats *f_basics, uint32_t flowid);
+void stats_into_plot_files(struct file_basic_stats *f_basics,
+                           const uint32_t *flowids, uint32_t count);
+int64_t get_body_stats_parallel(struct file_basic_stats *f_basics,
+                                uint32_t nthreads);
+int sidx_build(struct file_basic_stats *f_basics, const char *log_name);
+int sidx_load(struct file_basic_stats *f_basics, const char *log_name);
+void sidx_close(struct file_basic_stats *f_basics);
+void sidx_into_plot_files(struct file_basic_stats *f_basics,
+                          const uint32_t *flowids, uint32_t count);
+int flow_columns_record(struct flow_info *flow, const struct record_fields *rf);
+void flow_columns_free(struct flow_columns *fc);
+void columns_flow_stats(struct file_basic_stats *f_basics);
+size_t columns_size(const struct file_basic_stats *f_basics);
+void columns_into_plot_files(struct file_basic_stats *f_basics,
+                             const uint32_t *flowids, uint32_t count);
+void cwnd_decimate(struct plot_output *out, char direction,
+                   int64_t relative_usec, uint32_t cwnd, uint32_t ssthresh,
+                   uint32_t t_flags, uint32_t t_flags2);
+int cwnd_decimate_add(struct plot_output *out);
+void cwnd_decimate_init(const struct file_basic_stats *f_basics,
+                        struct plot_outputs *plots);
+void cwnd_decimate_flush(struct plot_outputs *plots);
+int export_flows(struct file_basic_stats *f_basics, const uint32_t *flowids,
+                 uint32_t count);
 
 /* There are 32 flag values for t_flags. So assume the caller has provided a
  * large enough array to hold 32 x sizeof("TF_CONGRECOVERY |") == 544 bytes.
+ * The names are appended to what str_array already holds.
  */
 void
 translate_tflags(uint32_t t_flags, char str_array[], uint32_t arr_size)
 {
     assert(arr_size >= (32 * sizeof("TF_CONGRECOVERY")));
 
-    if (t_flags & TF_ACKNOW) {
-        strcat(str_array, "TF_ACKNOW | ");
-    }
-    if (t_flags & TF_DELACK) {
-        strcat(str_array, "TF_DELACK | ");
-    }
-    if (t_flags & TF_NODELAY) {
-        strcat(str_array, "TF_NODELAY | ");
-    }
-    if (t_flags & TF_NOOPT) {
-        strcat(str_array, "TF_NOOPT | ");
-    }
-    if (t_flags & TF_SENTFIN) {
-        strcat(str_array, "TF_SENTFIN | ");
-    }
-    if (t_flags & TF_REQ_SCALE) {
-        strcat(str_array, "TF_REQ_SCALE | ");
-    }
-    if (t_flags & TF_RCVD_SCALE) {
-        strcat(str_array, "TF_RCVD_SCALE | ");
-    }
-    if (t_flags & TF_REQ_TSTMP) {
-        strcat(str_array, "TF_REQ_TSTMP | ");
-    }
-    if (t_flags & TF_RCVD_TSTMP) {
-        strcat(str_array, "TF_RCVD_TSTMP | ");
-    }
-    if (t_flags & TF_SACK_PERMIT) {
-        strcat(str_array, "TF_SACK_PERMIT | ");
-    }
-    if (t_flags & TF_NEEDSYN) {
-        strcat(str_array, "TF_NEEDSYN | ");
-    }
-    if (t_flags & TF_NEEDFIN) {
-        strcat(str_array, "TF_NEEDFIN | ");
-    }
-    if (t_flags & TF_NOPUSH) {
-        strcat(str_array, "TF_NOPUSH | ");
-    }
-    if (t_flags & TF_PREVVALID) {
-        strcat(str_array, "TF_PREVVALID | ");
-    }
-    if (t_flags & TF_WAKESOR) {
-        strcat(str_array, "TF_WAKESOR | ");
-    }
-    if (t_flags & TF_GPUTINPROG) {
-        strcat(str_array, "TF_GPUTINPROG | ");
-    }
-    if (t_flags & TF_MORETOCOME) {
-        strcat(str_array, "TF_MORETOCOME | ");
-    }
-    if (t_flags & TF_SONOTCONN) {
-        strcat(str_array, "TF_SONOTCONN | ");
-    }
-    if (t_flags & TF_LASTIDLE) {
-        strcat(str_array, "TF_LASTIDLE | ");
-    }
-    if (t_flags & TF_RXWIN0SENT) {
-        strcat(str_array, "TF_RXWIN0SENT | ");
-    }
-    if (t_flags & TF_FASTRECOVERY) {
-        strcat(str_array, "TF_FASTRECOVERY | ");
-    }
-    if (t_flags & TF_WASFRECOVERY) {
-        strcat(str_array, "TF_WASFRECOVERY | ");
-    }
-    if (t_flags & TF_SIGNATURE) {
-        strcat(str_array, "TF_SIGNATURE | ");
-    }
-    if (t_flags & TF_FORCEDATA) {
-        strcat(str_array, "TF_FORCEDATA | ");
-    }
-    if (t_flags & TF_TSO) {
-        strcat(str_array, "TF_TSO | ");
-    }
-    if (t_flags & TF_TOE) {
-        strcat(str_array, "TF_TOE | ");
-    }
-    if (t_flags & TF_CLOSED) {
-        strcat(str_array, "TF_CLOSED | ");
-    }
-    if (t_flags & TF_SENTSYN) {
-        strcat(str_array, "TF_SENTSYN | ");
-    }
-    if (t_flags & TF_LRD) {
-        strcat(str_array, "TF_LRD | ");
-    }
-    if (t_flags & TF_CONGRECOVERY) {
-        strcat(str_array, "TF_CONGRECOVERY | ");
-    }
-    if (t_flags & TF_WASCRECOVERY) {
-        strcat(str_array, "TF_WASCRECOVERY | ");
-    }
-    if (t_flags & TF_FASTOPEN) {
-        strcat(str_array, "TF_FASTOPEN | ");
-    }
+    tflags_decode(t_flags, tflags_names, str_array + strlen(str_array));
 }
 
 /* There are totally 23 values for t_flags2. So assume the caller has provided a
@@ -279,75 +266,7 @@ translate_tflags2(uint32_t t_flags2, char str_array[], uint32_t arr_size)
 {
     assert(arr_size >= (23 * sizeof("TF2_PROC_SACK_PROHIBIT")));
 
-    if (t_flags2 & TF2_PLPMTU_BLACKHOLE) {
-        strcat(str_array, "TF2_PLPMTU_BLACKHOLE | ");
-    }
-    if (t_flags2 & TF2_PLPMTU_PMTUD) {
-        strcat(str_array, "TF2_PLPMTU_PMTUD | ");
-    }
-    if (t_flags2 & TF2_PLPMTU_MAXSEGSNT) {
-        strcat(str_array, "TF2_PLPMTU_MAXSEGSNT | ");
-    }
-    if (t_flags2 & TF2_LOG_AUTO) {
-        strcat(str_array, "TF2_LOG_AUTO | ");
-    }
-    if (t_flags2 & TF2_DROP_AF_DATA) {
-        strcat(str_array, "TF2_DROP_AF_DATA | ");
-    }
-    if (t_flags2 & TF2_ECN_PERMIT) {
-        strcat(str_array, "TF2_ECN_PERMIT | ");
-    }
-    if (t_flags2 & TF2_ECN_SND_CWR) {
-        strcat(str_array, "TF2_ECN_SND_CWR | ");
-    }
-    if (t_flags2 & TF2_ECN_SND_ECE) {
-        strcat(str_array, "TF2_ECN_SND_ECE | ");
-    }
-    if (t_flags2 & TF2_ACE_PERMIT) {
-        strcat(str_array, "TF2_ACE_PERMIT | ");
-    }
-    if (t_flags2 & TF2_HPTS_CPU_SET) {
-        strcat(str_array, "TF2_HPTS_CPU_SET | ");
-    }
-    if (t_flags2 & TF2_FBYTES_COMPLETE) {
-        strcat(str_array, "TF2_FBYTES_COMPLETE | ");
-    }
-    if (t_flags2 & TF2_ECN_USE_ECT1) {
-        strcat(str_array, "TF2_ECN_USE_ECT1 | ");
-    }
-    if (t_flags2 & TF2_TCP_ACCOUNTING) {
-        strcat(str_array, "TF2_TCP_ACCOUNTING | ");
-    }
-    if (t_flags2 & TF2_HPTS_CALLS) {
-        strcat(str_array, "TF2_HPTS_CALLS | ");
-    }
-    if (t_flags2 & TF2_MBUF_L_ACKS) {
-        strcat(str_array, "TF2_MBUF_L_ACKS | ");
-    }
-    if (t_flags2 & TF2_MBUF_ACKCMP) {
-        strcat(str_array, "TF2_MBUF_ACKCMP | ");
-    }
-    if (t_flags2 & TF2_SUPPORTS_MBUFQ) {
-        strcat(str_array, "TF2_SUPPORTS_MBUFQ | ");
-    }
-    if (t_flags2 & TF2_MBUF_QUEUE_READY) {
-        strcat(str_array, "TF2_MBUF_QUEUE_READY | ");
-    }
-    if (t_flags2 & TF2_DONT_SACK_QUEUE) {
-        strcat(str_array, "TF2_DONT_SACK_QUEUE | ");
-    }
-    if (t_flags2 & TF2_CANNOT_DO_ECN) {
-        strcat(str_array, "TF2_CANNOT_DO_ECN | ");
-    }
-    if (t_flags2 & TF2_PROC_SACK_PROHIBIT) {
-        strcat(str_array, "TF2_PROC_SACK_PROHIBIT | ");
-    }
-    if (t_flags2 & TF2_IPSEC_TSO) {
-        strcat(str_array, "TF2_IPSEC_TSO | ");
-    }
-    if (t_flags2 & TF2_NO_ISS_CHECK) {
-        strcat(str_array, "TF2_NO_ISS_CHECK | ");
-    }
+    tflags_decode(t_flags2, tflags2_names, str_array + strlen(str_array));
 }
 
 void
@@ -395,6 +314,208 @@ fill_flow_info(struct flow_info *target_flow, char *fields[])
     }
 }
 
+/* Same as my_atol(), but on a field that is not NUL terminated. */
+long int
+field_atol(const struct record_fields *rf, int idx)
+{
+    const char *str = FIELD_PTR(rf, idx);
+    char *endptr;
+    long int number;
+    errno = 0;
+    number = strtol(str, &endptr, 10);
+
+    if (errno == ERANGE) {
+        PERROR_FUNCTION("The number is out of range for a long integer.");
+    } else if (str == endptr) {
+        PERROR_FUNCTION("No digits were found in the string.");
+    } else if (endptr != str + FIELD_LEN(rf, idx)) {
+        printf("Converted number: %ld\n", number);
+        printf("Remaining field after number: \"%.*s\"\n",
+               (int)(str + FIELD_LEN(rf, idx) - endptr), endptr);
+        PERROR_FUNCTION("Partial digits from the string");
+    }
+
+    return number;
+}
+
+/* Parse an unsigned decimal field, *value is left as is on failure. */
+static inline int
+field_u32(const struct record_fields *rf, int idx, uint32_t *value)
+{
+    return parse_u32(FIELD_PTR(rf, idx), FIELD_LEN(rf, idx), value);
+}
+
+/* Parse a "seconds.microseconds" field into microseconds. */
+static inline int
+field_usec(const struct record_fields *rf, int idx, int64_t *usec)
+{
+    return parse_usec(FIELD_PTR(rf, idx), FIELD_LEN(rf, idx), usec);
+}
+
+static inline void
+copy_field(char *dst, size_t dst_size, const struct record_fields *rf, int idx)
+{
+    size_t len = FIELD_LEN(rf, idx);
+
+    if (len >= dst_size) {
+        len = dst_size - 1;
+    }
+    memcpy(dst, FIELD_PTR(rf, idx), len);
+    dst[len] = '\0';
+}
+
+void
+fill_flow_info_from_view(struct flow_info *target_flow,
+                         const struct record_fields *rf)
+{
+    if (target_flow != NULL) {
+        copy_field(target_flow->laddr, sizeof(target_flow->laddr), rf, LOIP);
+        target_flow->lport = (uint16_t)field_atol(rf, LPORT);
+        copy_field(target_flow->faddr, sizeof(target_flow->faddr), rf, FOIP);
+        target_flow->fport = (uint16_t)field_atol(rf, FPORT);
+        target_flow->is_info_set = true;
+    }
+}
+
+/* The record field of each METRIC_* */
+static const int metric_fields[METRIC_COUNT] = {
+    CWND, SRTT, RTO, INFLIGHT_BYTES, SNDWIN, RCVWIN, SND_BUF_CC,
+};
+
+/* Add a record to the running stats of its flow, with -m */
+static inline void
+flow_stats_record(struct flow_info *flow, const struct record_fields *rf)
+{
+    uint64_t values[METRIC_COUNT];
+    int64_t usec;
+
+    if (field_usec(rf, TIMESTAMP, &usec) != EXIT_SUCCESS) {
+        return;
+    }
+    if (flow->stats == NULL) {
+        flow->stats = (struct flow_stats *)calloc(1, sizeof(struct flow_stats));
+        if (flow->stats == NULL) {
+            PERROR_FUNCTION("calloc failed for flow->stats");
+            return;
+        }
+    }
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        uint32_t value = 0;
+
+        field_u32(rf, metric_fields[m], &value);
+        values[m] = value;
+    }
+    flow_stats_add(flow->stats, usec, values);
+}
+
+/* Add a record to the interval of its flow it falls in, with --bucket */
+static inline void
+flow_bucket_record(struct flow_info *flow, const struct record_fields *rf,
+                   int64_t first_usec)
+{
+    uint32_t cwnd = 0, inflight = 0;
+    int64_t usec;
+
+    if (field_usec(rf, TIMESTAMP, &usec) != EXIT_SUCCESS) {
+        return;
+    }
+    if (flow->buckets == NULL) {
+        flow->buckets = (struct bucket_series *)
+            calloc(1, sizeof(struct bucket_series));
+        if (flow->buckets == NULL) {
+            PERROR_FUNCTION("calloc failed for flow->buckets");
+            return;
+        }
+    }
+    field_u32(rf, CWND, &cwnd);
+    field_u32(rf, INFLIGHT_BYTES, &inflight);
+    bucket_series_add(flow->buckets, bucket_index(usec, first_usec),
+                      *FIELD_PTR(rf, DIRECTION), cwnd, inflight);
+}
+
+/* Add a record to the congestion events of its flow, with --events */
+static inline void
+flow_events_record(struct flow_info *flow, const struct record_fields *rf)
+{
+    uint32_t t_flags = 0, t_flags2 = 0, cwnd = 0, ssthresh = 0, mss = 0;
+    struct flow_events *ev = flow->events;
+    int64_t usec;
+
+    if (ev == NULL) {
+        ev = flow->events = (struct flow_events *)
+            calloc(1, sizeof(struct flow_events));
+        if (ev == NULL) {
+            PERROR_FUNCTION("calloc failed for flow->events");
+            return;
+        }
+    }
+    field_u32(rf, FLAG, &t_flags);
+    field_u32(rf, FLAG2, &t_flags2);
+    field_u32(rf, CWND, &cwnd);
+    field_u32(rf, SSTHRESH, &ssthresh);
+
+    /* the time only matters next to an event, or during an episode */
+    usec = ev->last_usec;
+    if (ev->records == 0 || cwnd < ev->last_cwnd ||
+        ((TFLAGS_STATE(t_flags, t_flags2) | ev->last_state) &
+         EVENT_STATE_MASK) != 0) {
+        if (field_usec(rf, TIMESTAMP, &usec) != EXIT_SUCCESS) {
+            return;
+        }
+        field_u32(rf, MSS, &mss);
+    }
+    flow_events_add(ev, usec, t_flags, t_flags2, cwnd, ssthresh, mss);
+}
+
+/* Add a record to the flag occupancy of its flow, with --occupancy */
+static inline void
+flow_occupancy_record(struct flow_info *flow, const struct record_fields *rf)
+{
+    uint32_t t_flags = 0, t_flags2 = 0;
+    int64_t usec;
+
+    if (flow->occupancy == NULL) {
+        flow->occupancy = (struct flow_occupancy *)
+            calloc(1, sizeof(struct flow_occupancy));
+        if (flow->occupancy == NULL) {
+            PERROR_FUNCTION("calloc failed for flow->occupancy");
+            return;
+        }
+    }
+    if (field_usec(rf, TIMESTAMP, &usec) != EXIT_SUCCESS) {
+        return;
+    }
+    field_u32(rf, FLAG, &t_flags);
+    field_u32(rf, FLAG2, &t_flags2);
+    flow_occupancy_add(flow->occupancy, usec, t_flags, t_flags2);
+}
+
+/* The --from/--to bounds, for relative times that start at first_usec */
+static inline void
+plot_window(const struct file_basic_stats *f_basics, int64_t first_usec,
+            int64_t *lo, int64_t *hi)
+{
+    const struct timeval *enable = &f_basics->first_line_stats->enable_time;
+
+    time_window_bounds(first_usec,
+                       (int64_t)enable->tv_sec * 1000000 + enable->tv_usec,
+                       lo, hi);
+}
+
+/* Look at one record of the body pass; every stride-th one gets a mark */
+static inline int
+time_index_note(struct time_index *ti, const struct record_fields *rf,
+                const char *map)
+{
+    int64_t usec;
+
+    if (ti->seen++ % ti->stride != 0 ||
+        field_usec(rf, TIMESTAMP, &usec) != EXIT_SUCCESS) {
+        return EXIT_SUCCESS;
+    }
+    return time_index_push(ti, usec, (uint64_t)(rf->line - map));
+}
+
 void
 timeval_subtract(struct timeval *result, const struct timeval *t1,
                  const struct timeval *t2)
@@ -420,9 +541,10 @@ next_sub_str_from(char *str, const char *restrict delimiter)
 {
     char *str1 = NULL;
     char *str2 = NULL;
+    char *save;
 
-    str1 = strtok(str, delimiter);
-    str2 = strtok(NULL, delimiter);
+    str1 = strtok_r(str, delimiter, &save);
+    str2 = strtok_r(NULL, delimiter, &save);
 
     if (str1 == NULL || str2 == NULL) {
         PERROR_FUNCTION("Invalid input string.");
@@ -431,52 +553,110 @@ next_sub_str_from(char *str, const char *restrict delimiter)
     return str2;
 }
 
-/* Function to read the last line of a file */
+/*
+ * Read the last line of a file, without its line terminator, into a buffer
+ * that the caller frees. The file is read backwards a block at a time and
+ * each block is scanned with memrchr(), so a foot note carrying a long
+ * flowid_list takes a few reads however long it is.
+ */
 int
-read_last_line(FILE *file, char *lastLine)
+read_last_line(FILE *file, char **lastLine)
 {
-    long fileSize;
-    int pos;
+    int fd = fileno(file);
+    struct stat st;
+    char *buf = NULL;
+    size_t cap = 0;
+    off_t size, off, line_start = 0, line_end = -1;
 
     if (lastLine == NULL) {
         PERROR_FUNCTION("empty buffer");
         return EXIT_FAILURE;
     }
+    if (fstat(fd, &st) != 0) {
+        PERROR_FUNCTION("fstat");
+        return EXIT_FAILURE;
+    }
+    size = off = st.st_size;
+
+    /* buf holds the bytes from off to the end of the file at its end */
+    while (off > 0) {
+        size_t n = (off > LAST_LINE_BLOCK_SIZE) ? LAST_LINE_BLOCK_SIZE :
+                   (size_t)off;
+        size_t have = (size_t)(size - off);
+        size_t scan = n;
+        char *blk, *nl;
+
+        if (have + n > cap) {
+            size_t new_cap = (cap == 0) ? LAST_LINE_BLOCK_SIZE : cap * 2;
+            char *grown = (char *)malloc(new_cap);
 
-    fseek(file, 0, SEEK_END);
-    fileSize = ftell(file);
+            if (grown == NULL) {
+                PERROR_FUNCTION("malloc");
+                free(buf);
+                return EXIT_FAILURE;
+            }
+            if (have > 0) {
+                memcpy(grown + new_cap - have, buf + cap - have, have);
+            }
+            free(buf);
+            buf = grown;
+            cap = new_cap;
+        }
+        off -= (off_t)n;
+        blk = buf + cap - have - n;
+        if (pread(fd, blk, n, off) != (ssize_t)n) {
+            PERROR_FUNCTION("pread");
+            free(buf);
+            return EXIT_FAILURE;
+        }
 
-    for (pos = 1; pos < fileSize; pos++) {
-        fseek(file, -pos, SEEK_END);
-        if (fgetc(file) == '\n') {
-            if (fgets(lastLine, MAX_LINE_LENGTH, file) != NULL) {
-                return EXIT_SUCCESS;
+        if (line_end < 0) {
+            /* the trailing line terminators are not part of the line */
+            while (scan > 0 && (blk[scan - 1] == '\n' || blk[scan - 1] == '\r')) {
+                scan--;
             }
+            if (scan == 0) {
+                continue;
+            }
+            line_end = off + (off_t)scan;
+        }
+        nl = (char *)memrchr(blk, '\n', scan);
+        if (nl != NULL) {
+            line_start = off + (nl - blk) + 1;
+            break;
         }
     }
-    /* If file has only one line, handle that case */
-    rewind(file);
-    if (fgets(lastLine, MAX_LINE_LENGTH, file) != NULL) {
-        return EXIT_SUCCESS;
-    } else {
-        PERROR_FUNCTION("fgets");
+
+    if (line_end < 0) {
+        free(buf);
+        PERROR_FUNCTION("no last line");
+        return EXIT_FAILURE;
+    }
+    /* no newline before it: the file has only one line */
+    *lastLine = strndup(buf + cap - (size_t)(size - line_start),
+                        (size_t)(line_end - line_start));
+    free(buf);
+    if (*lastLine == NULL) {
+        PERROR_FUNCTION("strndup");
         return EXIT_FAILURE;
     }
+    return EXIT_SUCCESS;
 }
 
 void
 fill_fields_from_line(char **fields, char *line)
 {
     int field_cnt = 0;
+    char *save;
 
     // Strip newline characters at the end
     line[strcspn(line, "\r\n")] = '\0';
 
     // Tokenize the line using comma as the delimiter
-    char *token = strtok(line, COMMA_DELIMITER);
+    char *token = strtok_r(line, COMMA_DELIMITER, &save);
     while (token != NULL) {
         fields[field_cnt++] = token;
-        token = strtok(NULL, COMMA_DELIMITER);
+        token = strtok_r(NULL, COMMA_DELIMITER, &save);
     }
     if (field_cnt != TOTAL_FIELDS){
         printf("\nfield_cnt:%d != TOTAL_FIELDS:%d\n", field_cnt, TOTAL_FIELDS);
@@ -484,63 +664,219 @@ fill_fields_from_line(char **fields, char *line)
     }
 }
 
+/* Split a record into its fields without modifying or copying it. */
 bool
-is_flowid_in_file(const struct file_basic_stats *f_basics, uint32_t flowid, int *idx)
+fill_fields_from_view(struct record_fields *rf, const struct line_view *record)
 {
-    for (uint32_t i = 0; i < f_basics->flow_count; i++) {
-        if (f_basics->flow_list[i].flowid == flowid) {
-            *idx = i;
-            return true;
+    return split_fields(record->ptr, record->len, rf);
+}
+
+/*
+ * Get the next batch of split records. A whole block of the body is handed
+ * to the splitter at once, so there is no per-line call into the reader.
+ * Set batch->block.len to 0 before the first call.
+ */
+bool
+next_record_batch(struct log_reader *reader, struct record_batch *batch)
+{
+    for (;;) {
+        size_t consumed;
+
+        if (batch->block.len == 0 &&
+            !reader_next_block(reader, &batch->block)) {
+            return false;
         }
+        batch->count = split_records(batch->block.ptr, batch->block.len,
+                                     batch->records, RECORD_BATCH_SIZE,
+                                     &consumed);
+        if (batch->count == 0) {
+            /* no complete record left in this block */
+            batch->block.len = 0;
+            continue;
+        }
+        batch->block.ptr += consumed;
+        batch->block.len -= consumed;
+        return true;
     }
-    return false;
 }
 
+/* The first line of a cwnd plot file, naming its columns. */
+static inline const char *
+cwnd_plot_header(void)
+{
+    return show_tflags ? CWND_PLOT_HEADER_TFLAGS : CWND_PLOT_HEADER;
+}
+
+/*
+ * Append one record to the cwnd plot file of its flow. The text fields are
+ * copied as they are and the timestamp is printed with integer math. The
+ * flag words are only decoded if their columns are asked for.
+ */
 static inline void
-get_first_line_stats(struct file_basic_stats *f_basics)
+plot_cwnd_record(struct plot_outputs *plots, struct plot_output *out,
+                 const struct record_fields *rf, int64_t relative_usec)
 {
-    FILE *file = f_basics->file;
-    struct first_line_fields *f_line_stats = NULL;
-    char *firstLine = (char *)calloc(MAX_LINE_LENGTH, sizeof(char));
-    if (firstLine == NULL) {
-        PERROR_FUNCTION("malloc");
+    const char *t_flags_str = NULL, *t_flags2_str = NULL;
+    size_t t_flags_len = 0, t_flags2_len = 0;
+    size_t len = FIELD_LEN(rf, DIRECTION) + FIELD_LEN(rf, CWND) +
+                 FIELD_LEN(rf, SSTHRESH) + PLOT_USEC_MAX_LEN + 4;
+    char *p;
+
+    if (out->decim != NULL) {
+        uint32_t cwnd = 0, ssthresh = 0, t_flags = 0, t_flags2 = 0;
+
+        field_u32(rf, CWND, &cwnd);
+        field_u32(rf, SSTHRESH, &ssthresh);
+        if (show_tflags) {
+            field_u32(rf, FLAG, &t_flags);
+            field_u32(rf, FLAG2, &t_flags2);
+        }
+        cwnd_decimate(out, *FIELD_PTR(rf, DIRECTION), relative_usec, cwnd,
+                      ssthresh, t_flags, t_flags2);
         return;
     }
+    if (show_tflags) {
+        uint32_t t_flags = 0;
+        uint32_t t_flags2 = 0;
 
-    /* read the last line of a file */
-    if (fgets(firstLine, MAX_LINE_LENGTH, file) != NULL) {
-        /* 6 fields in the first line */
-        char *fields[TOTAL_FIRST_LINE_FIELDS];
-        uint32_t field_count = 0;
-        f_line_stats = (struct first_line_fields *)malloc(sizeof(*f_line_stats));
-
-        /* Strip newline characters at the end */
-        firstLine[strcspn(firstLine, "\r\n")] = '\0';
-
-        /* Tokenize the line using comma as the delimiter */
-        char *token = strtok(firstLine, TAB_DELIMITER);
-        while (token != NULL) {
-            fields[field_count++] = token;
-            token = strtok(NULL, TAB_DELIMITER);
-        }
+        field_u32(rf, FLAG, &t_flags);
+        field_u32(rf, FLAG2, &t_flags2);
+        t_flags_str = tflags_column(t_flags);
+        t_flags2_str = tflags2_column(t_flags2);
+        t_flags_len = strlen(t_flags_str);
+        t_flags2_len = strlen(t_flags2_str);
+        len += t_flags_len + t_flags2_len + 2;
+    }
 
-        f_line_stats->enable_time.tv_sec = GET_VALUE(fields[ENABLE_TIME_SECS]);
-        f_line_stats->enable_time.tv_usec = GET_VALUE(fields[ENABLE_TIME_USECS]);
-        strcpy(f_line_stats->siftrver, next_sub_str_from(fields[SIFTRVER],
-                                                            EQUAL_DELIMITER));
-        strcpy(f_line_stats->sysname, next_sub_str_from(fields[SYSNAME],
-                                                           EQUAL_DELIMITER));
-        strcpy(f_line_stats->sysver, next_sub_str_from(fields[SYSVER],
-                                                          EQUAL_DELIMITER));
-        strcpy(f_line_stats->ipmode, next_sub_str_from(fields[IPMODE],
-                                                          EQUAL_DELIMITER));
+    p = plot_reserve(plots, out, len);
+    if (p == NULL) {
+        return;
+    }
+    p = plot_put_str(p, FIELD_PTR(rf, DIRECTION), FIELD_LEN(rf, DIRECTION));
+    *p++ = '\t';
+    p = plot_put_usec(p, relative_usec);
+    *p++ = '\t';
+    p = plot_put_str(p, FIELD_PTR(rf, CWND), FIELD_LEN(rf, CWND));
+    *p++ = '\t';
+    p = plot_put_str(p, FIELD_PTR(rf, SSTHRESH), FIELD_LEN(rf, SSTHRESH));
+    if (show_tflags) {
+        *p++ = '\t';
+        p = plot_put_str(p, t_flags_str, t_flags_len);
+        *p++ = '\t';
+        p = plot_put_str(p, t_flags2_str, t_flags2_len);
+    }
+    *p++ = '\n';
+    plot_commit(out, p);
+}
 
-        free(firstLine);
-    } else {
-        free(firstLine);
-        PERROR_FUNCTION("Failed to read the first line.");
+/* One row of a cwnd plot file from parsed fields, as it is */
+static inline void
+plot_cwnd_line(struct plot_outputs *plots, struct plot_output *out,
+               const char *direction, size_t direction_len,
+               int64_t relative_usec, uint32_t cwnd, uint32_t ssthresh,
+               uint32_t t_flags, uint32_t t_flags2)
+{
+    const char *t_flags_str = NULL, *t_flags2_str = NULL;
+    size_t t_flags_len = 0, t_flags2_len = 0;
+    char *p;
+
+    if (show_tflags) {
+        t_flags_str = tflags_column(t_flags);
+        t_flags2_str = tflags2_column(t_flags2);
+        t_flags_len = strlen(t_flags_str);
+        t_flags2_len = strlen(t_flags2_str);
+    }
+    /* 2 x 10 digits, a timestamp, the flags and 6 separators */
+    p = plot_reserve(plots, out, direction_len + PLOT_USEC_MAX_LEN + 26 +
+                                 t_flags_len + t_flags2_len);
+    if (p == NULL) {
+        return;
+    }
+    p = plot_put_str(p, direction, direction_len);
+    *p++ = '\t';
+    p = plot_put_usec(p, relative_usec);
+    *p++ = '\t';
+    p = plot_put_u64(p, cwnd);
+    *p++ = '\t';
+    p = plot_put_u64(p, ssthresh);
+    if (show_tflags) {
+        *p++ = '\t';
+        p = plot_put_str(p, t_flags_str, t_flags_len);
+        *p++ = '\t';
+        p = plot_put_str(p, t_flags2_str, t_flags2_len);
+    }
+    *p++ = '\n';
+    plot_commit(out, p);
+}
+
+/* plot_cwnd_record() of a record whose fields are already parsed */
+static inline void
+plot_cwnd_values(struct plot_outputs *plots, struct plot_output *out,
+                 const char *direction, size_t direction_len,
+                 int64_t relative_usec, uint32_t cwnd, uint32_t ssthresh,
+                 uint32_t t_flags, uint32_t t_flags2)
+{
+    if (out->decim != NULL) {
+        cwnd_decimate(out, direction[0], relative_usec, cwnd, ssthresh,
+                      t_flags, t_flags2);
         return;
     }
+    plot_cwnd_line(plots, out, direction, direction_len, relative_usec, cwnd,
+                   ssthresh, t_flags, t_flags2);
+}
+
+bool
+is_flowid_in_file(const struct file_basic_stats *f_basics, uint32_t flowid, int *idx)
+{
+    uint32_t i;
+
+    if (flow_table_find(&f_basics->flow_table, flowid, &i)) {
+        *idx = i;
+        return true;
+    }
+    return false;
+}
+
+/* Parse the head note; the line is modified. Returns NULL on failure. */
+struct first_line_fields *
+parse_first_line(char *firstLine)
+{
+    /* 6 fields in the first line */
+    char *fields[TOTAL_FIRST_LINE_FIELDS];
+    uint32_t field_count = 0;
+    struct first_line_fields *f_line_stats =
+        (struct first_line_fields *)malloc(sizeof(*f_line_stats));
+    if (f_line_stats == NULL) {
+        PERROR_FUNCTION("malloc failed for f_line_stats");
+        return NULL;
+    }
+
+    /* Strip newline characters at the end */
+    firstLine[strcspn(firstLine, "\r\n")] = '\0';
+
+    /* Tokenize the line using comma as the delimiter */
+    char *save;
+    char *token = strtok_r(firstLine, TAB_DELIMITER, &save);
+    while (token != NULL && field_count < TOTAL_FIRST_LINE_FIELDS) {
+        fields[field_count++] = token;
+        token = strtok_r(NULL, TAB_DELIMITER, &save);
+    }
+    if (field_count <= IPMODE) {
+        PERROR_FUNCTION("field_count < TOTAL_FIRST_LINE_FIELDS");
+        free(f_line_stats);
+        return NULL;
+    }
+
+    f_line_stats->enable_time.tv_sec = GET_VALUE(fields[ENABLE_TIME_SECS]);
+    f_line_stats->enable_time.tv_usec = GET_VALUE(fields[ENABLE_TIME_USECS]);
+    strcpy(f_line_stats->siftrver, next_sub_str_from(fields[SIFTRVER],
+                                                        EQUAL_DELIMITER));
+    strcpy(f_line_stats->sysname, next_sub_str_from(fields[SYSNAME],
+                                                       EQUAL_DELIMITER));
+    strcpy(f_line_stats->sysver, next_sub_str_from(fields[SYSVER],
+                                                      EQUAL_DELIMITER));
+    strcpy(f_line_stats->ipmode, next_sub_str_from(fields[IPMODE],
+                                                      EQUAL_DELIMITER));
 
     if (verbose) {
         printf("enable_time: %ld.%ld, siftrver: %s, sysname: %s, sysver: %s, "
@@ -553,70 +889,87 @@ get_first_line_stats(struct file_basic_stats *f_basics)
                 f_line_stats->ipmode);
     }
 
-    f_basics->first_line_stats = f_line_stats;
+    return f_line_stats;
 }
 
 static inline void
-get_last_line_stats(struct file_basic_stats *f_basics)
+get_first_line_stats(struct file_basic_stats *f_basics)
 {
     FILE *file = f_basics->file;
-    struct last_line_fields *l_line_stats = NULL;
-    char *lastLine = (char *)calloc(MAX_LINE_LENGTH, sizeof(char));
-    if (lastLine == NULL) {
+    char *firstLine = (char *)calloc(MAX_LINE_LENGTH, sizeof(char));
+    if (firstLine == NULL) {
         PERROR_FUNCTION("malloc");
         return;
     }
 
-    if (read_last_line(file, lastLine) == EXIT_SUCCESS) {
-        char *fields[TOTAL_LAST_LINE_FIELDS];
-        uint32_t field_count = 0;
-        l_line_stats = (struct last_line_fields *)malloc(sizeof(*l_line_stats));
-        if (l_line_stats == NULL) {
-            PERROR_FUNCTION("malloc failed for l_line_stats");
-        }
+    /* read the first line of a file */
+    if (fgets(firstLine, MAX_LINE_LENGTH, file) != NULL) {
+        f_basics->first_line_stats = parse_first_line(firstLine);
+        free(firstLine);
+    } else {
+        free(firstLine);
+        PERROR_FUNCTION("Failed to read the first line.");
+        return;
+    }
+}
 
-        /* Strip newline characters at the end */
-        lastLine[strcspn(lastLine, "\r\n")] = '\0';
+/* Parse the foot note; the line is modified. Returns NULL on failure. */
+struct last_line_fields *
+parse_last_line(char *lastLine)
+{
+    char *fields[TOTAL_LAST_LINE_FIELDS];
+    uint32_t field_count = 0;
+    struct last_line_fields *l_line_stats =
+        (struct last_line_fields *)malloc(sizeof(*l_line_stats));
+    if (l_line_stats == NULL) {
+        PERROR_FUNCTION("malloc failed for l_line_stats");
+        return NULL;
+    }
 
-        // Tokenize the line using tab as the delimiter
-        char *token = strtok(lastLine, TAB_DELIMITER);
-        while (token != NULL) {
-            fields[field_count++] = token;
-            token = strtok(NULL, TAB_DELIMITER);
-        }
+    /* Strip newline characters at the end */
+    lastLine[strcspn(lastLine, "\r\n")] = '\0';
 
-        if (field_count != TOTAL_LAST_LINE_FIELDS) {
-            PERROR_FUNCTION("field_count != TOTAL_LAST_LINE_FIELDS");
-        }
+    // Tokenize the line using tab as the delimiter
+    char *save;
+    char *token = strtok_r(lastLine, TAB_DELIMITER, &save);
+    while (token != NULL && field_count < TOTAL_LAST_LINE_FIELDS) {
+        fields[field_count++] = token;
+        token = strtok_r(NULL, TAB_DELIMITER, &save);
+    }
 
-        l_line_stats->disable_time.tv_sec = GET_VALUE(fields[DISABLE_TIME_SECS]);
-        l_line_stats->disable_time.tv_usec = GET_VALUE(fields[DISABLE_TIME_USECS]);
-        l_line_stats->num_inbound_tcp_pkts = GET_VALUE(fields[NUM_INBOUND_TCP_PKTS]);
-        l_line_stats->num_outbound_tcp_pkts = GET_VALUE(fields[NUM_OUTBOUND_TCP_PKTS]);
-        l_line_stats->total_tcp_pkts = GET_VALUE(fields[TOTAL_TCP_PKTS]);
-
-        l_line_stats->num_inbound_skipped_pkts_malloc = GET_VALUE(fields[NUM_INBOUND_SKIPPED_PKTS_MALLOC]);
-        l_line_stats->num_outbound_skipped_pkts_malloc = GET_VALUE(fields[NUM_OUTBOUND_SKIPPED_PKTS_MALLOC]);
-        l_line_stats->num_inbound_skipped_pkts_tcpcb = GET_VALUE(fields[NUM_INBOUND_SKIPPED_PKTS_TCPCB]);
-        l_line_stats->num_outbound_skipped_pkts_tcpcb = GET_VALUE(fields[NUM_OUTBOUND_SKIPPED_PKTS_TCPCB]);
-        l_line_stats->num_inbound_skipped_pkts_inpcb = GET_VALUE(fields[NUM_INBOUND_SKIPPED_PKTS_INPCB]);
-        l_line_stats->num_outbound_skipped_pkts_inpcb = GET_VALUE(fields[NUM_OUTBOUND_SKIPPED_PKTS_INPCB]);
-        l_line_stats->total_skipped_tcp_pkts = GET_VALUE(fields[TOTAL_SKIPPED_TCP_PKTS]);
-
-        char *sub_str = next_sub_str_from(fields[FLOWID_LIST], EQUAL_DELIMITER);
-
-        l_line_stats->flowid_list = (char*)calloc(strlen(sub_str) + 1, sizeof(char));
-        if (l_line_stats->flowid_list == NULL) {
-            PERROR_FUNCTION("Failed to calloc the last line.");
-        }
-        strcpy(l_line_stats->flowid_list, sub_str);
+    if (field_count != TOTAL_LAST_LINE_FIELDS) {
+        PERROR_FUNCTION("field_count != TOTAL_LAST_LINE_FIELDS");
+        free(l_line_stats);
+        return NULL;
+    }
 
-        free(lastLine);
-    } else {
-        free(lastLine);
-        PERROR_FUNCTION("Failed to read the last line.");
-        return;
+    l_line_stats->disable_time.tv_sec = GET_VALUE(fields[DISABLE_TIME_SECS]);
+    l_line_stats->disable_time.tv_usec = GET_VALUE(fields[DISABLE_TIME_USECS]);
+    l_line_stats->num_inbound_tcp_pkts = GET_VALUE(fields[NUM_INBOUND_TCP_PKTS]);
+    l_line_stats->num_outbound_tcp_pkts = GET_VALUE(fields[NUM_OUTBOUND_TCP_PKTS]);
+    l_line_stats->total_tcp_pkts = GET_VALUE(fields[TOTAL_TCP_PKTS]);
+
+    l_line_stats->num_inbound_skipped_pkts_malloc = GET_VALUE(fields[NUM_INBOUND_SKIPPED_PKTS_MALLOC]);
+    l_line_stats->num_outbound_skipped_pkts_malloc = GET_VALUE(fields[NUM_OUTBOUND_SKIPPED_PKTS_MALLOC]);
+    l_line_stats->num_inbound_skipped_pkts_tcpcb = GET_VALUE(fields[NUM_INBOUND_SKIPPED_PKTS_TCPCB]);
+    l_line_stats->num_outbound_skipped_pkts_tcpcb = GET_VALUE(fields[NUM_OUTBOUND_SKIPPED_PKTS_TCPCB]);
+    l_line_stats->num_inbound_skipped_pkts_inpcb = GET_VALUE(fields[NUM_INBOUND_SKIPPED_PKTS_INPCB]);
+    l_line_stats->num_outbound_skipped_pkts_inpcb = GET_VALUE(fields[NUM_OUTBOUND_SKIPPED_PKTS_INPCB]);
+    l_line_stats->total_skipped_tcp_pkts = GET_VALUE(fields[TOTAL_SKIPPED_TCP_PKTS]);
+
+    char *sub_str = next_sub_str_from(fields[FLOWID_LIST], EQUAL_DELIMITER);
+    if (sub_str == NULL) {
+        /* a log without any flow */
+        sub_str = "";
+    }
+
+    l_line_stats->flowid_list = (char*)calloc(strlen(sub_str) + 1, sizeof(char));
+    if (l_line_stats->flowid_list == NULL) {
+        PERROR_FUNCTION("Failed to calloc the last line.");
+        free(l_line_stats);
+        return NULL;
     }
+    strcpy(l_line_stats->flowid_list, sub_str);
 
     if (verbose) {
         printf("disable_time: %ld.%ld, num_inbound_tcp_pkts: %" PRIu64
@@ -644,7 +997,21 @@ get_last_line_stats(struct file_basic_stats *f_basics)
                l_line_stats->flowid_list);
     }
 
-    f_basics->last_line_stats = l_line_stats;
+    return l_line_stats;
+}
+
+static inline void
+get_last_line_stats(struct file_basic_stats *f_basics)
+{
+    char *lastLine = NULL;
+
+    if (read_last_line(f_basics->file, &lastLine) == EXIT_SUCCESS) {
+        f_basics->last_line_stats = parse_last_line(lastLine);
+        free(lastLine);
+    } else {
+        PERROR_FUNCTION("Failed to read the last line.");
+        return;
+    }
 }
 
 static inline void
@@ -659,9 +1026,10 @@ get_flow_count(struct file_basic_stats *f_basics)
     }
 
     /* get the total number of flows */
-    char *token = strtok(flow_list_str, COMMA_DELIMITER);
+    char *save;
+    char *token = strtok_r(flow_list_str, COMMA_DELIMITER, &save);
     while (token != NULL) {
-        token = strtok(NULL, COMMA_DELIMITER);
+        token = strtok_r(NULL, COMMA_DELIMITER, &save);
         flow_cnt++;
     }
     f_basics->flow_count = flow_cnt;
@@ -669,13 +1037,124 @@ get_flow_count(struct file_basic_stats *f_basics)
     free(flow_list_str);
 }
 
+/* Make room for more flows while the foot note of a stream is not known yet */
+static inline int
+grow_flow_list(struct file_basic_stats *f_basics)
+{
+    uint32_t cap = f_basics->flow_count * 2;
+    struct flow_info *flows = (struct flow_info *)
+        realloc(f_basics->flow_list, cap * sizeof(struct flow_info));
+
+    if (flows == NULL) {
+        PERROR_FUNCTION("realloc failed for f_basics->flow_list");
+        return EXIT_FAILURE;
+    }
+    memset(flows + f_basics->flow_count, 0,
+           (cap - f_basics->flow_count) * sizeof(struct flow_info));
+    f_basics->flow_list = flows;
+    f_basics->flow_count = cap;
+    return EXIT_SUCCESS;
+}
+
+/* Go through the records one block at a time; returns the number of records */
+static inline int64_t
+get_body_stats_serial(struct file_basic_stats *f_basics)
+{
+    struct log_reader *reader = &f_basics->reader;
+    struct record_batch *batch;
+    int64_t line_cnt = 0;
+    uint64_t malformed = 0;
+
+    batch = (struct record_batch *)malloc(sizeof(*batch));
+    if (batch == NULL) {
+        PERROR_FUNCTION("malloc failed for batch");
+        return -1;
+    }
+
+    /* Go back to the first record, right after the head note */
+    if (reader_rewind_body(reader) != EXIT_SUCCESS) {
+        PERROR_FUNCTION("Failed to read first line");
+        free(batch);
+        return -1;
+    }
+
+    /* Read through the records, the reader stops at the foot note */
+    batch->block.len = 0;
+    while (next_record_batch(reader, batch)) {
+        for (size_t r = 0; r < batch->count; r++) {
+            struct record_fields *rf = &batch->records[r];
+            uint32_t flowid;
+            uint32_t idx;
+
+            line_cnt++;
+            if (f_basics->first_usec < 0 && rf->field_cnt == TOTAL_FIELDS) {
+                /* the first record is the origin of relative times */
+                field_usec(rf, TIMESTAMP, &f_basics->first_usec);
+            }
+            if (rf->field_cnt != TOTAL_FIELDS ||
+                field_u32(rf, FLOW_ID, &flowid) != EXIT_SUCCESS) {
+                malformed++;
+                continue;
+            }
+
+            if (flow_table_find_cached(&f_basics->flow_table, flowid, &idx)) {
+                f_basics->flow_list[idx].record_cnt++;
+            } else if (f_basics->flow_table.count < f_basics->flow_count ||
+                       (reader_is_stream(reader) &&
+                        grow_flow_list(f_basics) == EXIT_SUCCESS)) {
+                struct flow_info target_flow = { .flowid = flowid };
+
+                /* flows take the slots in the order they first show up */
+                idx = f_basics->flow_table.count;
+                fill_flow_info_from_view(&target_flow, rf);
+                target_flow.record_cnt = 1;
+                if (strcmp(f_basics->first_line_stats->ipmode, "4") == 0) {
+                    target_flow.ipver = INP_IPV4;
+                } else {
+                    target_flow.ipver = INP_IPV6;
+                }
+                f_basics->flow_list[idx] = target_flow;
+                flow_table_insert(&f_basics->flow_table, flowid, idx);
+            } else {
+                continue;
+            }
+
+            if (use_columns) {
+                /* the -m stats are then taken from the columns */
+                flow_columns_record(&f_basics->flow_list[idx], rf);
+            } else if (show_metrics) {
+                flow_stats_record(&f_basics->flow_list[idx], rf);
+            }
+            if (bucket_usec > 0) {
+                flow_bucket_record(&f_basics->flow_list[idx], rf,
+                                   f_basics->first_usec);
+            }
+            if (show_events) {
+                flow_events_record(&f_basics->flow_list[idx], rf);
+            }
+            if (show_occupancy) {
+                flow_occupancy_record(&f_basics->flow_list[idx], rf);
+            }
+
+            if (f_basics->flow_offsets != NULL) {
+                offset_list_add(&f_basics->flow_offsets[idx],
+                                (uint64_t)(rf->line - reader->map));
+            }
+            if (f_basics->time_index.stride > 0) {
+                time_index_note(&f_basics->time_index, rf, reader->map);
+            }
+        }
+    }
+    free(batch);
+    profile_count(PROF_MALFORMED, malformed);
+
+    return line_cnt;
+}
+
 /* get some basic info from the traffic records, exclude head or foot note */
 static inline void
 get_body_stats(struct file_basic_stats *f_basics) {
-    uint32_t lineCount = 0;
-    char current_line[MAX_LINE_LENGTH];
-    char previous_line[MAX_LINE_LENGTH] = {0};
-    FILE *file = f_basics->file;
+    int64_t line_cnt = -1;
 
     if (f_basics->flow_count > 0) {
         f_basics->flow_list = (struct flow_info*)calloc(f_basics->flow_count,
@@ -686,85 +1165,183 @@ get_body_stats(struct file_basic_stats *f_basics) {
         PERROR_FUNCTION("f_basics->flow_count not set");
         return;
     }
+    if (flow_table_init(&f_basics->flow_table, f_basics->flow_count) !=
+        EXIT_SUCCESS) {
+        return;
+    }
+    f_basics->first_usec = -1;
+    if (f_basics->reader.is_mapped && !use_columns && select_flows) {
+        /* record offsets are only useful if the records can be seeked to */
+        f_basics->flow_offsets = (struct offset_list *)
+            calloc(f_basics->flow_count, sizeof(struct offset_list));
+        if (time_window.has_from) {
+            /* where --from starts */
+            f_basics->time_index.stride = TIME_INDEX_STRIDE;
+        }
+    }
 
-    /* Restart seeking and go back to the beginning of the file */
-    fseek(file, 0, SEEK_SET);
-
-    // Read and discard the first line
-    if(fgets(current_line, MAX_LINE_LENGTH, file) == NULL) {
-        PERROR_FUNCTION("Failed to read first line");
+    if (jobs > 1) {
+        line_cnt = get_body_stats_parallel(f_basics, jobs);
+    }
+    if (line_cnt < 0) {
+        line_cnt = get_body_stats_serial(f_basics);
+    }
+    if (line_cnt < 0) {
         return;
     }
-    lineCount++;
+    profile_count(PROF_RECORDS, (uint64_t)line_cnt);
+    if (use_columns && show_metrics) {
+        columns_flow_stats(f_basics);
+    }
 
-    /* Read through the rest of the file line by line */
-    while (fgets(current_line, MAX_LINE_LENGTH, file) != NULL) {
-        if (previous_line[0] != '\0') {
-            char *fields[TOTAL_FIELDS];
-            uint32_t flowid;
-            int idx;
+    if (verbose) {
+        const char *kernel_name;
+
+        get_delim_bitmap(&kernel_name);
+        /* count in the head and the foot note */
+        printf("input file has total lines: %" PRId64 "\n", line_cnt + 2);
+        printf("field splitter: %s\n", kernel_name);
+        if (use_columns) {
+            printf("records loaded into columns: %zu bytes\n",
+                   columns_size(f_basics));
+        }
+    }
 
-            fill_fields_from_line(fields, previous_line);
-            flowid = my_atol(fields[FLOW_ID]);
+    f_basics->num_lines = (uint32_t)(line_cnt + 2);
+}
 
-            if (!is_flowid_in_file(f_basics, flowid, &idx)) {
-                struct flow_info target_flow = { .flowid = flowid };
+/*
+ * A compressed log is read in one go from its start: the head note shows up
+ * first, but the foot note only after the body pass, which grows the flow
+ * list as the flows show up. The list is then sized to the foot note.
+ */
+static int
+get_stream_basics(struct file_basic_stats *f_basics, enum decomp_kind kind)
+{
+    struct log_reader *reader = &f_basics->reader;
+    uint32_t flow_cap = FLOW_TABLE_MIN_SLOTS;
+    uint32_t flows_seen;
+    int prev;
 
-                for (uint32_t i = 0; i < f_basics->flow_count; i++) {
-                    if (f_basics->flow_list[i].flowid == 0) {
-                        fill_flow_info(&target_flow, fields);
-                        target_flow.record_cnt = 1;
-                        if (strcmp(f_basics->first_line_stats->ipmode, "4") == 0) {
-                            target_flow.ipver = INP_IPV4;
-                        } else {
-                            target_flow.ipver = INP_IPV6;
-                        }
-                        f_basics->flow_list[i] = target_flow;
-                        break;
-                    }
-                }
-            } else {
-                f_basics->flow_list[idx].record_cnt++;
-            }
-        }
+    if (reader_open_decomp(reader, f_basics->file, kind) != EXIT_SUCCESS) {
+        PERROR_FUNCTION("reader_open_decomp() failed");
+        return EXIT_FAILURE;
+    }
 
-        lineCount++;
-        /* Update the previous line to be the current line. */
-        strcpy(previous_line, current_line);
+    prev = profile_enter(PROF_FIRST_LINE);
+    if (reader_rewind_body(reader) == EXIT_SUCCESS) {
+        f_basics->first_line_stats = parse_first_line(reader->head_note);
+    }
+    profile_leave(prev);
+    if (f_basics->first_line_stats == NULL) {
+        PERROR_FUNCTION("head note not exist");
+        return EXIT_FAILURE;
     }
 
-    if (verbose) {
-        printf("input file has total lines: %u\n", lineCount);
+    prev = profile_enter(PROF_BODY);
+    f_basics->flow_count = flow_cap;
+    get_body_stats(f_basics);
+    profile_leave(prev);
+    flows_seen = f_basics->flow_table.count;
+    flow_cap = f_basics->flow_count;
+
+    prev = profile_enter(PROF_LAST_LINE);
+    if (reader->foot_note != NULL) {
+        f_basics->last_line_stats = parse_last_line(reader->foot_note);
+    }
+    profile_leave(prev);
+    if (f_basics->last_line_stats == NULL) {
+        PERROR_FUNCTION("foot note not exist");
+        return EXIT_FAILURE;
+    }
+
+    prev = profile_enter(PROF_FLOW_COUNT);
+    get_flow_count(f_basics);
+    profile_leave(prev);
+    if (f_basics->flow_count < flows_seen) {
+        f_basics->flow_count = flows_seen;
     }
+    if (f_basics->flow_count > flow_cap) {
+        uint32_t flow_count = f_basics->flow_count;
 
-    f_basics->num_lines = lineCount;
+        f_basics->flow_count = flow_cap;
+        while (f_basics->flow_count < flow_count) {
+            if (grow_flow_list(f_basics) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+        }
+        f_basics->flow_count = flow_count;
+    }
+    return EXIT_SUCCESS;
 }
 
 int
 get_file_basics(struct file_basic_stats *f_basics, const char *file_name)
 {
+    enum decomp_kind kind;
     FILE *file = fopen(file_name, "r");
+    int prev;
+
     if (!file) {
         PERROR_FUNCTION("Failed to open file");
         return EXIT_FAILURE;
     }
     f_basics->file = file;
 
+    prev = profile_enter(PROF_INDEX);
+    if (use_index && sidx_load(f_basics, file_name) == EXIT_SUCCESS) {
+        profile_leave(prev);
+        return EXIT_SUCCESS;
+    }
+    profile_leave(prev);
+
+    kind = decomp_detect(file);
+    if (kind != DECOMP_NONE) {
+        if (get_stream_basics(f_basics, kind) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        prev = profile_enter(PROF_INDEX);
+        if (use_index && sidx_build(f_basics, file_name) != EXIT_SUCCESS) {
+            PERROR_FUNCTION("sidx_build() failed, continue without it");
+        }
+        profile_leave(prev);
+        return EXIT_SUCCESS;
+    }
+
+    if (reader_open(&f_basics->reader, file) != EXIT_SUCCESS) {
+        PERROR_FUNCTION("reader_open() failed");
+        return EXIT_FAILURE;
+    }
+
+    prev = profile_enter(PROF_FIRST_LINE);
     get_first_line_stats(f_basics);
+    profile_leave(prev);
     if (f_basics->first_line_stats == NULL) {
         PERROR_FUNCTION("head note not exist");
         return EXIT_FAILURE;
     }
 
+    prev = profile_enter(PROF_LAST_LINE);
     get_last_line_stats(f_basics);
+    profile_leave(prev);
     if (f_basics->last_line_stats == NULL) {
         PERROR_FUNCTION("foot note not exist");
         return EXIT_FAILURE;
     }
 
+    prev = profile_enter(PROF_FLOW_COUNT);
     get_flow_count(f_basics);
+    profile_leave(prev);
     /* f_basics->flow_count must be set first */
+    prev = profile_enter(PROF_BODY);
     get_body_stats(f_basics);
+    profile_leave(prev);
+
+    prev = profile_enter(PROF_INDEX);
+    if (use_index && sidx_build(f_basics, file_name) != EXIT_SUCCESS) {
+        PERROR_FUNCTION("sidx_build() failed, continue without it");
+    }
+    profile_leave(prev);
 
     return EXIT_SUCCESS;
 }
@@ -805,6 +1382,119 @@ show_file_basic_stats(const struct file_basic_stats *f_basics)
            (intmax_t)f_basics->last_line_stats->disable_time.tv_usec);
 
     printf("log duration: %.2f seconds\n", time_in_seconds);
+
+    if (show_metrics) {
+        printf("\nflow metrics:\n");
+        for (uint32_t i = 0; i < f_basics->flow_count; i++) {
+            if (f_basics->flow_list[i].stats != NULL) {
+                show_flow_stats(f_basics->flow_list[i].flowid,
+                                f_basics->flow_list[i].stats);
+            }
+        }
+    }
+}
+
+/* Write the --bucket intervals of every flow to bucket_<flowid>.txt */
+void
+write_flow_buckets(const struct file_basic_stats *f_basics)
+{
+    uint32_t nflows = f_basics->flow_table.count;
+    uint32_t *flowids = (uint32_t *)calloc(nflows + 1, sizeof(uint32_t));
+    struct plot_outputs plots;
+
+    if (flowids == NULL) {
+        PERROR_FUNCTION("calloc failed for flowids");
+        return;
+    }
+    for (uint32_t i = 0; i < nflows; i++) {
+        flowids[i] = f_basics->flow_list[i].flowid;
+    }
+    if (plot_outputs_init_kind(&plots, "bucket", flowids, nflows,
+                               BUCKET_PLOT_HEADER) == EXIT_SUCCESS) {
+        for (uint32_t i = 0; i < nflows; i++) {
+            if (f_basics->flow_list[i].buckets != NULL) {
+                bucket_series_write(&plots, &plots.outs[i],
+                                    f_basics->flow_list[i].buckets);
+            }
+        }
+    }
+    plot_outputs_close(&plots);
+    free(flowids);
+}
+
+/*
+ * Write the --events of every flow to events_<flowid>.txt, and show how many
+ * of each there are and how long the episodes lasted.
+ */
+void
+write_flow_events(const struct file_basic_stats *f_basics)
+{
+    uint32_t nflows = f_basics->flow_table.count;
+    uint32_t *flowids = (uint32_t *)calloc(nflows + 1, sizeof(uint32_t));
+    struct plot_outputs plots;
+
+    if (flowids == NULL) {
+        PERROR_FUNCTION("calloc failed for flowids");
+        return;
+    }
+    for (uint32_t i = 0; i < nflows; i++) {
+        flowids[i] = f_basics->flow_list[i].flowid;
+    }
+
+    if (plot_outputs_init_kind(&plots, "events", flowids, nflows,
+                               EVENTS_PLOT_HEADER) == EXIT_SUCCESS) {
+        printf("\ncongestion events (count/seconds):\n");
+        printf(" %10s", "flowid");
+        for (int k = 0; k < EVENT_KINDS; k++) {
+            printf(" %20s", event_names[k]);
+        }
+        printf("\n");
+        for (uint32_t i = 0; i < nflows; i++) {
+            struct flow_events *ev = f_basics->flow_list[i].events;
+            uint32_t counts[EVENT_KINDS];
+            int64_t usecs[EVENT_KINDS];
+
+            if (ev == NULL) {
+                continue;
+            }
+            flow_events_finish(ev, counts, usecs);
+            flow_events_write(&plots, &plots.outs[i], ev,
+                              f_basics->first_usec);
+            printf(" %10u", f_basics->flow_list[i].flowid);
+            for (int k = 0; k < EVENT_KINDS; k++) {
+                printf(" %9u/%10.3f", counts[k], usecs[k] / 1e6);
+            }
+            printf("\n");
+        }
+    }
+    plot_outputs_close(&plots);
+    free(flowids);
+}
+
+/* Show in how many records and for how long each flag bit was set per flow */
+void
+show_flow_occupancy(const struct file_basic_stats *f_basics)
+{
+    printf("\nflag occupancy (%% of records/%% of time):\n");
+    printf(" %10s %-24s %8s %8s\n", "flowid", "flag", "records", "time");
+    for (uint32_t i = 0; i < f_basics->flow_table.count; i++) {
+        struct flow_occupancy *occ = f_basics->flow_list[i].occupancy;
+
+        if (occ == NULL) {
+            continue;
+        }
+        flow_occupancy_finish(occ);
+        flow_occupancy_show(f_basics->flow_list[i].flowid, occ);
+    }
+}
+
+static inline void
+show_flow_heading(const struct flow_info *flow)
+{
+    printf("++++++++++++++++++++++++++++++    ++++++++++++++++++++++++++++++\n");
+    printf("  %s:%hu->%s:%hu flowid: %u\n",
+           flow->laddr, flow->lport, flow->faddr, flow->fport, flow->flowid);
+    printf("    has %u useful records\n", flow->record_cnt);
 }
 
 /* Read the body of the per-flow stats, and skip the head or foot note. */
@@ -814,20 +1504,146 @@ read_body_by_flowid(struct file_basic_stats *f_basics, uint32_t flowid)
     int idx;
 
     if (is_flowid_in_file(f_basics, flowid, &idx)) {
-        printf("++++++++++++++++++++++++++++++    ++++++++++++++++++++++++++++++\n");
-        printf("  %s:%hu->%s:%hu flowid: %u\n",
-               f_basics->flow_list[idx].laddr, f_basics->flow_list[idx].lport,
-               f_basics->flow_list[idx].faddr, f_basics->flow_list[idx].fport,
-               flowid);
-        printf("    has %u useful records\n", f_basics->flow_list[idx].record_cnt);
+        int prev;
+
+        show_flow_heading(&f_basics->flow_list[idx]);
 
+        prev = profile_enter(PROF_PLOT);
         stats_into_plot_file(f_basics, flowid);
+        profile_leave(prev);
+    }
+}
+
+/* Same as read_body_by_flowid(), for many flows in a single pass. */
+void
+read_body_by_flowids(struct file_basic_stats *f_basics,
+                     const uint32_t *flowids, uint32_t count)
+{
+    int prev;
+
+    for (uint32_t i = 0; i < count; i++) {
+        int idx;
+
+        if (is_flowid_in_file(f_basics, flowids[i], &idx)) {
+            show_flow_heading(&f_basics->flow_list[idx]);
+        }
+    }
+
+    prev = profile_enter(PROF_PLOT);
+    if (export_file_name != NULL) {
+        export_flows(f_basics, flowids, count);
+    } else {
+        stats_into_plot_files(f_basics, flowids, count);
+    }
+    profile_leave(prev);
+}
+
+static inline bool
+parse_flowid(const char *str, const char *end, uint32_t *flowid)
+{
+    char *endptr;
+    unsigned long value;
+
+    errno = 0;
+    value = strtoul(str, &endptr, 10);
+    if (errno != 0 || endptr != end || str == end || value > UINT32_MAX) {
+        return false;
     }
+    *flowid = (uint32_t)value;
+    return true;
 }
 
+/*
+ * Turn the -s argument into the flowids to extract. The argument is "all",
+ * or a comma separated list of flowids and "low-high" ranges. A range picks
+ * the flows of the file whose flowid falls in it. Flowids not in the file are
+ * reported and skipped. The caller frees *flowids.
+ */
 int
-cleanup_file_basic_stats(const struct file_basic_stats *f_basics_ptr)
+select_flowids(const struct file_basic_stats *f_basics, const char *arg,
+               uint32_t **flowids, uint32_t *count)
 {
+    uint32_t nflows = f_basics->flow_table.count;
+    bool *selected = (bool *)calloc(nflows + 1, sizeof(bool));
+    const char *token = arg;
+
+    *flowids = NULL;
+    *count = 0;
+    if (selected == NULL) {
+        PERROR_FUNCTION("calloc failed for selected");
+        return EXIT_FAILURE;
+    }
+
+    while (*token != '\0') {
+        const char *end = strchr(token, ',');
+        const char *dash;
+        uint32_t low, high;
+
+        if (end == NULL) {
+            end = token + strlen(token);
+        }
+        dash = memchr(token, '-', end - token);
+
+        if ((size_t)(end - token) == strlen("all") &&
+            strncmp(token, "all", end - token) == 0) {
+            memset(selected, true, nflows);
+        } else if (dash != NULL) {
+            if (!parse_flowid(token, dash, &low) ||
+                !parse_flowid(dash + 1, end, &high) || low > high) {
+                printf("invalid flow id range: %.*s\n", (int)(end - token), token);
+                free(selected);
+                return EXIT_FAILURE;
+            }
+            for (uint32_t i = 0; i < nflows; i++) {
+                if (f_basics->flow_list[i].flowid >= low &&
+                    f_basics->flow_list[i].flowid <= high) {
+                    selected[i] = true;
+                }
+            }
+        } else {
+            uint32_t idx;
+
+            if (!parse_flowid(token, end, &low)) {
+                printf("invalid flow id: %.*s\n", (int)(end - token), token);
+                free(selected);
+                return EXIT_FAILURE;
+            }
+            if (flow_table_find(&f_basics->flow_table, low, &idx)) {
+                selected[idx] = true;
+            } else {
+                printf("flow ID %u not found\n", low);
+            }
+        }
+        token = (*end == ',') ? end + 1 : end;
+    }
+
+    for (uint32_t i = 0; i < nflows; i++) {
+        *count += selected[i];
+    }
+    if (*count > 0) {
+        *flowids = (uint32_t *)malloc(*count * sizeof(uint32_t));
+        if (*flowids == NULL) {
+            PERROR_FUNCTION("malloc failed for flowids");
+            free(selected);
+            return EXIT_FAILURE;
+        }
+        *count = 0;
+        for (uint32_t i = 0; i < nflows; i++) {
+            if (selected[i]) {
+                (*flowids)[(*count)++] = f_basics->flow_list[i].flowid;
+            }
+        }
+    }
+
+    free(selected);
+    return EXIT_SUCCESS;
+}
+
+int
+cleanup_file_basic_stats(struct file_basic_stats *f_basics_ptr)
+{
+    reader_close(&f_basics_ptr->reader);
+    sidx_close(f_basics_ptr);
 
     // Close the file and check for errors
     if (fclose(f_basics_ptr->file) == EOF) {
@@ -836,11 +1652,32 @@ cleanup_file_basic_stats(const struct file_basic_stats *f_basics_ptr)
     }
 
     free(f_basics_ptr->first_line_stats);
-    free(f_basics_ptr->last_line_stats->flowid_list);
+    if (f_basics_ptr->last_line_stats != NULL) {
+        free(f_basics_ptr->last_line_stats->flowid_list);
+    }
     free(f_basics_ptr->last_line_stats);
+    offset_lists_free(f_basics_ptr->flow_offsets, f_basics_ptr->flow_count);
+    time_index_free(&f_basics_ptr->time_index);
+    for (uint32_t i = 0; f_basics_ptr->flow_list != NULL &&
+         i < f_basics_ptr->flow_count; i++) {
+        flow_stats_free(f_basics_ptr->flow_list[i].stats);
+        flow_columns_free(f_basics_ptr->flow_list[i].cols);
+        bucket_series_free(f_basics_ptr->flow_list[i].buckets);
+        flow_events_free(f_basics_ptr->flow_list[i].events);
+        flow_occupancy_free(f_basics_ptr->flow_list[i].occupancy);
+    }
     free(f_basics_ptr->flow_list);
+    flow_table_free(&f_basics_ptr->flow_table);
 
     return EXIT_SUCCESS;
 }
 
+#include "siftr_decimate.h"
+#include "siftr_columns.h"
+#include "siftr_parallel.h"
+#include "siftr_index.h"
+#include "siftr_export.h"
+#include "siftr_follow.h"
+#include "siftr_batch.h"
+
 #endif /* REVIEW_SIFTR_LOG_H_ */
@@ -0,0 +1,292 @@
+/*
+ ============================================================================
+ Name        : siftr_batch.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Summarize many logs at once on a pool of threads
+ ============================================================================
+ */
+
+#ifndef SIFTR_BATCH_H_
+#define SIFTR_BATCH_H_
+
+#include <dirent.h>
+#include <glob.h>
+#include <pthread.h>
+
+/* What the summary shows of one log */
+struct batch_result {
+    bool        failed;
+    double      secs;           /* taken to read the log */
+    double      duration;       /* from the head to the foot note */
+    uint32_t    flows;
+    uint32_t    records;
+    uint64_t    tcp_pkts;
+    uint64_t    skipped_pkts;
+};
+
+/* The sums of all the logs, wide enough for many large ones */
+struct batch_total {
+    double      secs;
+    double      duration;
+    uint64_t    flows;
+    uint64_t    records;
+    uint64_t    tcp_pkts;
+    uint64_t    skipped_pkts;
+};
+
+/* The logs in the order given, handed out to the threads one at a time */
+struct batch_queue {
+    pthread_mutex_t     lock;
+    char                **names;
+    struct batch_result *results;
+    uint32_t            count;
+    uint32_t            cap;
+    uint32_t            next;
+};
+
+static inline int
+batch_add_name(struct batch_queue *queue, const char *name)
+{
+    if (queue->count == queue->cap) {
+        uint32_t cap = queue->cap ? queue->cap * 2 : 64;
+        char **names = (char **)realloc(queue->names, cap * sizeof(char *));
+
+        if (names == NULL) {
+            PERROR_FUNCTION("realloc failed for queue->names");
+            return EXIT_FAILURE;
+        }
+        queue->names = names;
+        queue->cap = cap;
+    }
+    queue->names[queue->count] = strdup(name);
+    if (queue->names[queue->count] == NULL) {
+        PERROR_FUNCTION("strdup failed for a log name");
+        return EXIT_FAILURE;
+    }
+    queue->count++;
+    return EXIT_SUCCESS;
+}
+
+static int
+cmp_name(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* The regular files of a directory, sorted, without hidden files or indexes */
+static inline int
+batch_add_dir(struct batch_queue *queue, const char *dir_name)
+{
+    DIR *dir = opendir(dir_name);
+    struct dirent *entry;
+    uint32_t first = queue->count;
+    int ret = EXIT_SUCCESS;
+
+    if (dir == NULL) {
+        PERROR_FUNCTION("opendir");
+        return EXIT_FAILURE;
+    }
+    while (ret == EXIT_SUCCESS && (entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        char *name;
+        struct stat st;
+
+        if (entry->d_name[0] == '.' ||
+            (len > strlen(SIDX_SUFFIX) &&
+             strcmp(entry->d_name + len - strlen(SIDX_SUFFIX),
+                    SIDX_SUFFIX) == 0)) {
+            continue;
+        }
+        if (asprintf(&name, "%s/%s", dir_name, entry->d_name) < 0) {
+            PERROR_FUNCTION("asprintf failed for a log name");
+            ret = EXIT_FAILURE;
+            break;
+        }
+        if (stat(name, &st) == 0 && S_ISREG(st.st_mode)) {
+            ret = batch_add_name(queue, name);
+        }
+        free(name);
+    }
+    closedir(dir);
+    qsort(queue->names + first, queue->count - first, sizeof(char *),
+          cmp_name);
+    return ret;
+}
+
+/* A log, a directory of logs, or a glob pattern the shell left alone */
+static inline int
+batch_add_input(struct batch_queue *queue, const char *arg)
+{
+    struct stat st;
+    glob_t matches;
+    int ret = EXIT_SUCCESS;
+
+    if (stat(arg, &st) == 0) {
+        return S_ISDIR(st.st_mode) ? batch_add_dir(queue, arg) :
+                                     batch_add_name(queue, arg);
+    }
+    if (strpbrk(arg, "*?[") == NULL ||
+        glob(arg, 0, NULL, &matches) != 0) {
+        printf("no such log: %s\n", arg);
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; ret == EXIT_SUCCESS && i < matches.gl_pathc; i++) {
+        ret = batch_add_name(queue, matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+    return ret;
+}
+
+static void *
+batch_worker(void *arg)
+{
+    struct batch_queue *queue = (struct batch_queue *)arg;
+
+    /* the phases of the logs read side by side would overlap */
+    profile_muted = true;
+    for (;;) {
+        struct file_basic_stats f_basics = {0};
+        struct batch_result *result;
+        double start = profile_now();
+        uint32_t i;
+
+        pthread_mutex_lock(&queue->lock);
+        i = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (i >= queue->count) {
+            break;
+        }
+        result = &queue->results[i];
+
+        if (get_file_basics(&f_basics, queue->names[i]) == EXIT_SUCCESS &&
+            f_basics.first_line_stats != NULL &&
+            f_basics.last_line_stats != NULL) {
+            struct timeval duration;
+
+            timeval_subtract(&duration,
+                             &f_basics.last_line_stats->disable_time,
+                             &f_basics.first_line_stats->enable_time);
+            result->duration = duration.tv_sec + duration.tv_usec / 1000000.0;
+            result->flows = f_basics.flow_count;
+            result->records = (f_basics.num_lines > 2) ?
+                              f_basics.num_lines - 2 : 0;
+            result->tcp_pkts = f_basics.last_line_stats->total_tcp_pkts;
+            result->skipped_pkts =
+                f_basics.last_line_stats->total_skipped_tcp_pkts;
+        } else {
+            result->failed = true;
+        }
+        if (f_basics.file != NULL) {
+            cleanup_file_basic_stats(&f_basics);
+        }
+        result->secs = profile_now() - start;
+    }
+    return NULL;
+}
+
+static inline void
+show_batch_summary(const struct batch_queue *queue)
+{
+    struct batch_total total = {0};
+    uint32_t failed = 0;
+
+    printf("\nbatch summary: %u logs\n", queue->count);
+    printf(" %-40s %12s %8s %12s %14s %12s %9s\n", "log", "duration",
+           "flows", "records", "tcp_pkts", "skipped", "secs");
+    for (uint32_t i = 0; i < queue->count; i++) {
+        const struct batch_result *result = &queue->results[i];
+
+        if (result->failed) {
+            printf(" %-40s %12s\n", queue->names[i], "failed");
+            failed++;
+            continue;
+        }
+        printf(" %-40s %12.2f %8u %12u %14" PRIu64 " %12" PRIu64 " %9.3f\n",
+               queue->names[i], result->duration, result->flows,
+               result->records, result->tcp_pkts, result->skipped_pkts,
+               result->secs);
+        total.duration += result->duration;
+        total.flows += result->flows;
+        total.records += result->records;
+        total.tcp_pkts += result->tcp_pkts;
+        total.skipped_pkts += result->skipped_pkts;
+        total.secs += result->secs;
+    }
+    printf(" %-40s %12.2f %8" PRIu64 " %12" PRIu64 " %14" PRIu64 " %12" PRIu64
+           " %9.3f\n", "total", total.duration, total.flows, total.records,
+           total.tcp_pkts, total.skipped_pkts, total.secs);
+    if (failed > 0) {
+        printf("%u of %u logs could not be read\n", failed, queue->count);
+    }
+}
+
+/*
+ * Read every log named by args, each one a log, a directory of logs or a
+ * glob pattern, on a pool of jobs threads and show one summary of them all.
+ * Each log is read by one thread, so the body of a log is not split further.
+ */
+int
+batch_main(char *const args[], uint32_t nargs)
+{
+    struct batch_queue queue = {0};
+    pthread_t threads[MAX_JOBS];
+    uint32_t nthreads = (jobs > MAX_JOBS) ? MAX_JOBS : jobs;
+    uint32_t started = 0;
+    int ret = EXIT_SUCCESS;
+
+    for (uint32_t i = 0; ret == EXIT_SUCCESS && i < nargs; i++) {
+        ret = batch_add_input(&queue, args[i]);
+    }
+    if (ret == EXIT_SUCCESS && queue.count == 0) {
+        printf("no logs to read\n");
+        ret = EXIT_FAILURE;
+    }
+    if (ret == EXIT_SUCCESS) {
+        queue.results = (struct batch_result *)
+            calloc(queue.count, sizeof(struct batch_result));
+        if (queue.results == NULL) {
+            PERROR_FUNCTION("calloc failed for queue.results");
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    if (ret == EXIT_SUCCESS) {
+        if (nthreads > queue.count) {
+            nthreads = queue.count;
+        }
+        jobs = 1;
+        /* pick the splitter kernel before the threads race to do it */
+        get_delim_bitmap(NULL);
+        pthread_mutex_init(&queue.lock, NULL);
+        for (uint32_t t = 0; t < nthreads; t++) {
+            if (pthread_create(&threads[t], NULL, batch_worker, &queue) != 0) {
+                PERROR_FUNCTION("pthread_create");
+                break;
+            }
+            started++;
+        }
+        if (started == 0) {
+            batch_worker(&queue);
+            profile_muted = false;
+        }
+        for (uint32_t t = 0; t < started; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        pthread_mutex_destroy(&queue.lock);
+        if (verbose) {
+            printf("logs read by %u threads\n", started);
+        }
+        show_batch_summary(&queue);
+    }
+
+    for (uint32_t i = 0; i < queue.count; i++) {
+        free(queue.names[i]);
+    }
+    free(queue.names);
+    free(queue.results);
+    return ret;
+}
+
+#endif /* SIFTR_BATCH_H_ */
@@ -0,0 +1,192 @@
+/*
+ ============================================================================
+ Name        : siftr_bucket.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Per-flow aggregates over fixed time intervals, for --bucket
+ ============================================================================
+ */
+
+#ifndef SIFTR_BUCKET_H_
+#define SIFTR_BUCKET_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUCKET_PLOT_HEADER  "##bucket_start" TAB "samples" TAB "in_pkts" TAB \
+                            "out_pkts" TAB "cwnd_mean" TAB "cwnd_max" TAB \
+                            "inflight_max\n"
+
+extern int64_t bucket_usec;     /* the interval, 0 without --bucket */
+
+/*
+ * The records of a flow that fall in one interval. Intervals start at the
+ * first record of the log, the same origin as the relative timestamps of
+ * the cwnd plot files.
+ */
+struct time_bucket {
+    int64_t     idx;            /* starts at idx x bucket_usec */
+    uint32_t    samples;
+    uint32_t    in_pkts;
+    uint32_t    out_pkts;
+    uint32_t    cwnd_max;
+    uint32_t    inflight_max;
+    uint64_t    cwnd_sum;
+};
+
+/* The intervals of a flow that have records, in time order */
+struct bucket_series {
+    struct time_bucket  *buckets;
+    uint32_t            count;
+    uint32_t            cap;
+};
+
+/* Parse an interval such as "10ms", "1s", "250us" or "0.5", in seconds */
+static inline int
+parse_interval(const char *arg, int64_t *usec)
+{
+    char *end;
+    double value;
+    double scale = 1e6;
+
+    errno = 0;
+    value = strtod(arg, &end);
+    if (errno != 0 || end == arg) {
+        return EXIT_FAILURE;
+    }
+    if (strcmp(end, "us") == 0) {
+        scale = 1;
+    } else if (strcmp(end, "ms") == 0) {
+        scale = 1e3;
+    } else if (strcmp(end, "s") != 0 && *end != '\0') {
+        return EXIT_FAILURE;
+    }
+    value = value * scale + 0.5;
+    if (!(value >= 1 && value <= (double)INT64_MAX / 2)) {
+        return EXIT_FAILURE;
+    }
+    *usec = (int64_t)value;
+    return EXIT_SUCCESS;
+}
+
+/* Index of the interval that usec falls in, rounded down before the origin */
+static inline int64_t
+bucket_index(int64_t usec, int64_t first_usec)
+{
+    int64_t rel = usec - first_usec;
+
+    return (rel >= 0) ? rel / bucket_usec : -((-rel - 1) / bucket_usec) - 1;
+}
+
+/*
+ * The bucket of interval idx, added if the flow has none yet. The records
+ * come in time order, so it is almost always the last one or a new last one.
+ */
+static inline struct time_bucket *
+bucket_series_at(struct bucket_series *series, int64_t idx)
+{
+    uint32_t pos = series->count;
+
+    if (pos > 0 && series->buckets[pos - 1].idx == idx) {
+        return &series->buckets[pos - 1];
+    }
+    while (pos > 0 && series->buckets[pos - 1].idx > idx) {
+        pos--;
+    }
+    if (pos > 0 && series->buckets[pos - 1].idx == idx) {
+        return &series->buckets[pos - 1];
+    }
+
+    if (series->count == series->cap) {
+        uint32_t cap = series->cap ? series->cap * 2 : 16;
+        struct time_bucket *buckets = (struct time_bucket *)
+            realloc(series->buckets, cap * sizeof(struct time_bucket));
+
+        if (buckets == NULL) {
+            PERROR_FUNCTION("realloc failed for series->buckets");
+            return NULL;
+        }
+        series->buckets = buckets;
+        series->cap = cap;
+    }
+    memmove(&series->buckets[pos + 1], &series->buckets[pos],
+            (series->count - pos) * sizeof(struct time_bucket));
+    memset(&series->buckets[pos], 0, sizeof(struct time_bucket));
+    series->buckets[pos].idx = idx;
+    series->count++;
+    return &series->buckets[pos];
+}
+
+static inline void
+bucket_series_add(struct bucket_series *series, int64_t idx, char direction,
+                  uint32_t cwnd, uint32_t inflight)
+{
+    struct time_bucket *b = bucket_series_at(series, idx);
+
+    if (b == NULL) {
+        return;
+    }
+    b->samples++;
+    b->in_pkts += (direction == 'i');
+    b->out_pkts += (direction == 'o');
+    b->cwnd_sum += cwnd;
+    b->cwnd_max = (cwnd > b->cwnd_max) ? cwnd : b->cwnd_max;
+    b->inflight_max = (inflight > b->inflight_max) ? inflight : b->inflight_max;
+}
+
+/* Fold the buckets of src, later records of the same flow, into dst */
+static inline void
+bucket_series_merge(struct bucket_series *dst, const struct bucket_series *src)
+{
+    for (uint32_t i = 0; i < src->count; i++) {
+        const struct time_bucket *from = &src->buckets[i];
+        struct time_bucket *b = bucket_series_at(dst, from->idx);
+
+        if (b == NULL) {
+            return;
+        }
+        b->samples += from->samples;
+        b->in_pkts += from->in_pkts;
+        b->out_pkts += from->out_pkts;
+        b->cwnd_sum += from->cwnd_sum;
+        b->cwnd_max = (from->cwnd_max > b->cwnd_max) ?
+                      from->cwnd_max : b->cwnd_max;
+        b->inflight_max = (from->inflight_max > b->inflight_max) ?
+                          from->inflight_max : b->inflight_max;
+    }
+}
+
+static inline void
+bucket_series_free(struct bucket_series *series)
+{
+    if (series != NULL) {
+        free(series->buckets);
+        free(series);
+    }
+}
+
+static inline void
+bucket_series_write(struct plot_outputs *plots, struct plot_output *out,
+                    const struct bucket_series *series)
+{
+    for (uint32_t i = 0; i < series->count; i++) {
+        const struct time_bucket *b = &series->buckets[i];
+        int64_t start = b->idx * bucket_usec;
+        char *p = plot_reserve(plots, out, PLOT_MAX_LINE);
+
+        if (p == NULL) {
+            return;
+        }
+        p = plot_put_usec(p, start);
+        p += sprintf(p, "\t%u\t%u\t%u\t%.2f\t%u\t%u\n", b->samples,
+                     b->in_pkts, b->out_pkts,
+                     (double)b->cwnd_sum / b->samples, b->cwnd_max,
+                     b->inflight_max);
+        plot_commit(out, p);
+    }
+}
+
+#endif /* SIFTR_BUCKET_H_ */
@@ -0,0 +1,349 @@
+/*
+ ============================================================================
+ Name        : siftr_columns.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : In-memory per-flow columns of the log records, for --columns
+ ============================================================================
+ */
+
+#ifndef SIFTR_COLUMNS_H_
+#define SIFTR_COLUMNS_H_
+
+enum {
+    COLUMN_MIN_ROWS = 64,
+    COLUMN_DICT_SIZE = 16,          /* distinct values a dictionary keeps */
+    COLUMN_DICT_VALUE_LEN = 8,
+    COLUMN_DICT_OTHER = UINT8_MAX,  /* code of the values it could not keep */
+};
+
+/*
+ * Bytes per row of each column, 0 if the field is the same in every record of
+ * a flow: the addresses, ports and flowid are in flow_info. TIMESTAMP is kept
+ * as microseconds, DIRECTION and FLOW_TYPE as dictionary codes. The window
+ * scales, the TCP state, issack and the MSS fit in narrower types; a larger
+ * value is stored as the largest one the column holds.
+ */
+static const uint8_t column_field_width[TOTAL_FIELDS] = {
+    [DIRECTION] = 1,    [TIMESTAMP] = 8,    [LOIP] = 0,         [LPORT] = 0,
+    [FOIP] = 0,         [FPORT] = 0,        [SSTHRESH] = 4,     [CWND] = 4,
+    [FLAG2] = 4,        [SNDWIN] = 4,       [RCVWIN] = 4,       [SNDSCALE] = 1,
+    [RCVSCALE] = 1,     [STATE] = 1,        [MSS] = 2,          [SRTT] = 4,
+    [ISSACK] = 1,       [FLAG] = 4,         [RTO] = 4,
+    [SND_BUF_HIWAT] = 4,    [SND_BUF_CC] = 4,   [RCV_BUF_HIWAT] = 4,
+    [RCV_BUF_CC] = 4,   [INFLIGHT_BYTES] = 4,   [REASS_QLEN] = 4,
+    [FLOW_ID] = 0,      [FLOW_TYPE] = 1,
+};
+
+enum {
+    COLUMN_DICT_DIRECTION,
+    COLUMN_DICT_FLOW_TYPE,
+    COLUMN_DICTS,
+};
+
+static const int column_dict_fields[COLUMN_DICTS] = {
+    [COLUMN_DICT_DIRECTION] = DIRECTION,
+    [COLUMN_DICT_FLOW_TYPE] = FLOW_TYPE,
+};
+
+/* The distinct values of a text column, a row keeps the index of its value */
+struct column_dict {
+    uint8_t     count;
+    char        values[COLUMN_DICT_SIZE][COLUMN_DICT_VALUE_LEN];
+};
+
+/* The records of one flow in file order, one contiguous array per field */
+struct flow_columns {
+    uint32_t            rows;
+    uint32_t            cap;
+    void                *cols[TOTAL_FIELDS];    /* NULL if not kept per row */
+    struct column_dict  dicts[COLUMN_DICTS];
+};
+
+#define COLUMN(fc, idx, type)   ((type *)(fc)->cols[(idx)])
+
+static inline uint8_t
+column_dict_code(struct column_dict *dict, const char *value, size_t len)
+{
+    if (len >= COLUMN_DICT_VALUE_LEN) {
+        return COLUMN_DICT_OTHER;
+    }
+    for (uint8_t k = 0; k < dict->count; k++) {
+        if (memcmp(dict->values[k], value, len) == 0 &&
+            dict->values[k][len] == '\0') {
+            return k;
+        }
+    }
+    if (dict->count == COLUMN_DICT_SIZE) {
+        return COLUMN_DICT_OTHER;
+    }
+    memcpy(dict->values[dict->count], value, len);
+    dict->values[dict->count][len] = '\0';
+    return dict->count++;
+}
+
+static inline const char *
+column_dict_value(const struct column_dict *dict, uint8_t code)
+{
+    return (code < dict->count) ? dict->values[code] : "?";
+}
+
+/* Value of a numeric column other than TIMESTAMP at row */
+static inline uint32_t
+column_value(const struct flow_columns *fc, int idx, uint32_t row)
+{
+    switch (column_field_width[idx]) {
+        case 1:
+            return COLUMN(fc, idx, const uint8_t)[row];
+        case 2:
+            return COLUMN(fc, idx, const uint16_t)[row];
+        default:
+            return COLUMN(fc, idx, const uint32_t)[row];
+    }
+}
+
+static inline void
+column_set(struct flow_columns *fc, int idx, uint32_t row, uint32_t value)
+{
+    switch (column_field_width[idx]) {
+        case 1:
+            COLUMN(fc, idx, uint8_t)[row] =
+                (value > UINT8_MAX) ? UINT8_MAX : (uint8_t)value;
+            break;
+        case 2:
+            COLUMN(fc, idx, uint16_t)[row] =
+                (value > UINT16_MAX) ? UINT16_MAX : (uint16_t)value;
+            break;
+        default:
+            COLUMN(fc, idx, uint32_t)[row] = value;
+            break;
+    }
+}
+
+/* Set the room of every column to cap records */
+static inline int
+flow_columns_resize(struct flow_columns *fc, uint32_t cap)
+{
+    for (int i = 0; i < TOTAL_FIELDS; i++) {
+        void *col;
+
+        if (column_field_width[i] == 0) {
+            continue;
+        }
+        col = realloc(fc->cols[i], (size_t)cap * column_field_width[i]);
+        if (col == NULL) {
+            PERROR_FUNCTION("realloc failed for a column");
+            return EXIT_FAILURE;
+        }
+        fc->cols[i] = col;
+    }
+    fc->cap = cap;
+    return EXIT_SUCCESS;
+}
+
+/* Make room for rows records in every column */
+static inline int
+flow_columns_reserve(struct flow_columns *fc, uint32_t rows)
+{
+    uint32_t cap = (fc->cap > 0) ? fc->cap : COLUMN_MIN_ROWS;
+
+    if (rows <= fc->cap) {
+        return EXIT_SUCCESS;
+    }
+    while (cap < rows) {
+        cap *= 2;
+    }
+    return flow_columns_resize(fc, cap);
+}
+
+void
+flow_columns_free(struct flow_columns *fc)
+{
+    if (fc != NULL) {
+        for (int i = 0; i < TOTAL_FIELDS; i++) {
+            free(fc->cols[i]);
+        }
+        free(fc);
+    }
+}
+
+/* Add a record to the columns of its flow, with -c */
+int
+flow_columns_record(struct flow_info *flow, const struct record_fields *rf)
+{
+    struct flow_columns *fc = flow->cols;
+    int64_t usec = 0;
+    uint32_t row;
+
+    if (fc == NULL) {
+        fc = (struct flow_columns *)calloc(1, sizeof(struct flow_columns));
+        if (fc == NULL) {
+            PERROR_FUNCTION("calloc failed for flow->cols");
+            return EXIT_FAILURE;
+        }
+        flow->cols = fc;
+    }
+    if (flow_columns_reserve(fc, fc->rows + 1) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    row = fc->rows++;
+
+    field_usec(rf, TIMESTAMP, &usec);
+    COLUMN(fc, TIMESTAMP, int64_t)[row] = usec;
+    for (int d = 0; d < COLUMN_DICTS; d++) {
+        int idx = column_dict_fields[d];
+
+        COLUMN(fc, idx, uint8_t)[row] =
+            column_dict_code(&fc->dicts[d], FIELD_PTR(rf, idx),
+                             FIELD_LEN(rf, idx));
+    }
+    for (int i = SSTHRESH; i < FLOW_ID; i++) {
+        uint32_t value = 0;
+
+        field_u32(rf, i, &value);
+        column_set(fc, i, row, value);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Add the rows of src, later records of the same flow, to dst */
+int
+flow_columns_append(struct flow_columns *dst, const struct flow_columns *src)
+{
+    if (flow_columns_reserve(dst, dst->rows + src->rows) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < TOTAL_FIELDS; i++) {
+        size_t width = column_field_width[i];
+
+        if (width != 0) {
+            memcpy((char *)dst->cols[i] + dst->rows * width, src->cols[i],
+                   src->rows * width);
+        }
+    }
+    /* the codes of src are the indexes into its own dictionaries */
+    for (int d = 0; d < COLUMN_DICTS; d++) {
+        const struct column_dict *from = &src->dicts[d];
+        uint8_t *codes = COLUMN(dst, column_dict_fields[d], uint8_t) + dst->rows;
+        uint8_t remap[COLUMN_DICT_SIZE];
+
+        for (uint8_t k = 0; k < from->count; k++) {
+            remap[k] = column_dict_code(&dst->dicts[d], from->values[k],
+                                        strlen(from->values[k]));
+        }
+        for (uint32_t r = 0; r < src->rows; r++) {
+            codes[r] = (codes[r] < from->count) ? remap[codes[r]] :
+                       COLUMN_DICT_OTHER;
+        }
+    }
+    dst->rows += src->rows;
+    return EXIT_SUCCESS;
+}
+
+/* The -m stats of every flow, one pass per metric column */
+void
+columns_flow_stats(struct file_basic_stats *f_basics)
+{
+    for (uint32_t i = 0; i < f_basics->flow_count; i++) {
+        struct flow_info *flow = &f_basics->flow_list[i];
+        const struct flow_columns *fc = flow->cols;
+        const uint32_t *values[METRIC_COUNT];
+
+        if (fc == NULL || fc->rows == 0) {
+            continue;
+        }
+        flow->stats = (struct flow_stats *)calloc(1, sizeof(struct flow_stats));
+        if (flow->stats == NULL) {
+            PERROR_FUNCTION("calloc failed for flow->stats");
+            return;
+        }
+        for (int m = 0; m < METRIC_COUNT; m++) {
+            values[m] = COLUMN(fc, metric_fields[m], const uint32_t);
+        }
+        if (flow_stats_add_columns(flow->stats,
+                                   COLUMN(fc, TIMESTAMP, const int64_t),
+                                   values, fc->rows) != EXIT_SUCCESS) {
+            return;
+        }
+    }
+}
+
+/* Memory held by the columns of all the flows */
+size_t
+columns_size(const struct file_basic_stats *f_basics)
+{
+    size_t row_size = 0, size = 0;
+
+    for (int i = 0; i < TOTAL_FIELDS; i++) {
+        row_size += column_field_width[i];
+    }
+    for (uint32_t i = 0; i < f_basics->flow_count; i++) {
+        const struct flow_columns *fc = f_basics->flow_list[i].cols;
+
+        if (fc != NULL) {
+            size += sizeof(*fc) + (size_t)fc->cap * row_size;
+        }
+    }
+    return size;
+}
+
+/* stats_into_plot_files() served from the columns, one flow at a time */
+void
+columns_into_plot_files(struct file_basic_stats *f_basics,
+                        const uint32_t *flowids, uint32_t count)
+{
+    const struct flow_columns *first = (f_basics->flow_table.count > 0) ?
+                                       f_basics->flow_list[0].cols : NULL;
+    struct plot_outputs plots;
+    int64_t first_usec;
+    int64_t lo, hi;
+
+    if (plot_outputs_init(&plots, flowids, count,
+                          cwnd_plot_header()) != EXIT_SUCCESS) {
+        plot_outputs_close(&plots);
+        return;
+    }
+    cwnd_decimate_init(f_basics, &plots);
+
+    /* flow_list[0] holds the first record of the log */
+    first_usec = (first != NULL && first->rows > 0) ?
+                 COLUMN(first, TIMESTAMP, const int64_t)[0] : 0;
+    plot_window(f_basics, first_usec, &lo, &hi);
+    for (uint32_t i = 0; i < count; i++) {
+        const struct flow_columns *fc;
+        const struct column_dict *dirs;
+        const int64_t *ts;
+        const uint8_t *direction;
+        const uint32_t *cwnd, *ssthresh, *t_flags, *t_flags2;
+        uint32_t idx;
+
+        if (!flow_table_find(&f_basics->flow_table, flowids[i], &idx) ||
+            f_basics->flow_list[idx].cols == NULL) {
+            continue;
+        }
+        fc = f_basics->flow_list[idx].cols;
+        dirs = &fc->dicts[COLUMN_DICT_DIRECTION];
+        ts = COLUMN(fc, TIMESTAMP, const int64_t);
+        direction = COLUMN(fc, DIRECTION, const uint8_t);
+        cwnd = COLUMN(fc, CWND, const uint32_t);
+        ssthresh = COLUMN(fc, SSTHRESH, const uint32_t);
+        t_flags = COLUMN(fc, FLAG, const uint32_t);
+        t_flags2 = COLUMN(fc, FLAG2, const uint32_t);
+
+        /* the timestamps of a flow are in order, find the window in them */
+        for (uint32_t r = (uint32_t)usec_lower_bound(ts, fc->rows, lo);
+             r < fc->rows && ts[r] <= hi; r++) {
+            const char *dir = column_dict_value(dirs, direction[r]);
+
+            plot_cwnd_values(&plots, &plots.outs[i], dir, strlen(dir),
+                             ts[r] - first_usec, cwnd[r], ssthresh[r],
+                             t_flags[r], t_flags2[r]);
+        }
+    }
+
+    cwnd_decimate_flush(&plots);
+    plot_outputs_close(&plots);
+}
+
+#endif /* SIFTR_COLUMNS_H_ */
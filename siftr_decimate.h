@@ -0,0 +1,308 @@
+/*
+ ============================================================================
+ Name        : siftr_decimate.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Min/max decimation of the cwnd plot files, for --max-points
+ ============================================================================
+ */
+
+#ifndef SIFTR_DECIMATE_H_
+#define SIFTR_DECIMATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+enum {
+    DECIMATE_KEEP = 4,          /* rows kept of a bucket: first, min, max, last */
+    DECIMATE_LANES = 2,         /* inbound, and everything else */
+    DECIMATE_MIN_POINTS = DECIMATE_KEEP * (DECIMATE_LANES + 1),
+};
+
+extern uint32_t max_points;     /* per flow, 0 to keep all */
+
+struct cwnd_point {
+    int64_t     usec;
+    uint32_t    cwnd;
+    uint32_t    ssthresh;
+    uint32_t    t_flags;
+    uint32_t    t_flags2;
+    uint64_t    seq;            /* row of its direction */
+    char        direction;
+    bool        keep;           /* picked by cwnd_kept_merge() */
+};
+
+/* The bucket being filled of one direction */
+struct cwnd_lane {
+    uint64_t            rows;   /* of this direction so far */
+    uint64_t            n;      /* of them in the open bucket */
+    struct cwnd_point   first;
+    struct cwnd_point   min;
+    struct cwnd_point   max;
+    struct cwnd_point   last;
+};
+
+/*
+ * The rows of a direction are cut into buckets of per_bucket rows in a row,
+ * and only the first, the last and the ones with the lowest and the highest
+ * cwnd of each are kept, in the order they came in. A drop of cwnd thus
+ * stays in the plot however many rows there are.
+ *
+ * How many rows a flow has inside --from/--to, or on a pipe or a followed
+ * log, is not known up front, so per_bucket starts at 1 and is doubled
+ * whenever the kept rows would pass max_points. The kept rows of two
+ * neighbouring buckets hold the first, last, min and max of both, so they
+ * are merged the same as if the buckets had been one from the start. The
+ * kept rows are written once all the rows are in.
+ */
+struct cwnd_decimator {
+    uint64_t            per_bucket;
+    struct cwnd_lane    lanes[DECIMATE_LANES];
+    struct cwnd_point   *kept;
+    uint32_t            kept_cnt;
+    uint32_t            kept_cap;
+};
+
+static inline int
+cwnd_lane_of(char direction)
+{
+    return direction != 'i';
+}
+
+/*
+ * Keep only the first, min, max and last row of each bucket of per_bucket
+ * rows. Each bucket is one run of the kept rows of its direction.
+ */
+static inline void
+cwnd_kept_merge(struct cwnd_decimator *dec)
+{
+    uint32_t cnt = 0;
+
+    for (int l = 0; l < DECIMATE_LANES; l++) {
+        struct cwnd_point *first = NULL, *min = NULL, *max = NULL;
+        struct cwnd_point *last = NULL;
+
+        for (uint32_t i = 0; i <= dec->kept_cnt; i++) {
+            struct cwnd_point *p = (i < dec->kept_cnt) ? &dec->kept[i] : NULL;
+
+            if (p != NULL && cwnd_lane_of(p->direction) != l) {
+                continue;
+            }
+            if (first != NULL && (p == NULL ||
+                p->seq / dec->per_bucket != first->seq / dec->per_bucket)) {
+                first->keep = min->keep = max->keep = last->keep = true;
+                first = NULL;
+            }
+            if (p == NULL) {
+                break;
+            }
+            if (first == NULL) {
+                first = min = max = p;
+            } else if (p->cwnd < min->cwnd) {
+                min = p;
+            } else if (p->cwnd > max->cwnd) {
+                max = p;
+            }
+            last = p;
+        }
+    }
+    for (uint32_t i = 0; i < dec->kept_cnt; i++) {
+        if (dec->kept[i].keep) {
+            dec->kept[cnt] = dec->kept[i];
+            dec->kept[cnt++].keep = false;
+        }
+    }
+    dec->kept_cnt = cnt;
+}
+
+static inline int
+cwnd_kept_add(struct cwnd_decimator *dec, const struct cwnd_point *p)
+{
+    if (dec->kept_cnt == dec->kept_cap && dec->kept_cap < max_points) {
+        uint32_t cap = (dec->kept_cap > 0) ? dec->kept_cap * 2 : 64;
+        struct cwnd_point *kept;
+
+        if (cap > max_points) {
+            cap = max_points;
+        }
+        kept = (struct cwnd_point *)realloc(dec->kept, cap * sizeof(*kept));
+        if (kept == NULL) {
+            PERROR_FUNCTION("realloc failed for dec->kept");
+            return EXIT_FAILURE;
+        }
+        dec->kept = kept;
+        dec->kept_cap = cap;
+    }
+    /* a bucket holds at most DECIMATE_KEEP rows, so this ends */
+    while (dec->kept_cnt == max_points) {
+        dec->per_bucket *= 2;
+        cwnd_kept_merge(dec);
+    }
+    dec->kept[dec->kept_cnt++] = *p;
+    return EXIT_SUCCESS;
+}
+
+/* Keep the picked rows of the open bucket and start the next one */
+static inline void
+cwnd_lane_emit(struct cwnd_decimator *dec, struct cwnd_lane *lane)
+{
+    const struct cwnd_point *keep[DECIMATE_KEEP] = {
+        &lane->first, &lane->min, &lane->max, &lane->last,
+    };
+    uint64_t added = UINT64_MAX;
+
+    if (lane->n == 0) {
+        return;
+    }
+    for (int i = 1; i < DECIMATE_KEEP; i++) {
+        const struct cwnd_point *p = keep[i];
+        int j = i;
+
+        while (j > 0 && keep[j - 1]->seq > p->seq) {
+            keep[j] = keep[j - 1];
+            j--;
+        }
+        keep[j] = p;
+    }
+    for (int i = 0; i < DECIMATE_KEEP; i++) {
+        const struct cwnd_point *p = keep[i];
+
+        if (p->seq == added) {
+            continue;
+        }
+        added = p->seq;
+        if (cwnd_kept_add(dec, p) != EXIT_SUCCESS) {
+            break;
+        }
+    }
+    lane->n = 0;
+}
+
+void
+cwnd_decimate(struct plot_output *out, char direction, int64_t relative_usec,
+              uint32_t cwnd, uint32_t ssthresh, uint32_t t_flags,
+              uint32_t t_flags2)
+{
+    struct cwnd_decimator *dec = out->decim;
+    struct cwnd_lane *lane = &dec->lanes[cwnd_lane_of(direction)];
+    struct cwnd_point p = {
+        .usec = relative_usec, .cwnd = cwnd, .ssthresh = ssthresh,
+        .t_flags = t_flags, .t_flags2 = t_flags2, .seq = lane->rows,
+        .direction = direction,
+    };
+
+    if (lane->n == 0) {
+        lane->first = lane->min = lane->max = p;
+    } else if (cwnd < lane->min.cwnd) {
+        lane->min = p;
+    } else if (cwnd > lane->max.cwnd) {
+        lane->max = p;
+    }
+    lane->last = p;
+    lane->n++;
+    /* per_bucket is a power of 2; after a doubling, the open bucket ends later */
+    if ((++lane->rows & (dec->per_bucket - 1)) == 0) {
+        cwnd_lane_emit(dec, lane);
+    }
+}
+
+/* Give one plot output a decimator, if --max-points is given */
+int
+cwnd_decimate_add(struct plot_output *out)
+{
+    if (max_points == 0) {
+        return EXIT_SUCCESS;
+    }
+    out->decim = (struct cwnd_decimator *)
+        calloc(1, sizeof(struct cwnd_decimator));
+    if (out->decim == NULL) {
+        PERROR_FUNCTION("calloc failed for out->decim");
+        return EXIT_FAILURE;
+    }
+    out->decim->per_bucket = 1;
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Give the flows of a log read before a decimator. A flow with no more
+ * records than --max-points fits however many of them are plotted, and is
+ * written as it is.
+ */
+void
+cwnd_decimate_init(const struct file_basic_stats *f_basics,
+                   struct plot_outputs *plots)
+{
+    for (uint32_t i = 0; i < plots->count; i++) {
+        struct plot_output *out = &plots->outs[i];
+        uint32_t idx;
+
+        if (!flow_table_find(&f_basics->flow_table, out->flowid, &idx) ||
+            f_basics->flow_list[idx].record_cnt <= max_points) {
+            continue;
+        }
+        if (cwnd_decimate_add(out) != EXIT_SUCCESS) {
+            return;
+        }
+    }
+}
+
+/* Time order across the directions, as the rows are in the log */
+static int
+cmp_cwnd_point(const void *a, const void *b)
+{
+    const struct cwnd_point *x = a, *y = b;
+
+    if (x->usec != y->usec) {
+        return (x->usec > y->usec) - (x->usec < y->usec);
+    }
+    if (x->seq != y->seq) {
+        return (x->seq > y->seq) - (x->seq < y->seq);
+    }
+    return (int)x->direction - (int)y->direction;
+}
+
+/* Write the kept rows, with the buckets that were not filled up */
+void
+cwnd_decimate_flush(struct plot_outputs *plots)
+{
+    for (uint32_t i = 0; i < plots->count; i++) {
+        struct plot_output *out = &plots->outs[i];
+        struct cwnd_decimator *dec = out->decim;
+
+        if (dec == NULL) {
+            continue;
+        }
+        for (int l = 0; l < DECIMATE_LANES; l++) {
+            cwnd_lane_emit(dec, &dec->lanes[l]);
+        }
+        /* an open bucket that began before a doubling shares its bucket */
+        cwnd_kept_merge(dec);
+        /* the buckets of the directions were kept as they filled up */
+        if (dec->kept_cnt > 1) {
+            qsort(dec->kept, dec->kept_cnt, sizeof(struct cwnd_point),
+                  cmp_cwnd_point);
+        }
+        for (uint32_t k = 0; k < dec->kept_cnt; k++) {
+            const struct cwnd_point *p = &dec->kept[k];
+
+            plot_cwnd_line(plots, out, &p->direction, 1, p->usec, p->cwnd,
+                           p->ssthresh, p->t_flags, p->t_flags2);
+        }
+        free(dec->kept);
+        dec->kept = NULL;
+        dec->kept_cnt = dec->kept_cap = 0;
+    }
+}
+
+void
+cwnd_decimate_free(struct cwnd_decimator *dec)
+{
+    if (dec != NULL) {
+        free(dec->kept);
+    }
+    free(dec);
+}
+
+#endif /* SIFTR_DECIMATE_H_ */
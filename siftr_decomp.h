@@ -0,0 +1,409 @@
+/*
+ ============================================================================
+ Name        : siftr_decomp.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Compressed log input, decompressed ahead by its own thread
+ ============================================================================
+ */
+
+#ifndef SIFTR_DECOMP_H_
+#define SIFTR_DECOMP_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+enum decomp_kind {
+    DECOMP_NONE,
+    DECOMP_GZIP,
+    DECOMP_ZSTD,
+};
+
+enum {
+    DECOMP_RING = 4,                /* buffers decompressed ahead */
+    DECOMP_BUF_SIZE = (1 << 20),
+    DECOMP_IN_SIZE = (256 << 10),
+};
+
+/* One decompressed buffer of the ring. */
+struct decomp_buf {
+    char        *data;
+    size_t      len;
+};
+
+/*
+ * A compressed file read as plain text. The thread decompresses into a ring
+ * of buffers while the reader takes the filled ones in order, so the parser
+ * and the decompressor run at the same time and the plain text never goes
+ * to disk. Reading from the start again restarts the decompression.
+ */
+struct decomp_stream {
+    FILE                *src;
+    enum decomp_kind    kind;
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    struct decomp_buf   ring[DECOMP_RING];
+    uint32_t            head;       /* oldest filled buffer */
+    uint32_t            filled;
+    size_t              head_pos;   /* bytes of ring[head] already taken */
+    bool                done;       /* the thread has filled its last buffer */
+    bool                failed;
+    bool                stop;
+    unsigned char       *in;
+#ifdef HAVE_ZLIB
+    z_stream            zs;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx           *zstd;
+#endif
+};
+
+/* Tell the compression from the magic bytes, and go back to the start. */
+static inline enum decomp_kind
+decomp_detect(FILE *file)
+{
+    unsigned char magic[4] = {0};
+    size_t n = fread(magic, 1, sizeof(magic), file);
+
+    rewind(file);
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return DECOMP_GZIP;
+    }
+    if (n == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f &&
+        magic[3] == 0xfd) {
+        return DECOMP_ZSTD;
+    }
+    return DECOMP_NONE;
+}
+
+/* Wait for an empty buffer; NULL if the reader is gone. */
+static inline struct decomp_buf *
+decomp_get_empty(struct decomp_stream *ds)
+{
+    struct decomp_buf *buf = NULL;
+
+    pthread_mutex_lock(&ds->lock);
+    while (ds->filled == DECOMP_RING && !ds->stop) {
+        pthread_cond_wait(&ds->cond, &ds->lock);
+    }
+    if (!ds->stop) {
+        buf = &ds->ring[(ds->head + ds->filled) % DECOMP_RING];
+        buf->len = 0;
+    }
+    pthread_mutex_unlock(&ds->lock);
+    return buf;
+}
+
+static inline void
+decomp_put_filled(struct decomp_stream *ds)
+{
+    pthread_mutex_lock(&ds->lock);
+    ds->filled++;
+    pthread_cond_broadcast(&ds->cond);
+    pthread_mutex_unlock(&ds->lock);
+}
+
+/*
+ * Decompress what is left of in into buf. Returns 1 at the end of the data,
+ * or of a gzip member with no input left after it, 0 to go on, -1 on corrupt
+ * input.
+ */
+static inline int
+decomp_step(struct decomp_stream *ds, struct decomp_buf *buf,
+            const unsigned char **in, size_t *in_len, bool in_eof)
+{
+    switch (ds->kind) {
+#ifdef HAVE_ZLIB
+        case DECOMP_GZIP: {
+            int rc;
+
+            ds->zs.next_in = (unsigned char *)*in;
+            ds->zs.avail_in = (uInt)*in_len;
+            ds->zs.next_out = (unsigned char *)buf->data + buf->len;
+            ds->zs.avail_out = (uInt)(DECOMP_BUF_SIZE - buf->len);
+            rc = inflate(&ds->zs, Z_NO_FLUSH);
+            buf->len = DECOMP_BUF_SIZE - ds->zs.avail_out;
+            *in = ds->zs.next_in;
+            *in_len = ds->zs.avail_in;
+            if (rc == Z_STREAM_END) {
+                /* gzip files can be concatenated */
+                inflateReset(&ds->zs);
+                return (*in_len == 0) ? 1 : 0;
+            }
+            if (rc == Z_BUF_ERROR && *in_len == 0 && in_eof) {
+                PERROR_FUNCTION("truncated gzip input");
+                return -1;
+            }
+            if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                PERROR_FUNCTION("inflate failed");
+                return -1;
+            }
+            return 0;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case DECOMP_ZSTD: {
+            ZSTD_inBuffer zin = { *in, *in_len, 0 };
+            ZSTD_outBuffer zout = { buf->data, DECOMP_BUF_SIZE, buf->len };
+            size_t rc = ZSTD_decompressStream(ds->zstd, &zout, &zin);
+
+            buf->len = zout.pos;
+            *in += zin.pos;
+            *in_len -= zin.pos;
+            if (ZSTD_isError(rc)) {
+                PERROR_FUNCTION("ZSTD_decompressStream failed");
+                return -1;
+            }
+            if (*in_len == 0 && in_eof && zout.pos < zout.size) {
+                if (rc != 0) {
+                    PERROR_FUNCTION("truncated zstd input");
+                    return -1;
+                }
+                return 1;
+            }
+            return 0;
+        }
+#endif
+        default:
+            (void)ds, (void)buf, (void)in, (void)in_len, (void)in_eof;
+            return -1;
+    }
+}
+
+static void *
+decomp_main(void *arg)
+{
+    struct decomp_stream *ds = (struct decomp_stream *)arg;
+    const unsigned char *in = ds->in;
+    size_t in_len = 0;
+    bool in_eof = false;
+    int rc = 0;
+
+    while (rc == 0) {
+        struct decomp_buf *buf = decomp_get_empty(ds);
+
+        if (buf == NULL) {
+            return NULL;
+        }
+        /* fill the whole buffer, the reader copies fewer, larger pieces */
+        while (rc == 0 && buf->len < DECOMP_BUF_SIZE) {
+            if (in_len == 0 && !in_eof) {
+                in = ds->in;
+                in_len = fread(ds->in, 1, DECOMP_IN_SIZE, ds->src);
+                in_eof = (in_len < DECOMP_IN_SIZE);
+            }
+            rc = decomp_step(ds, buf, &in, &in_len, in_eof);
+            if (rc == 1 && !in_eof) {
+                /* another gzip member may follow */
+                in = ds->in;
+                in_len = fread(ds->in, 1, DECOMP_IN_SIZE, ds->src);
+                in_eof = (in_len < DECOMP_IN_SIZE);
+                rc = (in_len > 0) ? 0 : 1;
+            }
+        }
+        decomp_put_filled(ds);
+    }
+
+    pthread_mutex_lock(&ds->lock);
+    ds->failed = (rc < 0);
+    ds->done = true;
+    pthread_cond_broadcast(&ds->cond);
+    pthread_mutex_unlock(&ds->lock);
+    return NULL;
+}
+
+static inline int
+decomp_codec_init(struct decomp_stream *ds)
+{
+    switch (ds->kind) {
+#ifdef HAVE_ZLIB
+        case DECOMP_GZIP:
+            /* 15 + 32: zlib or gzip header, detected */
+            if (inflateInit2(&ds->zs, 15 + 32) != Z_OK) {
+                PERROR_FUNCTION("inflateInit2 failed");
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+#endif
+#ifdef HAVE_ZSTD
+        case DECOMP_ZSTD:
+            ds->zstd = ZSTD_createDCtx();
+            if (ds->zstd == NULL) {
+                PERROR_FUNCTION("ZSTD_createDCtx failed");
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+#endif
+        default:
+            printf("%s input is not supported by this build\n",
+                   (ds->kind == DECOMP_GZIP) ? "gzip" : "zstd");
+            return EXIT_FAILURE;
+    }
+}
+
+static inline void
+decomp_codec_end(struct decomp_stream *ds)
+{
+#ifdef HAVE_ZLIB
+    if (ds->kind == DECOMP_GZIP) {
+        inflateEnd(&ds->zs);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (ds->kind == DECOMP_ZSTD) {
+        ZSTD_freeDCtx(ds->zstd);
+    }
+#endif
+}
+
+/* Start decompressing src from its beginning. */
+static inline int
+decomp_start(struct decomp_stream *ds)
+{
+    ds->head = ds->filled = 0;
+    ds->head_pos = 0;
+    ds->done = ds->failed = ds->stop = false;
+    if (fseek(ds->src, 0, SEEK_SET) != 0) {
+        PERROR_FUNCTION("compressed input is not seekable");
+        return EXIT_FAILURE;
+    }
+    if (decomp_codec_init(ds) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (pthread_create(&ds->thread, NULL, decomp_main, ds) != 0) {
+        PERROR_FUNCTION("pthread_create");
+        decomp_codec_end(ds);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static inline void
+decomp_halt(struct decomp_stream *ds)
+{
+    pthread_mutex_lock(&ds->lock);
+    ds->stop = true;
+    pthread_cond_broadcast(&ds->cond);
+    pthread_mutex_unlock(&ds->lock);
+    if (pthread_join(ds->thread, NULL) != 0) {
+        PERROR_FUNCTION("pthread_join");
+    }
+    decomp_codec_end(ds);
+}
+
+struct decomp_stream *
+decomp_open(FILE *src, enum decomp_kind kind)
+{
+    struct decomp_stream *ds =
+        (struct decomp_stream *)calloc(1, sizeof(struct decomp_stream));
+    bool is_ok;
+
+    if (ds == NULL) {
+        PERROR_FUNCTION("calloc failed for the decompressor");
+        return NULL;
+    }
+    ds->src = src;
+    ds->kind = kind;
+    ds->in = (unsigned char *)malloc(DECOMP_IN_SIZE);
+    is_ok = (ds->in != NULL);
+    for (uint32_t i = 0; i < DECOMP_RING; i++) {
+        ds->ring[i].data = (char *)malloc(DECOMP_BUF_SIZE);
+        is_ok &= (ds->ring[i].data != NULL);
+    }
+    if (!is_ok) {
+        PERROR_FUNCTION("malloc failed for the decompressor buffers");
+    }
+    pthread_mutex_init(&ds->lock, NULL);
+    pthread_cond_init(&ds->cond, NULL);
+    if (!is_ok || decomp_start(ds) != EXIT_SUCCESS) {
+        for (uint32_t i = 0; i < DECOMP_RING; i++) {
+            free(ds->ring[i].data);
+        }
+        free(ds->in);
+        pthread_mutex_destroy(&ds->lock);
+        pthread_cond_destroy(&ds->cond);
+        free(ds);
+        return NULL;
+    }
+    return ds;
+}
+
+/* Go back to the first byte of the plain text. */
+int
+decomp_rewind(struct decomp_stream *ds)
+{
+    decomp_halt(ds);
+    return decomp_start(ds);
+}
+
+/*
+ * Copy up to len bytes of plain text to dst, like fread(). Returns 0 at the
+ * end of the data or on an error, which then also sets *failed.
+ */
+size_t
+decomp_read(struct decomp_stream *ds, char *dst, size_t len, bool *failed)
+{
+    size_t copied = 0;
+
+    pthread_mutex_lock(&ds->lock);
+    while (copied < len) {
+        struct decomp_buf *buf;
+        size_t n;
+
+        while (ds->filled == 0 && !ds->done) {
+            pthread_cond_wait(&ds->cond, &ds->lock);
+        }
+        if (ds->filled == 0) {
+            *failed = ds->failed;
+            break;
+        }
+        buf = &ds->ring[ds->head];
+        n = buf->len - ds->head_pos;
+        if (n > len - copied) {
+            n = len - copied;
+        }
+        /* the thread does not touch a filled buffer, copy it unlocked */
+        pthread_mutex_unlock(&ds->lock);
+        memcpy(dst + copied, buf->data + ds->head_pos, n);
+        pthread_mutex_lock(&ds->lock);
+        copied += n;
+        ds->head_pos += n;
+        if (ds->head_pos == buf->len) {
+            ds->head = (ds->head + 1) % DECOMP_RING;
+            ds->filled--;
+            ds->head_pos = 0;
+            pthread_cond_broadcast(&ds->cond);
+        }
+    }
+    pthread_mutex_unlock(&ds->lock);
+    return copied;
+}
+
+void
+decomp_close(struct decomp_stream *ds)
+{
+    if (ds == NULL) {
+        return;
+    }
+    decomp_halt(ds);
+    for (uint32_t i = 0; i < DECOMP_RING; i++) {
+        free(ds->ring[i].data);
+    }
+    free(ds->in);
+    pthread_mutex_destroy(&ds->lock);
+    pthread_cond_destroy(&ds->cond);
+    free(ds);
+}
+
+#endif /* SIFTR_DECOMP_H_ */
@@ -0,0 +1,351 @@
+/*
+ ============================================================================
+ Name        : siftr_events.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Congestion events of a flow from its flag word transitions,
+               for --events
+ ============================================================================
+ */
+
+#ifndef SIFTR_EVENTS_H_
+#define SIFTR_EVENTS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EVENTS_PLOT_HEADER  "##start" TAB "duration" TAB "event" TAB \
+                            "cwnd_before" TAB "cwnd_after\n"
+
+extern bool show_events;
+
+/* The episodes, a flag that is set for a while, then the point events */
+enum congestion_event_kind {
+    EVENT_FAST_RECOVERY,
+    EVENT_CONG_RECOVERY,
+    EVENT_ECN_CWR,
+    EVENT_ECN_ECE,
+    EVENT_EPISODES,
+    EVENT_RTO = EVENT_EPISODES,     /* cwnd down to one segment */
+    EVENT_KINDS,
+};
+
+static const char *const event_names[EVENT_KINDS] = {
+    "fast_recovery", "cong_recovery", "ecn_cwr", "ecn_ece", "rto",
+};
+
+static const uint64_t event_bits[EVENT_EPISODES] = {
+    TFLAGS_STATE(TF_FASTRECOVERY, 0),
+    TFLAGS_STATE(TF_CONGRECOVERY, 0),
+    TFLAGS_STATE(0, TF2_ECN_SND_CWR),
+    TFLAGS_STATE(0, TF2_ECN_SND_ECE),
+};
+
+#define EVENT_STATE_MASK    (TFLAGS_STATE(TF_FASTRECOVERY | TF_CONGRECOVERY, \
+                                         TF2_ECN_SND_CWR | TF2_ECN_SND_ECE))
+
+struct congestion_event {
+    int64_t     start_usec;
+    int64_t     end_usec;       /* the same as start_usec for a point event */
+    uint32_t    cwnd_before;
+    uint32_t    cwnd_after;
+    uint8_t     kind;
+    bool        from_first;     /* already on at the first record */
+};
+
+/*
+ * The events of a flow, and what is needed to carry on from its last record:
+ * its flag words, cwnd and ssthresh, and the episodes still going on. The
+ * first record is kept too, so that the events of a later part of the log
+ * can be joined to these.
+ */
+struct flow_events {
+    uint64_t    records;
+    int64_t     first_usec;
+    uint64_t    first_state;
+    uint32_t    first_cwnd;
+    uint32_t    first_ssthresh;
+    uint32_t    first_mss;
+    int64_t     last_usec;
+    uint64_t    last_state;
+    uint32_t    last_cwnd;
+    uint32_t    last_ssthresh;
+    int64_t     open_since[EVENT_EPISODES];
+    uint32_t    open_cwnd[EVENT_EPISODES];      /* cwnd before it started */
+    bool        open_from_first[EVENT_EPISODES];
+    struct congestion_event *list;
+    uint32_t    count;
+    uint32_t    cap;
+};
+
+static inline void
+flow_events_push(struct flow_events *ev, const struct congestion_event *e)
+{
+    if (ev->count == ev->cap) {
+        uint32_t cap = ev->cap ? ev->cap * 2 : 16;
+        struct congestion_event *list = (struct congestion_event *)
+            realloc(ev->list, cap * sizeof(struct congestion_event));
+
+        if (list == NULL) {
+            PERROR_FUNCTION("realloc failed for ev->list");
+            return;
+        }
+        ev->list = list;
+        ev->cap = cap;
+    }
+    ev->list[ev->count++] = *e;
+}
+
+/* cwnd cut to at most one segment, with a new ssthresh: a retransmit timeout */
+static inline bool
+event_is_rto(uint32_t last_cwnd, uint32_t last_ssthresh, uint32_t cwnd,
+             uint32_t ssthresh, uint32_t mss)
+{
+    return cwnd <= mss && last_cwnd > mss && ssthresh != last_ssthresh;
+}
+
+/* Start or end the episodes whose flag changed */
+static inline void
+flow_events_toggle(struct flow_events *ev, uint64_t changed, uint64_t state,
+                   int64_t usec, uint32_t cwnd)
+{
+    for (int k = 0; k < EVENT_EPISODES; k++) {
+        if ((changed & event_bits[k]) == 0) {
+            continue;
+        }
+        if (state & event_bits[k]) {
+            ev->open_since[k] = usec;
+            ev->open_cwnd[k] = ev->last_cwnd;
+            ev->open_from_first[k] = false;
+        } else {
+            struct congestion_event e = {
+                .start_usec = ev->open_since[k], .end_usec = usec,
+                .cwnd_before = ev->open_cwnd[k], .cwnd_after = cwnd,
+                .kind = (uint8_t)k, .from_first = ev->open_from_first[k],
+            };
+
+            flow_events_push(ev, &e);
+            ev->open_since[k] = -1;
+        }
+    }
+}
+
+/*
+ * Add a record. Most records change none of the flags, which takes one XOR
+ * and one compare to tell. mss is only looked at when cwnd went down.
+ */
+static inline void
+flow_events_add(struct flow_events *ev, int64_t usec, uint32_t t_flags,
+                uint32_t t_flags2, uint32_t cwnd, uint32_t ssthresh,
+                uint32_t mss)
+{
+    uint64_t state = TFLAGS_STATE(t_flags, t_flags2);
+    uint64_t changed;
+
+    if (ev->records++ == 0) {
+        ev->first_usec = usec;
+        ev->first_state = state;
+        ev->first_cwnd = cwnd;
+        ev->first_ssthresh = ssthresh;
+        ev->first_mss = mss;
+        for (int k = 0; k < EVENT_EPISODES; k++) {
+            bool on = (state & event_bits[k]) != 0;
+
+            ev->open_since[k] = on ? usec : -1;
+            ev->open_cwnd[k] = cwnd;
+            ev->open_from_first[k] = on;
+        }
+    } else {
+        changed = (state ^ ev->last_state) & EVENT_STATE_MASK;
+        if (changed != 0) {
+            flow_events_toggle(ev, changed, state, usec, cwnd);
+        }
+        if (cwnd < ev->last_cwnd &&
+            event_is_rto(ev->last_cwnd, ev->last_ssthresh, cwnd, ssthresh,
+                         mss)) {
+            struct congestion_event e = {
+                .start_usec = usec, .end_usec = usec,
+                .cwnd_before = ev->last_cwnd, .cwnd_after = cwnd,
+                .kind = EVENT_RTO,
+            };
+
+            flow_events_push(ev, &e);
+        }
+    }
+    ev->last_usec = usec;
+    ev->last_state = state;
+    ev->last_cwnd = cwnd;
+    ev->last_ssthresh = ssthresh;
+}
+
+/*
+ * Fold the events of src, later records of the same flow, into dst. An
+ * episode src found on at its first record either goes on from one of dst,
+ * or was started by that record; one dst had on that src found off ended
+ * at that record.
+ */
+static inline void
+flow_events_merge(struct flow_events *dst, struct flow_events *src)
+{
+    int64_t start[EVENT_EPISODES];
+    uint32_t before[EVENT_EPISODES];
+    bool from_first[EVENT_EPISODES];
+
+    if (src->records == 0) {
+        return;
+    }
+    if (dst->records == 0) {
+        free(dst->list);
+        *dst = *src;
+        memset(src, 0, sizeof(*src));
+        return;
+    }
+
+    for (int k = 0; k < EVENT_EPISODES; k++) {
+        bool dst_on = dst->open_since[k] >= 0;
+        bool src_on = (src->first_state & event_bits[k]) != 0;
+
+        if (dst_on && !src_on) {
+            struct congestion_event e = {
+                .start_usec = dst->open_since[k], .end_usec = src->first_usec,
+                .cwnd_before = dst->open_cwnd[k], .cwnd_after = src->first_cwnd,
+                .kind = (uint8_t)k, .from_first = dst->open_from_first[k],
+            };
+
+            flow_events_push(dst, &e);
+        }
+        start[k] = (dst_on && src_on) ? dst->open_since[k] : src->first_usec;
+        before[k] = (dst_on && src_on) ? dst->open_cwnd[k] : dst->last_cwnd;
+        from_first[k] = dst_on && src_on && dst->open_from_first[k];
+    }
+    if (src->first_cwnd < dst->last_cwnd &&
+        event_is_rto(dst->last_cwnd, dst->last_ssthresh, src->first_cwnd,
+                     src->first_ssthresh, src->first_mss)) {
+        struct congestion_event e = {
+            .start_usec = src->first_usec, .end_usec = src->first_usec,
+            .cwnd_before = dst->last_cwnd, .cwnd_after = src->first_cwnd,
+            .kind = EVENT_RTO,
+        };
+
+        flow_events_push(dst, &e);
+    }
+
+    for (uint32_t i = 0; i < src->count; i++) {
+        struct congestion_event e = src->list[i];
+
+        if (e.from_first) {
+            e.start_usec = start[e.kind];
+            e.cwnd_before = before[e.kind];
+            e.from_first = from_first[e.kind];
+        }
+        flow_events_push(dst, &e);
+    }
+    for (int k = 0; k < EVENT_EPISODES; k++) {
+        if (src->open_since[k] >= 0 && src->open_from_first[k]) {
+            dst->open_since[k] = start[k];
+            dst->open_cwnd[k] = before[k];
+            dst->open_from_first[k] = from_first[k];
+        } else {
+            dst->open_since[k] = src->open_since[k];
+            dst->open_cwnd[k] = src->open_cwnd[k];
+            dst->open_from_first[k] = src->open_from_first[k];
+        }
+    }
+    dst->records += src->records;
+    dst->last_usec = src->last_usec;
+    dst->last_state = src->last_state;
+    dst->last_cwnd = src->last_cwnd;
+    dst->last_ssthresh = src->last_ssthresh;
+}
+
+static inline void
+flow_events_free(struct flow_events *ev)
+{
+    if (ev != NULL) {
+        free(ev->list);
+        free(ev);
+    }
+}
+
+static int
+cmp_event_start(const void *a, const void *b)
+{
+    const struct congestion_event *x = a, *y = b;
+
+    if (x->start_usec != y->start_usec) {
+        return (x->start_usec > y->start_usec) - (x->start_usec < y->start_usec);
+    }
+    if (x->kind != y->kind) {
+        return (int)x->kind - (int)y->kind;
+    }
+    if (x->end_usec != y->end_usec) {
+        return (x->end_usec > y->end_usec) - (x->end_usec < y->end_usec);
+    }
+    return (x->cwnd_before > y->cwnd_before) - (x->cwnd_before < y->cwnd_before);
+}
+
+/*
+ * End the episodes still on at the last record there, and sort the events
+ * by when they started. Returns how many of each kind there are, and the
+ * time spent in each episode.
+ */
+static inline void
+flow_events_finish(struct flow_events *ev, uint32_t counts[EVENT_KINDS],
+                   int64_t usecs[EVENT_KINDS])
+{
+    for (int k = 0; k < EVENT_EPISODES; k++) {
+        if (ev->open_since[k] >= 0) {
+            struct congestion_event e = {
+                .start_usec = ev->open_since[k], .end_usec = ev->last_usec,
+                .cwnd_before = ev->open_cwnd[k], .cwnd_after = ev->last_cwnd,
+                .kind = (uint8_t)k, .from_first = ev->open_from_first[k],
+            };
+
+            flow_events_push(ev, &e);
+            ev->open_since[k] = -1;
+        }
+    }
+    if (ev->count > 1) {
+        qsort(ev->list, ev->count, sizeof(struct congestion_event),
+              cmp_event_start);
+    }
+
+    memset(counts, 0, EVENT_KINDS * sizeof(uint32_t));
+    memset(usecs, 0, EVENT_KINDS * sizeof(int64_t));
+    for (uint32_t i = 0; i < ev->count; i++) {
+        counts[ev->list[i].kind]++;
+        usecs[ev->list[i].kind] += ev->list[i].end_usec -
+                                   ev->list[i].start_usec;
+    }
+}
+
+/* One line per event, the start relative to first_usec like the cwnd files */
+static inline void
+flow_events_write(struct plot_outputs *plots, struct plot_output *out,
+                  const struct flow_events *ev, int64_t first_usec)
+{
+    for (uint32_t i = 0; i < ev->count; i++) {
+        const struct congestion_event *e = &ev->list[i];
+        char *p = plot_reserve(plots, out, PLOT_MAX_LINE);
+
+        if (p == NULL) {
+            return;
+        }
+        p = plot_put_usec(p, e->start_usec - first_usec);
+        *p++ = '\t';
+        p = plot_put_usec(p, e->end_usec - e->start_usec);
+        *p++ = '\t';
+        p = plot_put_str(p, event_names[e->kind], strlen(event_names[e->kind]));
+        *p++ = '\t';
+        p = plot_put_u64(p, e->cwnd_before);
+        *p++ = '\t';
+        p = plot_put_u64(p, e->cwnd_after);
+        *p++ = '\n';
+        plot_commit(out, p);
+    }
+}
+
+#endif /* SIFTR_EVENTS_H_ */
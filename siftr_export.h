@@ -0,0 +1,884 @@
+/*
+ ============================================================================
+ Name        : siftr_export.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Export of the parsed records as an Arrow IPC stream, for
+               --export
+ ============================================================================
+ */
+
+#ifndef SIFTR_EXPORT_H_
+#define SIFTR_EXPORT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    EXPORT_BATCH_ROWS = (64 << 10),     /* rows of a record batch */
+    EXPORT_META_SIZE = (16 << 10),      /* room for the metadata of a message */
+    EXPORT_SMALL_DICT = 16,             /* values DIRECTION and FLOW_TYPE keep */
+    EXPORT_ALIGN = 8,                   /* of the body buffers */
+};
+
+extern const char *export_file_name;
+
+/*
+ * The Arrow columnar format, in the IPC streaming format: a schema message,
+ * then dictionary and record batch messages, each one flatbuffer metadata
+ * followed by a body of 8 byte aligned buffers. Only the few tables the
+ * export needs are built, with the ids of Schema.fbs and Message.fbs.
+ */
+enum {
+    ARROW_METADATA_V5 = 4,
+    ARROW_HEADER_SCHEMA = 1,
+    ARROW_HEADER_DICTIONARY_BATCH = 2,
+    ARROW_HEADER_RECORD_BATCH = 3,
+    ARROW_TYPE_INT = 2,
+    ARROW_TYPE_UTF8 = 5,
+    ARROW_TYPE_TIMESTAMP = 10,
+    ARROW_TIME_UNIT_MICROSECOND = 2,
+    ARROW_CONTINUATION = 0xffffffff,
+};
+
+enum export_type {
+    EXPORT_UINT,
+    EXPORT_TIMESTAMP,   /* microseconds since the epoch, UTC */
+    EXPORT_DICT,        /* text, as a code into a dictionary of utf8 values */
+};
+
+enum {
+    EXPORT_DICT_DIRECTION,
+    EXPORT_DICT_LOIP,
+    EXPORT_DICT_FOIP,
+    EXPORT_DICT_FLOW_TYPE,
+    EXPORT_DICTS,
+};
+
+struct export_field {
+    const char  *name;
+    uint8_t     type;
+    uint8_t     width;      /* bytes per row, of the code for EXPORT_DICT */
+    int8_t      dict;       /* EXPORT_DICT_*, -1 if not dictionary encoded */
+};
+
+/* Every field of a record is a column, in the order of the log */
+static const struct export_field export_fields[TOTAL_FIELDS] = {
+    [DIRECTION] = {"direction", EXPORT_DICT, 1, EXPORT_DICT_DIRECTION},
+    [TIMESTAMP] = {"timestamp", EXPORT_TIMESTAMP, 8, -1},
+    [LOIP] = {"loip", EXPORT_DICT, 4, EXPORT_DICT_LOIP},
+    [LPORT] = {"lport", EXPORT_UINT, 2, -1},
+    [FOIP] = {"foip", EXPORT_DICT, 4, EXPORT_DICT_FOIP},
+    [FPORT] = {"fport", EXPORT_UINT, 2, -1},
+    [SSTHRESH] = {"ssthresh", EXPORT_UINT, 4, -1},
+    [CWND] = {"cwnd", EXPORT_UINT, 4, -1},
+    [FLAG2] = {"t_flags2", EXPORT_UINT, 4, -1},
+    [SNDWIN] = {"sndwin", EXPORT_UINT, 4, -1},
+    [RCVWIN] = {"rcvwin", EXPORT_UINT, 4, -1},
+    [SNDSCALE] = {"sndscale", EXPORT_UINT, 1, -1},
+    [RCVSCALE] = {"rcvscale", EXPORT_UINT, 1, -1},
+    [STATE] = {"state", EXPORT_UINT, 1, -1},
+    [MSS] = {"mss", EXPORT_UINT, 4, -1},
+    [SRTT] = {"srtt", EXPORT_UINT, 4, -1},
+    [ISSACK] = {"issack", EXPORT_UINT, 1, -1},
+    [FLAG] = {"t_flags", EXPORT_UINT, 4, -1},
+    [RTO] = {"rto", EXPORT_UINT, 4, -1},
+    [SND_BUF_HIWAT] = {"snd_buf_hiwat", EXPORT_UINT, 4, -1},
+    [SND_BUF_CC] = {"snd_buf_cc", EXPORT_UINT, 4, -1},
+    [RCV_BUF_HIWAT] = {"rcv_buf_hiwat", EXPORT_UINT, 4, -1},
+    [RCV_BUF_CC] = {"rcv_buf_cc", EXPORT_UINT, 4, -1},
+    [INFLIGHT_BYTES] = {"inflight_bytes", EXPORT_UINT, 4, -1},
+    [REASS_QLEN] = {"reass_qlen", EXPORT_UINT, 4, -1},
+    [FLOW_ID] = {"flowid", EXPORT_UINT, 4, -1},
+    [FLOW_TYPE] = {"flow_type", EXPORT_DICT, 1, EXPORT_DICT_FLOW_TYPE},
+};
+
+/*
+ * A flatbuffer built front to back into a fixed buffer. A table is written
+ * before what it points to, so its offsets are set once those are written.
+ */
+struct fb_builder {
+    uint8_t     buf[EXPORT_META_SIZE];
+    size_t      len;
+    bool        failed;     /* out of room, the message is not written */
+};
+
+/* A scalar of size bytes of a table, or with size 0 an offset set later */
+struct fb_field {
+    uint16_t    id;
+    uint8_t     size;
+    uint64_t    value;
+};
+
+enum {
+    FB_MAX_FIELDS = 8,
+};
+
+static inline size_t
+fb_align(size_t pos, size_t align)
+{
+    return (pos + align - 1) & ~(align - 1);
+}
+
+/* Room for n bytes at a multiple of align, zero filled */
+static inline size_t
+fb_alloc(struct fb_builder *fb, size_t align, size_t n)
+{
+    size_t pos = fb_align(fb->len, align);
+
+    if (pos + n > sizeof(fb->buf)) {
+        fb->failed = true;
+        return 0;
+    }
+    memset(fb->buf + fb->len, 0, pos + n - fb->len);
+    fb->len = pos + n;
+    return pos;
+}
+
+static inline void
+fb_put(struct fb_builder *fb, size_t pos, const void *value, size_t size)
+{
+    if (!fb->failed) {
+        memcpy(fb->buf + pos, value, size);
+    }
+}
+
+/* Point the offset at slot to the object at target, which comes later */
+static inline void
+fb_set_offset(struct fb_builder *fb, size_t slot, size_t target)
+{
+    uint32_t offset = (uint32_t)(target - slot);
+
+    fb_put(fb, slot, &offset, sizeof(offset));
+}
+
+/*
+ * Write a table and its vtable just before it. The widest fields go first
+ * so each one is aligned to its size. slots[i] is where fields[i] is, for
+ * the offsets and scalars set later. Returns where the table starts.
+ */
+static size_t
+fb_table(struct fb_builder *fb, const struct fb_field *fields, int n,
+         size_t *slots)
+{
+    static const uint8_t sizes[] = {8, 4, 2, 1};
+    uint16_t field_off[FB_MAX_FIELDS] = {0};
+    uint16_t vtable[2 + FB_MAX_FIELDS] = {0};
+    uint16_t nslots = 0;
+    size_t off = sizeof(int32_t);
+    size_t vt_size, pos;
+    int32_t soffset;
+
+    for (int s = 0; s < (int)sizeof(sizes); s++) {
+        for (int i = 0; i < n; i++) {
+            uint8_t size = fields[i].size ? fields[i].size : sizeof(uint32_t);
+
+            if (size == sizes[s]) {
+                off = fb_align(off, size);
+                field_off[i] = (uint16_t)off;
+                off += size;
+            }
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (fields[i].id + 1 > nslots) {
+            nslots = fields[i].id + 1;
+        }
+        vtable[2 + fields[i].id] = field_off[i];
+    }
+    vt_size = (2 + nslots) * sizeof(uint16_t);
+    vtable[0] = (uint16_t)vt_size;
+    vtable[1] = (uint16_t)off;
+
+    /* the table starts 8 byte aligned, right after its vtable */
+    pos = fb_align(fb->len + vt_size, 8);
+    fb_alloc(fb, 1, pos + off - fb->len);
+    if (fb->failed) {
+        return 0;
+    }
+    fb_put(fb, pos - vt_size, vtable, vt_size);
+    soffset = (int32_t)vt_size;
+    fb_put(fb, pos, &soffset, sizeof(soffset));
+    for (int i = 0; i < n; i++) {
+        if (slots != NULL) {
+            slots[i] = pos + field_off[i];
+        }
+        if (fields[i].size != 0) {
+            /* little endian, the low bytes of value */
+            fb_put(fb, pos + field_off[i], &fields[i].value, fields[i].size);
+        }
+    }
+    return pos;
+}
+
+/* A vector of count elements, returns where its length is */
+static inline size_t
+fb_vector(struct fb_builder *fb, uint32_t count, size_t elem_size,
+          size_t align)
+{
+    size_t pos;
+
+    if (align < sizeof(uint32_t)) {
+        align = sizeof(uint32_t);
+    }
+    /* the elements, right after the length, are aligned */
+    pos = fb_align(fb->len + sizeof(uint32_t), align) - sizeof(uint32_t);
+    fb_alloc(fb, 1, pos + sizeof(uint32_t) + count * elem_size - fb->len);
+    fb_put(fb, pos, &count, sizeof(count));
+    return pos;
+}
+
+static inline size_t
+fb_string(struct fb_builder *fb, const char *str)
+{
+    uint32_t len = (uint32_t)strlen(str);
+    size_t pos = fb_alloc(fb, sizeof(uint32_t), sizeof(uint32_t) + len + 1);
+
+    fb_put(fb, pos, &len, sizeof(len));
+    fb_put(fb, pos + sizeof(uint32_t), str, len);
+    return pos;
+}
+
+/*
+ * Start a Message, returns the slot of its header. The body length is set
+ * at *body_len_slot once the body is laid out.
+ */
+static inline size_t
+arrow_message(struct fb_builder *fb, uint8_t header_type,
+              size_t *body_len_slot)
+{
+    const struct fb_field fields[] = {
+        {0, 2, ARROW_METADATA_V5}, {1, 1, header_type}, {2, 0, 0}, {3, 8, 0},
+    };
+    size_t slots[4];
+
+    fb->len = 0;
+    fb->failed = false;
+    fb_alloc(fb, sizeof(uint32_t), sizeof(uint32_t));
+    fb_set_offset(fb, 0, fb_table(fb, fields, 4, slots));
+    *body_len_slot = slots[3];
+    return slots[2];
+}
+
+static inline size_t
+arrow_int_type(struct fb_builder *fb, int bit_width, bool is_signed)
+{
+    const struct fb_field fields[] = {{0, 4, bit_width}, {1, 1, is_signed}};
+
+    return fb_table(fb, fields, 2, NULL);
+}
+
+/* The Field of a column, its type and how it is dictionary encoded */
+static inline void
+arrow_field(struct fb_builder *fb, size_t slot, const struct export_field *ef)
+{
+    const struct fb_field fields[] = {
+        {0, 0, 0}, {1, 1, false},
+        {2, 1, (ef->type == EXPORT_UINT) ? ARROW_TYPE_INT :
+               (ef->type == EXPORT_TIMESTAMP) ? ARROW_TYPE_TIMESTAMP :
+               ARROW_TYPE_UTF8},
+        {3, 0, 0}, {5, 0, 0}, {4, 0, 0},
+    };
+    size_t slots[6];
+
+    fb_set_offset(fb, slot, fb_table(fb, fields,
+                                     (ef->type == EXPORT_DICT) ? 6 : 5,
+                                     slots));
+    fb_set_offset(fb, slots[0], fb_string(fb, ef->name));
+    fb_set_offset(fb, slots[4], fb_vector(fb, 0, sizeof(uint32_t), 0));
+    if (ef->type == EXPORT_UINT) {
+        fb_set_offset(fb, slots[3], arrow_int_type(fb, ef->width * 8, false));
+    } else if (ef->type == EXPORT_TIMESTAMP) {
+        const struct fb_field ts[] = {
+            {0, 2, ARROW_TIME_UNIT_MICROSECOND}, {1, 0, 0},
+        };
+        size_t ts_slots[2];
+
+        fb_set_offset(fb, slots[3], fb_table(fb, ts, 2, ts_slots));
+        fb_set_offset(fb, ts_slots[1], fb_string(fb, "UTC"));
+    } else {
+        const struct fb_field dict[] = {{0, 8, (uint64_t)ef->dict}, {1, 0, 0}};
+        size_t dict_slots[2];
+
+        fb_set_offset(fb, slots[3], fb_table(fb, NULL, 0, NULL));
+        fb_set_offset(fb, slots[5], fb_table(fb, dict, 2, dict_slots));
+        fb_set_offset(fb, dict_slots[1],
+                      arrow_int_type(fb, ef->width * 8, true));
+    }
+}
+
+/* A body buffer: where it is in the body and how long it is */
+struct arrow_buffer {
+    const void  *data;
+    uint64_t    len;
+};
+
+/*
+ * The RecordBatch of nodes columns of length rows with no nulls, whose bufs
+ * are laid out in the body in that order. Returns the body length.
+ */
+static uint64_t
+arrow_record_batch(struct fb_builder *fb, size_t slot, int64_t rows,
+                   uint32_t nodes, const struct arrow_buffer *bufs,
+                   uint32_t nbufs)
+{
+    const struct fb_field fields[] = {
+        {0, 8, (uint64_t)rows}, {1, 0, 0}, {2, 0, 0},
+    };
+    size_t slots[3], pos;
+    uint64_t body_len = 0;
+
+    fb_set_offset(fb, slot, fb_table(fb, fields, 3, slots));
+    pos = fb_vector(fb, nodes, 2 * sizeof(int64_t), sizeof(int64_t));
+    fb_set_offset(fb, slots[1], pos);
+    for (uint32_t i = 0; i < nodes; i++) {
+        const int64_t node[2] = {rows, 0};
+
+        fb_put(fb, pos + sizeof(uint32_t) + i * sizeof(node), node,
+               sizeof(node));
+    }
+    pos = fb_vector(fb, nbufs, 2 * sizeof(int64_t), sizeof(int64_t));
+    fb_set_offset(fb, slots[2], pos);
+    for (uint32_t i = 0; i < nbufs; i++) {
+        const int64_t buffer[2] = {(int64_t)body_len, (int64_t)bufs[i].len};
+
+        fb_put(fb, pos + sizeof(uint32_t) + i * sizeof(buffer), buffer,
+               sizeof(buffer));
+        body_len += fb_align(bufs[i].len, EXPORT_ALIGN);
+    }
+    return body_len;
+}
+
+/* The distinct values of a text column, a row keeps the code of its value */
+struct export_dict {
+    char        *data;          /* the values one after the other */
+    uint32_t    *ends;          /* ends[k] is where value k ends in data */
+    uint32_t    count;
+    uint32_t    cap;
+    uint32_t    data_len;
+    uint32_t    data_cap;
+    uint32_t    sent;           /* values already written to the stream */
+    uint32_t    limit;          /* values kept, the last one is "?" */
+};
+
+static int
+export_dict_push(struct export_dict *dict, const char *value, size_t len)
+{
+    if (dict->count == dict->cap) {
+        uint32_t cap = dict->cap ? dict->cap * 2 : 16;
+        uint32_t *ends = (uint32_t *)realloc(dict->ends,
+                                             cap * sizeof(uint32_t));
+
+        if (ends == NULL) {
+            PERROR_FUNCTION("realloc failed for dict->ends");
+            return EXIT_FAILURE;
+        }
+        dict->ends = ends;
+        dict->cap = cap;
+    }
+    if (dict->data_len + len > dict->data_cap) {
+        uint32_t cap = dict->data_cap ? dict->data_cap : 256;
+        char *data;
+
+        while (cap < dict->data_len + len) {
+            cap *= 2;
+        }
+        data = (char *)realloc(dict->data, cap);
+        if (data == NULL) {
+            PERROR_FUNCTION("realloc failed for dict->data");
+            return EXIT_FAILURE;
+        }
+        dict->data = data;
+        dict->data_cap = cap;
+    }
+    memcpy(dict->data + dict->data_len, value, len);
+    dict->data_len += (uint32_t)len;
+    dict->ends[dict->count++] = dict->data_len;
+    return EXIT_SUCCESS;
+}
+
+/* Code of value, added if new; a full dictionary codes new values as "?" */
+static inline uint32_t
+export_dict_code(struct export_dict *dict, const char *value, size_t len)
+{
+    for (uint32_t k = 0; k < dict->count; k++) {
+        uint32_t start = (k > 0) ? dict->ends[k - 1] : 0;
+
+        if (dict->ends[k] - start == len &&
+            memcmp(dict->data + start, value, len) == 0) {
+            return k;
+        }
+    }
+    if (dict->count + 1 >= dict->limit) {
+        if (dict->count + 1 == dict->limit) {
+            export_dict_push(dict, "?", 1);
+        }
+        return dict->limit - 1;
+    }
+    if (export_dict_push(dict, value, len) != EXIT_SUCCESS) {
+        return 0;
+    }
+    return dict->count - 1;
+}
+
+/* Dictionary codes of the addresses of a flow, -1 until it is first seen */
+struct export_flow_codes {
+    int32_t     loip;
+    int32_t     foip;
+};
+
+/* One record batch of the stream being built */
+struct arrow_export {
+    FILE                    *file;
+    void                    *cols[TOTAL_FIELDS];
+    uint32_t                rows;
+    uint64_t                total_rows;
+    bool                    started;    /* dictionaries written once */
+    bool                    failed;
+    struct export_dict      dicts[EXPORT_DICTS];
+    struct export_flow_codes *flow_codes;
+    struct fb_builder       fb;
+};
+
+/* Write one message: continuation, metadata length, metadata, body */
+static int
+export_write_message(struct arrow_export *exp, const struct arrow_buffer *bufs,
+                     uint32_t nbufs)
+{
+    static const uint8_t zeros[EXPORT_ALIGN];
+    uint32_t prefix[2] = {ARROW_CONTINUATION, 0};
+    size_t meta_len = fb_align(exp->fb.len, EXPORT_ALIGN);
+
+    if (exp->fb.failed) {
+        printf("--export: the metadata of a message does not fit\n");
+        exp->failed = true;
+        return EXIT_FAILURE;
+    }
+    prefix[1] = (uint32_t)meta_len;
+    fwrite(prefix, sizeof(prefix), 1, exp->file);
+    fwrite(exp->fb.buf, 1, exp->fb.len, exp->file);
+    fwrite(zeros, 1, meta_len - exp->fb.len, exp->file);
+    for (uint32_t i = 0; i < nbufs; i++) {
+        if (bufs[i].len == 0) {
+            continue;
+        }
+        fwrite(bufs[i].data, 1, bufs[i].len, exp->file);
+        fwrite(zeros, 1, fb_align(bufs[i].len, EXPORT_ALIGN) - bufs[i].len,
+               exp->file);
+    }
+    if (ferror(exp->file)) {
+        PERROR_FUNCTION("Failed to write the export file");
+        exp->failed = true;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int
+export_write_schema(struct arrow_export *exp)
+{
+    struct fb_builder *fb = &exp->fb;
+    const struct fb_field fields[] = {{0, 2, 0}, {1, 0, 0}};
+    size_t slots[2], vec, msg, body_len_slot;
+
+    msg = arrow_message(fb, ARROW_HEADER_SCHEMA, &body_len_slot);
+    fb_set_offset(fb, msg, fb_table(fb, fields, 2, slots));
+    vec = fb_vector(fb, TOTAL_FIELDS, sizeof(uint32_t), 0);
+    fb_set_offset(fb, slots[1], vec);
+    for (int i = 0; i < TOTAL_FIELDS; i++) {
+        arrow_field(fb, vec + sizeof(uint32_t) * (i + 1), &export_fields[i]);
+    }
+    return export_write_message(exp, NULL, 0);
+}
+
+/*
+ * Write the values of a dictionary added since the last batch. The first
+ * batch of every dictionary goes out before the first record batch, the
+ * next ones are deltas that add to it.
+ */
+static int
+export_write_dict(struct arrow_export *exp, int d)
+{
+    struct export_dict *dict = &exp->dicts[d];
+    struct fb_builder *fb = &exp->fb;
+    uint32_t n = dict->count - dict->sent;
+    uint32_t start = (dict->sent > 0) ? dict->ends[dict->sent - 1] : 0;
+    int32_t *offsets = (int32_t *)malloc((n + 1) * sizeof(int32_t));
+    struct arrow_buffer bufs[3];
+    const struct fb_field fields[] = {
+        {0, 8, (uint64_t)d}, {1, 0, 0}, {2, 1, exp->started},
+    };
+    size_t slots[3], msg, body_len_slot;
+    uint64_t body_len;
+    int ret;
+
+    if (offsets == NULL) {
+        PERROR_FUNCTION("malloc failed for the dictionary offsets");
+        return EXIT_FAILURE;
+    }
+    offsets[0] = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        offsets[k + 1] = (int32_t)(dict->ends[dict->sent + k] - start);
+    }
+    bufs[0] = (struct arrow_buffer){NULL, 0};
+    bufs[1] = (struct arrow_buffer){offsets, (n + 1) * sizeof(int32_t)};
+    bufs[2] = (struct arrow_buffer){dict->data + start,
+                                    (uint64_t)offsets[n]};
+
+    msg = arrow_message(fb, ARROW_HEADER_DICTIONARY_BATCH, &body_len_slot);
+    fb_set_offset(fb, msg, fb_table(fb, fields, 3, slots));
+    body_len = arrow_record_batch(fb, slots[1], n, 1, bufs, 3);
+    fb_put(fb, body_len_slot, &body_len, sizeof(body_len));
+
+    ret = export_write_message(exp, bufs, 3);
+    free(offsets);
+    dict->sent = dict->count;
+    return ret;
+}
+
+static int
+export_flush(struct arrow_export *exp)
+{
+    struct fb_builder *fb = &exp->fb;
+    struct arrow_buffer bufs[2 * TOTAL_FIELDS];
+    uint64_t body_len;
+    size_t msg, body_len_slot;
+
+    for (int d = 0; d < EXPORT_DICTS; d++) {
+        if ((!exp->started || exp->dicts[d].count > exp->dicts[d].sent) &&
+            export_write_dict(exp, d) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+    exp->started = true;
+    if (exp->rows == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    for (int i = 0; i < TOTAL_FIELDS; i++) {
+        bufs[2 * i] = (struct arrow_buffer){NULL, 0};
+        bufs[2 * i + 1] = (struct arrow_buffer){
+            exp->cols[i], (uint64_t)exp->rows * export_fields[i].width,
+        };
+    }
+    msg = arrow_message(fb, ARROW_HEADER_RECORD_BATCH, &body_len_slot);
+    body_len = arrow_record_batch(fb, msg, exp->rows, TOTAL_FIELDS, bufs,
+                                  2 * TOTAL_FIELDS);
+    fb_put(fb, body_len_slot, &body_len, sizeof(body_len));
+    exp->total_rows += exp->rows;
+    exp->rows = 0;
+    return export_write_message(exp, bufs, 2 * TOTAL_FIELDS);
+}
+
+static int
+export_open(struct arrow_export *exp, const char *name, uint32_t flow_count)
+{
+    memset(exp, 0, sizeof(*exp));
+    for (int d = 0; d < EXPORT_DICTS; d++) {
+        exp->dicts[d].limit = (d == EXPORT_DICT_DIRECTION ||
+                               d == EXPORT_DICT_FLOW_TYPE) ?
+                              EXPORT_SMALL_DICT : INT32_MAX;
+    }
+    exp->flow_codes = (struct export_flow_codes *)
+        malloc((flow_count + 1) * sizeof(struct export_flow_codes));
+    if (exp->flow_codes == NULL) {
+        PERROR_FUNCTION("malloc failed for exp->flow_codes");
+        return EXIT_FAILURE;
+    }
+    memset(exp->flow_codes, 0xff,
+           (flow_count + 1) * sizeof(struct export_flow_codes));
+    for (int i = 0; i < TOTAL_FIELDS; i++) {
+        exp->cols[i] = malloc((size_t)EXPORT_BATCH_ROWS *
+                              export_fields[i].width);
+        if (exp->cols[i] == NULL) {
+            PERROR_FUNCTION("malloc failed for an export column");
+            return EXIT_FAILURE;
+        }
+    }
+    exp->file = fopen(name, "wb");
+    if (exp->file == NULL) {
+        PERROR_FUNCTION("Failed to create the export file");
+        return EXIT_FAILURE;
+    }
+    return export_write_schema(exp);
+}
+
+/* Write the last batch and the end of stream marker, and free it all */
+static int
+export_close(struct arrow_export *exp)
+{
+    static const uint32_t eos[2] = {ARROW_CONTINUATION, 0};
+    int ret = exp->failed ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    if (exp->file != NULL) {
+        if (ret == EXIT_SUCCESS) {
+            ret = export_flush(exp);
+            fwrite(eos, sizeof(eos), 1, exp->file);
+        }
+        if (fclose(exp->file) != 0 && ret == EXIT_SUCCESS) {
+            PERROR_FUNCTION("Failed to close the export file");
+            ret = EXIT_FAILURE;
+        }
+    }
+    for (int i = 0; i < TOTAL_FIELDS; i++) {
+        free(exp->cols[i]);
+    }
+    for (int d = 0; d < EXPORT_DICTS; d++) {
+        free(exp->dicts[d].data);
+        free(exp->dicts[d].ends);
+    }
+    free(exp->flow_codes);
+    return ret;
+}
+
+static inline void
+export_set(struct arrow_export *exp, int idx, uint32_t value)
+{
+    switch (export_fields[idx].width) {
+        case 1:
+            ((uint8_t *)exp->cols[idx])[exp->rows] =
+                (value > UINT8_MAX) ? UINT8_MAX : (uint8_t)value;
+            break;
+        case 2:
+            ((uint16_t *)exp->cols[idx])[exp->rows] =
+                (value > UINT16_MAX) ? UINT16_MAX : (uint16_t)value;
+            break;
+        default:
+            ((uint32_t *)exp->cols[idx])[exp->rows] = value;
+            break;
+    }
+}
+
+static inline void
+export_set_text(struct arrow_export *exp, int idx, const char *value,
+                size_t len)
+{
+    uint32_t code = export_dict_code(&exp->dicts[export_fields[idx].dict],
+                                     value, len);
+
+    if (export_fields[idx].width == 1) {
+        ((int8_t *)exp->cols[idx])[exp->rows] = (int8_t)code;
+    } else {
+        ((int32_t *)exp->cols[idx])[exp->rows] = (int32_t)code;
+    }
+}
+
+/*
+ * The columns that are the same in every record of a flow come from its
+ * flow_info, the addresses are looked up once per flow.
+ */
+static inline void
+export_flow_columns(struct arrow_export *exp, uint32_t idx,
+                    const struct flow_info *flow)
+{
+    struct export_flow_codes *codes = &exp->flow_codes[idx];
+
+    if (codes->loip < 0) {
+        codes->loip = (int32_t)export_dict_code(
+            &exp->dicts[EXPORT_DICT_LOIP], flow->laddr, strlen(flow->laddr));
+        codes->foip = (int32_t)export_dict_code(
+            &exp->dicts[EXPORT_DICT_FOIP], flow->faddr, strlen(flow->faddr));
+    }
+    ((int32_t *)exp->cols[LOIP])[exp->rows] = codes->loip;
+    ((int32_t *)exp->cols[FOIP])[exp->rows] = codes->foip;
+    export_set(exp, LPORT, flow->lport);
+    export_set(exp, FPORT, flow->fport);
+    export_set(exp, FLOW_ID, flow->flowid);
+}
+
+/* The row is complete, write the batch once it is full */
+static inline int
+export_next_row(struct arrow_export *exp)
+{
+    if (++exp->rows == EXPORT_BATCH_ROWS) {
+        return export_flush(exp);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* A record of the log text, of the flow at idx of flow_list */
+static inline int
+export_record(struct arrow_export *exp, const struct record_fields *rf,
+              int64_t usec, uint32_t idx, const struct flow_info *flow)
+{
+    ((int64_t *)exp->cols[TIMESTAMP])[exp->rows] = usec;
+    export_set_text(exp, DIRECTION, FIELD_PTR(rf, DIRECTION),
+                    FIELD_LEN(rf, DIRECTION));
+    export_flow_columns(exp, idx, flow);
+    for (int i = SSTHRESH; i < FLOW_ID; i++) {
+        uint32_t value = 0;
+
+        field_u32(rf, i, &value);
+        export_set(exp, i, value);
+    }
+    export_set_text(exp, FLOW_TYPE, FIELD_PTR(rf, FLOW_TYPE),
+                    FIELD_LEN(rf, FLOW_TYPE));
+    return export_next_row(exp);
+}
+
+/* Record r of the sidecar index */
+static inline int
+export_sidx_record(struct arrow_export *exp, const struct sidecar_index *sidx,
+                   uint64_t r, const struct flow_info *flow, uint32_t idx)
+{
+    const char dir = ((const char *)sidx_column(sidx, DIRECTION))[r];
+    char flow_type[12];
+
+    ((int64_t *)exp->cols[TIMESTAMP])[exp->rows] =
+        ((const int64_t *)sidx_column(sidx, TIMESTAMP))[r];
+    export_set_text(exp, DIRECTION, &dir, 1);
+    export_flow_columns(exp, idx, flow);
+    for (int i = SSTHRESH; i < FLOW_ID; i++) {
+        export_set(exp, i, sidx_value(sidx, i, r));
+    }
+    export_set_text(exp, FLOW_TYPE, flow_type,
+                    (size_t)snprintf(flow_type, sizeof(flow_type), "%u",
+                                     sidx_value(sidx, FLOW_TYPE, r)));
+    return export_next_row(exp);
+}
+
+/* The records of the flows of the window from the sidecar columns */
+static int
+export_from_sidx(struct arrow_export *exp, struct file_basic_stats *f_basics,
+                 const bool *selected)
+{
+    const struct sidecar_index *sidx = f_basics->sidx;
+    const int64_t *ts = (const int64_t *)sidx_column(sidx, TIMESTAMP);
+    const uint32_t *flow_idx = (const uint32_t *)sidx_column(sidx, FLOW_ID);
+    uint64_t record_cnt = sidx->hdr->record_cnt;
+    int64_t lo, hi;
+
+    plot_window(f_basics, (record_cnt > 0) ? ts[0] : 0, &lo, &hi);
+    for (uint64_t r = usec_lower_bound(ts, record_cnt, lo);
+         r < record_cnt && ts[r] <= hi; r++) {
+        uint32_t idx = flow_idx[r];
+
+        if (idx >= f_basics->flow_count || !selected[idx]) {
+            continue;
+        }
+        if (export_sidx_record(exp, sidx, r, &f_basics->flow_list[idx],
+                               idx) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/* The records of the flows of the window in one more pass over the log */
+static int
+export_from_log(struct arrow_export *exp, struct file_basic_stats *f_basics,
+                const bool *selected)
+{
+    struct record_batch *batch;
+    int64_t first_usec = f_basics->first_usec;
+    int64_t lo = INT64_MIN, hi = INT64_MAX;
+    bool past_window = false;
+    int ret = EXIT_SUCCESS;
+
+    batch = (struct record_batch *)malloc(sizeof(*batch));
+    if (batch == NULL ||
+        reader_rewind_body(&f_basics->reader) != EXIT_SUCCESS) {
+        PERROR_FUNCTION("Failed to read the log body");
+        free(batch);
+        return EXIT_FAILURE;
+    }
+    if (first_usec >= 0) {
+        plot_window(f_basics, first_usec, &lo, &hi);
+    }
+    if (time_window.has_from && first_usec >= 0 &&
+        f_basics->reader.is_mapped) {
+        f_basics->reader.pos = time_index_seek(&f_basics->time_index, lo,
+                                               f_basics->reader.pos);
+    }
+
+    batch->block.len = 0;
+    while (ret == EXIT_SUCCESS && !past_window &&
+           next_record_batch(&f_basics->reader, batch)) {
+        for (size_t r = 0; r < batch->count; r++) {
+            struct record_fields *rf = &batch->records[r];
+            uint32_t flowid, idx;
+            int64_t usec = 0;
+
+            if (rf->field_cnt != TOTAL_FIELDS) {
+                continue;
+            }
+            field_usec(rf, TIMESTAMP, &usec);
+            if (first_usec < 0) {
+                first_usec = usec;
+                plot_window(f_basics, first_usec, &lo, &hi);
+            }
+            if (usec < lo) {
+                continue;
+            }
+            if (usec > hi) {
+                past_window = true;
+                break;
+            }
+            if (field_u32(rf, FLOW_ID, &flowid) == EXIT_SUCCESS &&
+                flow_table_find_cached(&f_basics->flow_table, flowid, &idx) &&
+                selected[idx]) {
+                ret = export_record(exp, rf, usec, idx,
+                                    &f_basics->flow_list[idx]);
+                if (ret != EXIT_SUCCESS) {
+                    break;
+                }
+            }
+        }
+    }
+    free(batch);
+    return ret;
+}
+
+/*
+ * Write the records of the flows in flowids to export_file_name, every field
+ * a column, in batches of EXPORT_BATCH_ROWS rows. Only one batch is held, so
+ * the memory does not grow with the log.
+ */
+int
+export_flows(struct file_basic_stats *f_basics, const uint32_t *flowids,
+             uint32_t count)
+{
+    struct arrow_export *exp;
+    bool *selected;
+    int ret;
+
+    selected = (bool *)calloc(f_basics->flow_count + 1, sizeof(bool));
+    exp = (struct arrow_export *)malloc(sizeof(*exp));
+    if (selected == NULL || exp == NULL) {
+        PERROR_FUNCTION("Failed to allocate the export");
+        free(selected);
+        free(exp);
+        return EXIT_FAILURE;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t idx;
+
+        if (flow_table_find(&f_basics->flow_table, flowids[i], &idx)) {
+            selected[idx] = true;
+        }
+    }
+
+    ret = export_open(exp, export_file_name, f_basics->flow_count);
+    if (ret == EXIT_SUCCESS) {
+        ret = (f_basics->sidx != NULL) ?
+              export_from_sidx(exp, f_basics, selected) :
+              export_from_log(exp, f_basics, selected);
+    }
+    if (ret != EXIT_SUCCESS) {
+        exp->failed = true;
+    }
+    ret = export_close(exp);
+    if (ret == EXIT_SUCCESS) {
+        printf("export_file_name: %s, %" PRIu64 " records\n",
+               export_file_name, exp->total_rows);
+    }
+    free(exp);
+    free(selected);
+    return ret;
+}
+
+#endif /* SIFTR_EXPORT_H_ */
@@ -0,0 +1,169 @@
+/*
+ ============================================================================
+ Name        : siftr_flow_table.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Open-addressing hash index from flowid to flow_list slot
+ ============================================================================
+ */
+
+#ifndef SIFTR_FLOW_TABLE_H_
+#define SIFTR_FLOW_TABLE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+enum {
+    FLOW_TABLE_MIN_SLOTS = 16,
+};
+
+struct flow_slot {
+    uint32_t    flowid;
+    uint32_t    idx_plus1;      /* index into flow_list plus 1, 0 if empty */
+};
+
+/* Slots looked at by this thread, for --profile */
+static _Thread_local uint64_t flow_probe_cnt;
+
+/*
+ * Linear probing table, kept at most half full. Records of one flow tend to
+ * come in runs, so the last hit is remembered in front of the table.
+ */
+struct flow_table {
+    struct flow_slot    *slots;
+    uint32_t            mask;       /* number of slots - 1 */
+    uint32_t            count;      /* number of flows indexed */
+    uint32_t            last_flowid;
+    uint32_t            last_idx_plus1;
+};
+
+static inline uint32_t
+flow_hash(uint32_t flowid)
+{
+    /* the murmur3 finalizer, siftr flowids are not always well mixed */
+    flowid ^= flowid >> 16;
+    flowid *= 0x85ebca6bU;
+    flowid ^= flowid >> 13;
+    flowid *= 0xc2b2ae35U;
+    flowid ^= flowid >> 16;
+    return flowid;
+}
+
+int
+flow_table_init(struct flow_table *table, uint32_t capacity)
+{
+    uint32_t nslots = FLOW_TABLE_MIN_SLOTS;
+
+    while (nslots < capacity * 2) {
+        nslots <<= 1;
+    }
+    table->slots = (struct flow_slot *)calloc(nslots, sizeof(struct flow_slot));
+    if (table->slots == NULL) {
+        PERROR_FUNCTION("calloc failed for table->slots");
+        return EXIT_FAILURE;
+    }
+    table->mask = nslots - 1;
+    table->count = 0;
+    table->last_idx_plus1 = 0;
+    return EXIT_SUCCESS;
+}
+
+void
+flow_table_free(struct flow_table *table)
+{
+    free(table->slots);
+    table->slots = NULL;
+    table->mask = table->count = table->last_idx_plus1 = 0;
+}
+
+static inline struct flow_slot *
+flow_table_probe(const struct flow_table *table, uint32_t flowid)
+{
+    uint32_t pos = flow_hash(flowid) & table->mask;
+
+    for (;;) {
+        struct flow_slot *slot = &table->slots[pos];
+
+        flow_probe_cnt++;
+        if (slot->idx_plus1 == 0 || slot->flowid == flowid) {
+            return slot;
+        }
+        pos = (pos + 1) & table->mask;
+    }
+}
+
+bool
+flow_table_find(const struct flow_table *table, uint32_t flowid, uint32_t *idx)
+{
+    const struct flow_slot *slot;
+
+    if (table->slots == NULL) {
+        return false;
+    }
+    slot = flow_table_probe(table, flowid);
+    if (slot->idx_plus1 == 0) {
+        return false;
+    }
+    *idx = slot->idx_plus1 - 1;
+    return true;
+}
+
+/* Same as flow_table_find(), but checks and updates the last-flow cache. */
+static inline bool
+flow_table_find_cached(struct flow_table *table, uint32_t flowid,
+                       uint32_t *idx)
+{
+    if (table->last_idx_plus1 != 0 && table->last_flowid == flowid) {
+        *idx = table->last_idx_plus1 - 1;
+        return true;
+    }
+    if (!flow_table_find(table, flowid, idx)) {
+        return false;
+    }
+    table->last_flowid = flowid;
+    table->last_idx_plus1 = *idx + 1;
+    return true;
+}
+
+static inline int
+flow_table_grow(struct flow_table *table)
+{
+    struct flow_table bigger;
+
+    if (flow_table_init(&bigger, (table->mask + 1)) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    for (uint32_t i = 0; table->slots != NULL && i <= table->mask; i++) {
+        if (table->slots[i].idx_plus1 != 0) {
+            *flow_table_probe(&bigger, table->slots[i].flowid) =
+                table->slots[i];
+        }
+    }
+    bigger.count = table->count;
+    free(table->slots);
+    *table = bigger;
+    return EXIT_SUCCESS;
+}
+
+/* Index flowid at flow_list[idx]; flowid must not be in the table yet. */
+int
+flow_table_insert(struct flow_table *table, uint32_t flowid, uint32_t idx)
+{
+    struct flow_slot *slot;
+
+    if ((table->count + 1) * 2 > table->mask + 1 &&
+        flow_table_grow(table) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    slot = flow_table_probe(table, flowid);
+    slot->flowid = flowid;
+    slot->idx_plus1 = idx + 1;
+    table->count++;
+    table->last_flowid = flowid;
+    table->last_idx_plus1 = idx + 1;
+    return EXIT_SUCCESS;
+}
+
+#endif /* SIFTR_FLOW_TABLE_H_ */
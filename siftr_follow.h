@@ -0,0 +1,510 @@
+/*
+ ============================================================================
+ Name        : siftr_follow.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Read a siftr log in one forward pass, as it is being
+               written or from a pipe
+ ============================================================================
+ */
+
+#ifndef SIFTR_FOLLOW_H_
+#define SIFTR_FOLLOW_H_
+
+#include <signal.h>
+#include <time.h>
+
+enum {
+    FOLLOW_POLL_MSECS = 200,    /* wait this long when there is nothing new */
+    FOLLOW_MIN_FLOWS = 64,
+};
+
+#define FOOT_NOTE_PREFIX    "disable_time_secs="
+
+static volatile sig_atomic_t follow_stop;
+
+static void
+follow_on_signal(int signo)
+{
+    (void)signo;
+    follow_stop = 1;
+}
+
+/*
+ * Match a flowid against a -s argument: "all", or a comma separated list of
+ * flowids and "low-high" ranges. Returns 1 on a match, 0 if there is none,
+ * or -1 if the argument is malformed.
+ */
+static inline int
+flow_spec_match(const char *spec, uint32_t flowid)
+{
+    const char *token = spec;
+    int match = 0;
+
+    while (*token != '\0') {
+        const char *end = strchr(token, ',');
+        const char *dash;
+        uint32_t low, high;
+
+        if (end == NULL) {
+            end = token + strlen(token);
+        }
+        dash = memchr(token, '-', end - token);
+
+        if ((size_t)(end - token) == strlen("all") &&
+            strncmp(token, "all", end - token) == 0) {
+            match = 1;
+        } else if (dash != NULL) {
+            if (!parse_flowid(token, dash, &low) ||
+                !parse_flowid(dash + 1, end, &high) || low > high) {
+                return -1;
+            }
+            match |= (flowid >= low && flowid <= high);
+        } else {
+            if (!parse_flowid(token, end, &low)) {
+                return -1;
+            }
+            match |= (flowid == low);
+        }
+        token = (*end == ',') ? end + 1 : end;
+    }
+    return match;
+}
+
+/* Live state of a followed log, the flows grow as they show up. */
+struct follow_state {
+    bool                live;           /* wait at the end for more lines */
+    bool                truncated;      /* a pipe ended before its foot note */
+    struct plot_outputs plots;
+    uint32_t            *out_of_flow;   /* flow_list index -> outs index + 1 */
+    uint32_t            flow_cap;
+    const char          *flow_spec;     /* NULL if no cwnd output is wanted */
+    uint64_t            record_cnt;
+    uint64_t            reported_cnt;   /* record_cnt at the last progress */
+    int64_t             first_usec;     /* timestamp of the first record */
+    int64_t             last_usec;      /* timestamp of the last record */
+};
+
+static inline int
+follow_add_flow(struct file_basic_stats *f_basics, struct follow_state *st,
+                const struct record_fields *rf, uint32_t flowid, uint32_t *idx)
+{
+    struct flow_info *flow;
+
+    if (f_basics->flow_table.count == st->flow_cap) {
+        uint32_t cap = st->flow_cap * 2;
+        struct flow_info *flows = (struct flow_info *)
+            realloc(f_basics->flow_list, cap * sizeof(struct flow_info));
+        uint32_t *outs;
+
+        if (flows == NULL) {
+            PERROR_FUNCTION("realloc failed for f_basics->flow_list");
+            return EXIT_FAILURE;
+        }
+        f_basics->flow_list = flows;
+        outs = (uint32_t *)realloc(st->out_of_flow, cap * sizeof(uint32_t));
+        if (outs == NULL) {
+            PERROR_FUNCTION("realloc failed for st->out_of_flow");
+            return EXIT_FAILURE;
+        }
+        st->out_of_flow = outs;
+        st->flow_cap = cap;
+    }
+
+    *idx = f_basics->flow_table.count;
+    if (flow_table_insert(&f_basics->flow_table, flowid, *idx) !=
+        EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    flow = &f_basics->flow_list[*idx];
+    memset(flow, 0, sizeof(*flow));
+    flow->flowid = flowid;
+    fill_flow_info_from_view(flow, rf);
+    flow->ipver = (strcmp(f_basics->first_line_stats->ipmode, "4") == 0) ?
+                  INP_IPV4 : INP_IPV6;
+    st->out_of_flow[*idx] = 0;
+
+    if (st->flow_spec != NULL && flow_spec_match(st->flow_spec, flowid) > 0) {
+        int64_t out = plot_outputs_add(&st->plots, flowid,
+                                       cwnd_plot_header());
+
+        if (out < 0 || cwnd_decimate_add(&st->plots.outs[out]) !=
+            EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        st->out_of_flow[*idx] = (uint32_t)out + 1;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* The window can only be placed once the first record is known */
+static inline bool
+follow_in_window(const struct file_basic_stats *f_basics,
+                 const struct follow_state *st)
+{
+    int64_t lo, hi;
+
+    plot_window(f_basics, st->first_usec, &lo, &hi);
+    return st->last_usec >= lo && st->last_usec <= hi;
+}
+
+static inline int
+follow_record(struct file_basic_stats *f_basics, struct follow_state *st,
+              const char *line, size_t len)
+{
+    struct record_fields rf;
+    uint32_t flowid;
+    uint32_t idx;
+
+    f_basics->num_lines++;
+    profile_count(PROF_RECORDS, 1);
+    if (!split_fields(line, len, &rf)) {
+        profile_count(PROF_MALFORMED, 1);
+        return EXIT_SUCCESS;
+    }
+    st->record_cnt++;
+    field_usec(&rf, TIMESTAMP, &st->last_usec);
+    if (st->record_cnt == 1) {
+        st->first_usec = st->last_usec;
+    }
+
+    if (field_u32(&rf, FLOW_ID, &flowid) != EXIT_SUCCESS) {
+        profile_count(PROF_MALFORMED, 1);
+        return EXIT_SUCCESS;
+    }
+    if (flow_table_find_cached(&f_basics->flow_table, flowid, &idx)) {
+        f_basics->flow_list[idx].record_cnt++;
+    } else {
+        if (follow_add_flow(f_basics, st, &rf, flowid, &idx) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        f_basics->flow_list[idx].record_cnt = 1;
+        if (verbose) {
+            printf("new flow: %u\n", flowid);
+        }
+    }
+    if (show_metrics) {
+        flow_stats_record(&f_basics->flow_list[idx], &rf);
+    }
+    if (bucket_usec > 0) {
+        flow_bucket_record(&f_basics->flow_list[idx], &rf, st->first_usec);
+    }
+    if (show_events) {
+        flow_events_record(&f_basics->flow_list[idx], &rf);
+    }
+    if (show_occupancy) {
+        flow_occupancy_record(&f_basics->flow_list[idx], &rf);
+    }
+
+    if (st->out_of_flow[idx] != 0 &&
+        (!time_window_is_set() || follow_in_window(f_basics, st))) {
+        plot_cwnd_record(&st->plots, &st->plots.outs[st->out_of_flow[idx] - 1],
+                         &rf, st->last_usec - st->first_usec);
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Stand in for the foot note of a log that was not finished: the end time is
+ * the one of the last record, and the flow list holds the flows seen.
+ */
+static inline struct last_line_fields *
+follow_fake_last_line(const struct file_basic_stats *f_basics,
+                      const struct follow_state *st)
+{
+    struct last_line_fields *l_line_stats =
+        (struct last_line_fields *)calloc(1, sizeof(*l_line_stats));
+    size_t len = 0;
+
+    if (l_line_stats == NULL) {
+        PERROR_FUNCTION("calloc failed for l_line_stats");
+        return NULL;
+    }
+    l_line_stats->disable_time.tv_sec = st->last_usec / 1000000;
+    l_line_stats->disable_time.tv_usec = st->last_usec % 1000000;
+    if (st->record_cnt == 0) {
+        l_line_stats->disable_time = f_basics->first_line_stats->enable_time;
+    }
+
+    /* up to 10 digits and a comma per flow */
+    l_line_stats->flowid_list = (char *)malloc(
+        (size_t)f_basics->flow_table.count * 11 + 1);
+    if (l_line_stats->flowid_list == NULL) {
+        PERROR_FUNCTION("malloc failed for flowid_list");
+        free(l_line_stats);
+        return NULL;
+    }
+    l_line_stats->flowid_list[0] = '\0';
+    for (uint32_t i = 0; i < f_basics->flow_table.count; i++) {
+        len += sprintf(l_line_stats->flowid_list + len, "%s%u",
+                       (i > 0) ? COMMA_DELIMITER : "",
+                       f_basics->flow_list[i].flowid);
+    }
+    return l_line_stats;
+}
+
+/* Tell how far the log has got, if anything came in since the last time. */
+static inline void
+follow_progress(const struct file_basic_stats *f_basics,
+                struct follow_state *st)
+{
+    if (st->record_cnt == st->reported_cnt) {
+        return;
+    }
+    st->reported_cnt = st->record_cnt;
+    printf("following: %" PRIu64 " records, %u flows\n",
+           st->record_cnt, f_basics->flow_table.count);
+    fflush(stdout);
+}
+
+/*
+ * Read lines as they are completed, until the foot note or a signal. Unless
+ * the log is live, the end of the input ends it too.
+ */
+static inline int
+follow_lines(struct file_basic_stats *f_basics, struct follow_state *st,
+             const char *file_name)
+{
+    struct log_reader *reader = &f_basics->reader;
+    const struct timespec poll = {
+        .tv_sec = FOLLOW_POLL_MSECS / 1000,
+        .tv_nsec = (FOLLOW_POLL_MSECS % 1000) * 1000000L,
+    };
+    size_t off, len, raw_len;
+
+    while (!follow_stop) {
+        char *line;
+        char *note;
+
+        if (!reader_next_buffered_line(reader, &off, &len, &raw_len)) {
+            if (!st->live) {
+                break;
+            }
+            /* nothing new, wait for siftr to write more */
+            if (plot_outputs_flush(&st->plots) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+            follow_progress(f_basics, st);
+            nanosleep(&poll, NULL);
+            continue;
+        }
+        line = reader->buf + off;
+
+        if (f_basics->first_line_stats != NULL &&
+            (len < strlen(FOOT_NOTE_PREFIX) ||
+             memcmp(line, FOOT_NOTE_PREFIX, strlen(FOOT_NOTE_PREFIX)) != 0)) {
+            if (follow_record(f_basics, st, line, len) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
+
+        /* the head or the foot note, parsed from a modifiable copy */
+        note = strndup(line, len);
+        if (note == NULL) {
+            PERROR_FUNCTION("strndup failed for the note");
+            return EXIT_FAILURE;
+        }
+        f_basics->num_lines++;
+        if (f_basics->first_line_stats == NULL) {
+            f_basics->first_line_stats = parse_first_line(note);
+            free(note);
+            if (f_basics->first_line_stats == NULL) {
+                PERROR_FUNCTION("head note not exist");
+                return EXIT_FAILURE;
+            }
+        } else {
+            f_basics->last_line_stats = parse_last_line(note);
+            free(note);
+            break;
+        }
+    }
+
+    if (f_basics->first_line_stats == NULL) {
+        printf("no head note was written to %s\n", file_name);
+        return EXIT_FAILURE;
+    }
+    if (st->live) {
+        follow_progress(f_basics, st);
+    }
+    if (f_basics->last_line_stats == NULL) {
+        printf("%s before the foot note\n",
+               st->live ? "stopped" : "the input ended");
+        f_basics->last_line_stats = follow_fake_last_line(f_basics, st);
+        if (f_basics->last_line_stats == NULL) {
+            return EXIT_FAILURE;
+        }
+        st->truncated = !st->live;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * The foot note of a piped log is only seen at the end, so its flow list can
+ * not size the flow table. Tell the flows it lists that had no records, and
+ * the flows with records it does not list.
+ */
+static inline void
+follow_check_flow_list(const struct file_basic_stats *f_basics)
+{
+    uint32_t nflows = f_basics->flow_table.count;
+    bool *listed = (bool *)calloc(nflows + 1, sizeof(bool));
+    char *list = strdup(f_basics->last_line_stats->flowid_list);
+    char *save;
+    char *token;
+    uint32_t mismatch = 0;
+
+    if (listed == NULL || list == NULL) {
+        PERROR_FUNCTION("failed to copy the foot note flow list");
+        free(listed);
+        free(list);
+        return;
+    }
+    for (token = strtok_r(list, COMMA_DELIMITER, &save); token != NULL;
+         token = strtok_r(NULL, COMMA_DELIMITER, &save)) {
+        uint32_t flowid, idx;
+
+        if (!parse_flowid(token, token + strlen(token), &flowid)) {
+            printf("foot note has an invalid flow id: %s\n", token);
+            mismatch++;
+        } else if (flow_table_find(&f_basics->flow_table, flowid, &idx)) {
+            listed[idx] = true;
+        } else {
+            printf("foot note lists flow %u, which has no records\n", flowid);
+            mismatch++;
+        }
+    }
+    for (uint32_t i = 0; i < nflows; i++) {
+        if (!listed[i]) {
+            printf("flow %u has records, but is not in the foot note\n",
+                   f_basics->flow_list[i].flowid);
+            mismatch++;
+        }
+    }
+    if (verbose && mismatch == 0) {
+        printf("foot note lists the %u flows seen\n", nflows);
+    }
+    free(listed);
+    free(list);
+}
+
+/* True if file_name can only be read once from its start, such as a pipe */
+static inline bool
+is_stream_input(const char *file_name)
+{
+    struct stat st;
+
+    if (strcmp(file_name, "-") == 0) {
+        return true;
+    }
+    return stat(file_name, &st) == 0 && !S_ISREG(st.st_mode) &&
+           !S_ISDIR(st.st_mode);
+}
+
+/*
+ * Read a log in a single forward pass. Records are counted and written to
+ * the cwnd plot files of the flows picked by flow_spec as they come in, so
+ * nothing is seeked to or read twice. A live log is followed like "tail -f"
+ * until its foot note, or SIGINT/SIGTERM, ends it; otherwise the end of the
+ * input does, which lets a log be read from stdin ("-") or a pipe.
+ */
+int
+follow_file(struct file_basic_stats *f_basics, const char *file_name,
+            const char *flow_spec, bool live)
+{
+    struct follow_state st = {0};
+    struct sigaction sa = {0}, old_int, old_term;
+    int ret, prev;
+
+    if (flow_spec != NULL && flow_spec_match(flow_spec, 0) < 0) {
+        printf("invalid flow ids: %s\n", flow_spec);
+        return EXIT_FAILURE;
+    }
+    st.flow_spec = flow_spec;
+    st.live = live;
+
+    f_basics->file = (strcmp(file_name, "-") == 0) ? stdin :
+                     fopen(file_name, "r");
+    if (f_basics->file == NULL) {
+        PERROR_FUNCTION("Failed to open file");
+        return EXIT_FAILURE;
+    }
+    st.flow_cap = FOLLOW_MIN_FLOWS;
+    f_basics->flow_list = (struct flow_info *)
+        calloc(st.flow_cap, sizeof(struct flow_info));
+    st.out_of_flow = (uint32_t *)calloc(st.flow_cap, sizeof(uint32_t));
+    if (f_basics->flow_list == NULL || st.out_of_flow == NULL) {
+        PERROR_FUNCTION("calloc failed for the flow list");
+        free(st.out_of_flow);
+        return EXIT_FAILURE;
+    }
+    if (reader_open_follow(&f_basics->reader, f_basics->file) != EXIT_SUCCESS ||
+        flow_table_init(&f_basics->flow_table, FOLLOW_MIN_FLOWS) !=
+        EXIT_SUCCESS ||
+        plot_outputs_init(&st.plots, NULL, 0, cwnd_plot_header()) !=
+        EXIT_SUCCESS) {
+        free(st.out_of_flow);
+        return EXIT_FAILURE;
+    }
+    /* a pipe ends for good, and its last line may have no terminator */
+    f_basics->reader.follow = live;
+    st.plots.is_live = live;
+
+    follow_stop = 0;
+    sa.sa_handler = follow_on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+
+    if (live) {
+        printf("following %s, stop with Ctrl-C\n", file_name);
+        if (max_points > 0 && flow_spec != NULL) {
+            printf("the --max-points cwnd plot files are written once "
+                   "following stops\n");
+        }
+    }
+    prev = profile_enter(PROF_BODY);
+    ret = follow_lines(f_basics, &st, file_name);
+    profile_leave(prev);
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+    if (ret == EXIT_SUCCESS) {
+        if (verbose) {
+            printf("input file has total lines: %u\n", f_basics->num_lines);
+        }
+        if (!live && st.record_cnt > 0 &&
+            f_basics->last_line_stats->flowid_list[0] != '\0') {
+            follow_check_flow_list(f_basics);
+        }
+        f_basics->flow_count = f_basics->flow_table.count;
+        show_file_basic_stats(f_basics);
+        if (bucket_usec > 0) {
+            write_flow_buckets(f_basics);
+        }
+        if (show_events) {
+            f_basics->first_usec = st.first_usec;
+            write_flow_events(f_basics);
+        }
+        if (show_occupancy) {
+            show_flow_occupancy(f_basics);
+        }
+        for (uint32_t i = 0; i < f_basics->flow_count; i++) {
+            if (st.out_of_flow[i] != 0) {
+                show_flow_heading(&f_basics->flow_list[i]);
+            }
+        }
+    }
+
+    cwnd_decimate_flush(&st.plots);
+    if (plot_outputs_close(&st.plots) != EXIT_SUCCESS) {
+        ret = EXIT_FAILURE;
+    }
+    free(st.out_of_flow);
+    /* what was read is shown, but a cut off capture is not a success */
+    return st.truncated ? EXIT_FAILURE : ret;
+}
+
+#endif /* SIFTR_FOLLOW_H_ */
@@ -0,0 +1,649 @@
+/*
+ ============================================================================
+ Name        : siftr_index.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Persistent binary sidecar index (<log>.sidx) of a siftr log
+ ============================================================================
+ */
+
+#ifndef SIFTR_INDEX_H_
+#define SIFTR_INDEX_H_
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SIDX_MAGIC          "SIFTRIDX"
+#define SIDX_SUFFIX         ".sidx"
+
+enum {
+    SIDX_VERSION = 2,
+    SIDX_HASH_SPAN = (64 << 10),    /* bytes hashed at the head and the tail */
+    SIDX_HASH_SAMPLES = 32,         /* blocks hashed in between */
+    SIDX_HASH_BLOCK = (4 << 10),
+};
+
+/*
+ * Bytes per record of each column, 0 if the field is not kept per record.
+ * The addresses and ports are in the flow table. TIMESTAMP is kept as
+ * microseconds, FLOW_ID as the index of the flow in flow_list, DIRECTION as
+ * its character.
+ */
+static const uint8_t sidx_field_width[TOTAL_FIELDS] = {
+    [DIRECTION] = 1,    [TIMESTAMP] = 8,    [LOIP] = 0,         [LPORT] = 0,
+    [FOIP] = 0,         [FPORT] = 0,        [SSTHRESH] = 4,     [CWND] = 4,
+    [FLAG2] = 4,        [SNDWIN] = 4,       [RCVWIN] = 4,       [SNDSCALE] = 1,
+    [RCVSCALE] = 1,     [STATE] = 1,        [MSS] = 4,          [SRTT] = 4,
+    [ISSACK] = 1,       [FLAG] = 4,         [RTO] = 4,
+    [SND_BUF_HIWAT] = 4,    [SND_BUF_CC] = 4,   [RCV_BUF_HIWAT] = 4,
+    [RCV_BUF_CC] = 4,   [INFLIGHT_BYTES] = 4,   [REASS_QLEN] = 4,
+    [FLOW_ID] = 4,      [FLOW_TYPE] = 1,
+};
+
+/* On-disk layout: this header, flow_list, the foot note flowid_list, columns */
+struct sidx_header {
+    char                    magic[8];
+    uint32_t                version;
+    uint32_t                flow_info_size;     /* sizeof(struct flow_info) */
+    uint64_t                src_size;
+    int64_t                 src_mtime_nsec;
+    uint64_t                src_hash;
+    uint64_t                record_cnt;
+    uint32_t                num_lines;
+    uint32_t                flow_count;
+    uint32_t                flows_seen;
+    uint32_t                flowid_list_len;
+    struct first_line_fields first_line;
+    struct last_line_fields  last_line;         /* flowid_list is not valid */
+    uint64_t                flows_off;
+    uint64_t                flowid_list_off;
+    uint64_t                col_off[TOTAL_FIELDS];
+};
+
+struct sidecar_index {
+    const struct sidx_header *hdr;
+    size_t                  size;
+};
+
+static inline uint64_t
+fnv1a64(uint64_t hash, const unsigned char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+ * Hash the head and the tail of the log plus evenly spaced blocks of it. This
+ * catches rewritten logs without reading all of a multi-GB file.
+ */
+static inline uint64_t
+sidx_source_hash(int fd, uint64_t size)
+{
+    unsigned char buf[SIDX_HASH_SPAN];
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    ssize_t n;
+
+    n = pread(fd, buf, sizeof(buf), 0);
+    hash = fnv1a64(hash, buf, n > 0 ? (size_t)n : 0);
+    if (size > SIDX_HASH_SPAN) {
+        n = pread(fd, buf, sizeof(buf), (off_t)(size - SIDX_HASH_SPAN));
+        hash = fnv1a64(hash, buf, n > 0 ? (size_t)n : 0);
+    }
+    for (uint32_t i = 1; i <= SIDX_HASH_SAMPLES; i++) {
+        off_t off = (off_t)(size / (SIDX_HASH_SAMPLES + 1) * i);
+
+        n = pread(fd, buf, SIDX_HASH_BLOCK, off);
+        hash = fnv1a64(hash, buf, n > 0 ? (size_t)n : 0);
+    }
+    return hash;
+}
+
+static inline uint64_t
+sidx_align(uint64_t off)
+{
+    return (off + 7) & ~(uint64_t)7;
+}
+
+static inline int64_t
+sidx_mtime_nsec(const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static inline void
+sidx_name(char *name, size_t size, const char *log_name)
+{
+    snprintf(name, size, "%s" SIDX_SUFFIX, log_name);
+}
+
+/* Pointer to the column of field idx */
+static inline const void *
+sidx_column(const struct sidecar_index *sidx, int idx)
+{
+    return (const char *)sidx->hdr + sidx->hdr->col_off[idx];
+}
+
+/* Value of a narrow or 32-bit column at record r */
+static inline uint32_t
+sidx_value(const struct sidecar_index *sidx, int idx, uint64_t r)
+{
+    if (sidx_field_width[idx] == 1) {
+        return ((const uint8_t *)sidx_column(sidx, idx))[r];
+    }
+    return ((const uint32_t *)sidx_column(sidx, idx))[r];
+}
+
+/*
+ * Write <log>.sidx for the log that f_basics was just built from. One more
+ * pass over the body fills the columns straight into the mapped sidecar.
+ */
+int
+sidx_build(struct file_basic_stats *f_basics, const char *log_name)
+{
+    char name[PATH_MAX], tmp_name[PATH_MAX + 4];
+    uint64_t capacity = (f_basics->num_lines > 2) ? f_basics->num_lines - 2 : 0;
+    const char *flowid_list = f_basics->last_line_stats->flowid_list;
+    struct sidx_header *hdr;
+    struct record_batch *batch;
+    struct stat st;
+    uint64_t off, record_cnt = 0;
+    void *map;
+    int fd, err;
+
+    if (fstat(fileno(f_basics->file), &st) != 0) {
+        PERROR_FUNCTION("fstat");
+        return EXIT_FAILURE;
+    }
+    sidx_name(name, sizeof(name), log_name);
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", name);
+
+    /* lay out the file */
+    off = sidx_align(sizeof(struct sidx_header));
+    uint64_t flows_off = off;
+    off = sidx_align(off + (uint64_t)f_basics->flow_count * sizeof(struct flow_info));
+    uint64_t flowid_list_off = off;
+    off = sidx_align(off + strlen(flowid_list) + 1);
+    uint64_t col_off[TOTAL_FIELDS] = {0};
+    for (int i = 0; i < TOTAL_FIELDS; i++) {
+        if (sidx_field_width[i] != 0) {
+            col_off[i] = off;
+            off = sidx_align(off + capacity * sidx_field_width[i]);
+        }
+    }
+
+    fd = open(tmp_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        PERROR_FUNCTION("Failed to create the sidecar index");
+        return EXIT_FAILURE;
+    }
+    /* a sparse file would raise SIGBUS on a full disk instead */
+    err = posix_fallocate(fd, 0, (off_t)off);
+    if (err != 0) {
+        errno = err;
+        PERROR_FUNCTION("posix_fallocate");
+        close(fd);
+        unlink(tmp_name);
+        return EXIT_FAILURE;
+    }
+    map = mmap(NULL, off, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        PERROR_FUNCTION("mmap");
+        close(fd);
+        unlink(tmp_name);
+        return EXIT_FAILURE;
+    }
+
+    hdr = (struct sidx_header *)map;
+    memcpy(hdr->magic, SIDX_MAGIC, sizeof(hdr->magic));
+    hdr->version = SIDX_VERSION;
+    hdr->flow_info_size = sizeof(struct flow_info);
+    hdr->src_size = (uint64_t)st.st_size;
+    hdr->src_mtime_nsec = sidx_mtime_nsec(&st);
+    hdr->src_hash = sidx_source_hash(fileno(f_basics->file), hdr->src_size);
+    hdr->num_lines = f_basics->num_lines;
+    hdr->flow_count = f_basics->flow_count;
+    hdr->flows_seen = f_basics->flow_table.count;
+    hdr->flowid_list_len = (uint32_t)strlen(flowid_list);
+    hdr->first_line = *f_basics->first_line_stats;
+    hdr->last_line = *f_basics->last_line_stats;
+    hdr->last_line.flowid_list = NULL;
+    hdr->flows_off = flows_off;
+    hdr->flowid_list_off = flowid_list_off;
+    memcpy(hdr->col_off, col_off, sizeof(col_off));
+    memcpy((char *)map + flows_off, f_basics->flow_list,
+           f_basics->flow_count * sizeof(struct flow_info));
+    memcpy((char *)map + flowid_list_off, flowid_list, hdr->flowid_list_len + 1);
+
+    batch = (struct record_batch *)malloc(sizeof(*batch));
+    if (batch == NULL || reader_rewind_body(&f_basics->reader) != EXIT_SUCCESS) {
+        PERROR_FUNCTION("Failed to read the log body");
+        free(batch);
+        munmap(map, off);
+        close(fd);
+        unlink(tmp_name);
+        return EXIT_FAILURE;
+    }
+
+    batch->block.len = 0;
+    while (next_record_batch(&f_basics->reader, batch)) {
+        for (size_t r = 0; r < batch->count && record_cnt < capacity; r++) {
+            struct record_fields *rf = &batch->records[r];
+            char *base = (char *)map;
+            uint32_t flowid = 0;
+            int64_t usec = 0;
+            uint32_t idx;
+
+            if (rf->field_cnt != TOTAL_FIELDS) {
+                continue;
+            }
+            if (field_u32(rf, FLOW_ID, &flowid) != EXIT_SUCCESS ||
+                !flow_table_find_cached(&f_basics->flow_table, flowid, &idx)) {
+                idx = UINT32_MAX;
+            }
+            field_usec(rf, TIMESTAMP, &usec);
+            ((int64_t *)(base + col_off[TIMESTAMP]))[record_cnt] = usec;
+            ((uint32_t *)(base + col_off[FLOW_ID]))[record_cnt] = idx;
+            ((uint8_t *)(base + col_off[DIRECTION]))[record_cnt] =
+                (uint8_t)*FIELD_PTR(rf, DIRECTION);
+
+            for (int i = SSTHRESH; i <= FLOW_TYPE; i++) {
+                uint32_t value = 0;
+
+                if (i == FLOW_ID || sidx_field_width[i] == 0) {
+                    continue;
+                }
+                field_u32(rf, i, &value);
+                if (sidx_field_width[i] == 4) {
+                    ((uint32_t *)(base + col_off[i]))[record_cnt] = value;
+                } else {
+                    ((uint8_t *)(base + col_off[i]))[record_cnt] =
+                        (value > UINT8_MAX) ? UINT8_MAX : (uint8_t)value;
+                }
+            }
+            record_cnt++;
+        }
+    }
+    free(batch);
+    hdr->record_cnt = record_cnt;
+
+    /* the columns must be on disk before the header can be found */
+    if (msync(map, off, MS_SYNC) != 0 || fsync(fd) != 0) {
+        PERROR_FUNCTION("Failed to sync the sidecar index");
+        munmap(map, off);
+        close(fd);
+        unlink(tmp_name);
+        return EXIT_FAILURE;
+    }
+    munmap(map, off);
+    close(fd);
+    if (rename(tmp_name, name) != 0) {
+        PERROR_FUNCTION("Failed to rename the sidecar index");
+        unlink(tmp_name);
+        return EXIT_FAILURE;
+    }
+    if (verbose) {
+        printf("sidecar index written: %s\n", name);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* The -m stats of every flow, from the columns instead of the log */
+static void
+sidx_flow_stats(struct file_basic_stats *f_basics)
+{
+    const struct sidecar_index *sidx = f_basics->sidx;
+    const int64_t *ts = (const int64_t *)sidx_column(sidx, TIMESTAMP);
+    const uint32_t *flow_idx = (const uint32_t *)sidx_column(sidx, FLOW_ID);
+    const uint32_t *columns[METRIC_COUNT];
+
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        columns[m] = (const uint32_t *)sidx_column(sidx, metric_fields[m]);
+    }
+    for (uint64_t r = 0; r < sidx->hdr->record_cnt; r++) {
+        struct flow_info *flow;
+        uint64_t values[METRIC_COUNT];
+
+        if (flow_idx[r] >= f_basics->flow_count) {
+            continue;
+        }
+        flow = &f_basics->flow_list[flow_idx[r]];
+        if (flow->stats == NULL) {
+            flow->stats = (struct flow_stats *)
+                calloc(1, sizeof(struct flow_stats));
+            if (flow->stats == NULL) {
+                PERROR_FUNCTION("calloc failed for flow->stats");
+                return;
+            }
+        }
+        for (int m = 0; m < METRIC_COUNT; m++) {
+            values[m] = columns[m][r];
+        }
+        flow_stats_add(flow->stats, ts[r], values);
+    }
+}
+
+/* The --bucket intervals of every flow, from the columns */
+static void
+sidx_flow_buckets(struct file_basic_stats *f_basics)
+{
+    const struct sidecar_index *sidx = f_basics->sidx;
+    const int64_t *ts = (const int64_t *)sidx_column(sidx, TIMESTAMP);
+    const uint32_t *flow_idx = (const uint32_t *)sidx_column(sidx, FLOW_ID);
+    const uint8_t *direction = (const uint8_t *)sidx_column(sidx, DIRECTION);
+    const uint32_t *cwnd = (const uint32_t *)sidx_column(sidx, CWND);
+    const uint32_t *inflight =
+        (const uint32_t *)sidx_column(sidx, INFLIGHT_BYTES);
+    uint64_t record_cnt = sidx->hdr->record_cnt;
+
+    f_basics->first_usec = (record_cnt > 0) ? ts[0] : -1;
+    for (uint64_t r = 0; r < record_cnt; r++) {
+        struct flow_info *flow;
+
+        if (flow_idx[r] >= f_basics->flow_count) {
+            continue;
+        }
+        flow = &f_basics->flow_list[flow_idx[r]];
+        if (flow->buckets == NULL) {
+            flow->buckets = (struct bucket_series *)
+                calloc(1, sizeof(struct bucket_series));
+            if (flow->buckets == NULL) {
+                PERROR_FUNCTION("calloc failed for flow->buckets");
+                return;
+            }
+        }
+        bucket_series_add(flow->buckets,
+                          bucket_index(ts[r], f_basics->first_usec),
+                          (char)direction[r], cwnd[r], inflight[r]);
+    }
+}
+
+/* The --events of every flow, from the flag, cwnd and ssthresh columns */
+static void
+sidx_flow_events(struct file_basic_stats *f_basics)
+{
+    const struct sidecar_index *sidx = f_basics->sidx;
+    const int64_t *ts = (const int64_t *)sidx_column(sidx, TIMESTAMP);
+    const uint32_t *flow_idx = (const uint32_t *)sidx_column(sidx, FLOW_ID);
+    const uint32_t *t_flags = (const uint32_t *)sidx_column(sidx, FLAG);
+    const uint32_t *t_flags2 = (const uint32_t *)sidx_column(sidx, FLAG2);
+    const uint32_t *cwnd = (const uint32_t *)sidx_column(sidx, CWND);
+    const uint32_t *ssthresh = (const uint32_t *)sidx_column(sidx, SSTHRESH);
+    const uint32_t *mss = (const uint32_t *)sidx_column(sidx, MSS);
+    uint64_t record_cnt = sidx->hdr->record_cnt;
+
+    f_basics->first_usec = (record_cnt > 0) ? ts[0] : -1;
+    for (uint64_t r = 0; r < record_cnt; r++) {
+        struct flow_info *flow;
+
+        if (flow_idx[r] >= f_basics->flow_count) {
+            continue;
+        }
+        flow = &f_basics->flow_list[flow_idx[r]];
+        if (flow->events == NULL) {
+            flow->events = (struct flow_events *)
+                calloc(1, sizeof(struct flow_events));
+            if (flow->events == NULL) {
+                PERROR_FUNCTION("calloc failed for flow->events");
+                return;
+            }
+        }
+        flow_events_add(flow->events, ts[r], t_flags[r], t_flags2[r],
+                        cwnd[r], ssthresh[r], mss[r]);
+    }
+}
+
+/* The --occupancy of every flow, from the flag columns */
+static void
+sidx_flow_occupancy(struct file_basic_stats *f_basics)
+{
+    const struct sidecar_index *sidx = f_basics->sidx;
+    const int64_t *ts = (const int64_t *)sidx_column(sidx, TIMESTAMP);
+    const uint32_t *flow_idx = (const uint32_t *)sidx_column(sidx, FLOW_ID);
+    const uint32_t *t_flags = (const uint32_t *)sidx_column(sidx, FLAG);
+    const uint32_t *t_flags2 = (const uint32_t *)sidx_column(sidx, FLAG2);
+    uint64_t record_cnt = sidx->hdr->record_cnt;
+
+    for (uint64_t r = 0; r < record_cnt; r++) {
+        struct flow_info *flow;
+
+        if (flow_idx[r] >= f_basics->flow_count) {
+            continue;
+        }
+        flow = &f_basics->flow_list[flow_idx[r]];
+        if (flow->occupancy == NULL) {
+            flow->occupancy = (struct flow_occupancy *)
+                calloc(1, sizeof(struct flow_occupancy));
+            if (flow->occupancy == NULL) {
+                PERROR_FUNCTION("calloc failed for flow->occupancy");
+                return;
+            }
+        }
+        flow_occupancy_add(flow->occupancy, ts[r], t_flags[r], t_flags2[r]);
+    }
+}
+
+/* Whether cnt items of width bytes at off end within size bytes */
+static inline bool
+sidx_region_fits(uint64_t size, uint64_t off, uint64_t cnt, uint64_t width)
+{
+    return off <= size && (width == 0 || cnt <= (size - off) / width);
+}
+
+/*
+ * Whether the flow list, the flowid list and every column of a sidecar of
+ * size bytes are inside it, so a truncated sidecar is rebuilt, not read.
+ */
+static inline bool
+sidx_layout_fits(const struct sidx_header *hdr, uint64_t size)
+{
+    if (hdr->flows_seen > hdr->flow_count ||
+        !sidx_region_fits(size, hdr->flows_off, hdr->flow_count,
+                          sizeof(struct flow_info)) ||
+        !sidx_region_fits(size, hdr->flowid_list_off,
+                          (uint64_t)hdr->flowid_list_len + 1, 1) ||
+        memchr((const char *)hdr + hdr->flowid_list_off, '\0',
+               (size_t)hdr->flowid_list_len + 1) == NULL) {
+        return false;
+    }
+    for (int i = 0; i < TOTAL_FIELDS; i++) {
+        if (sidx_field_width[i] > 0 &&
+            (hdr->col_off[i] % sidx_field_width[i] != 0 ||
+             !sidx_region_fits(size, hdr->col_off[i], hdr->record_cnt,
+                               sidx_field_width[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Fill f_basics from <log>.sidx instead of the log text, if the sidecar is
+ * there and still matches the log in size, mtime and content hash.
+ */
+int
+sidx_load(struct file_basic_stats *f_basics, const char *log_name)
+{
+    char name[PATH_MAX];
+    struct sidecar_index *sidx;
+    const struct sidx_header *hdr;
+    struct stat st, sidx_st;
+    void *map;
+    int fd;
+
+    sidx_name(name, sizeof(name), log_name);
+    if (fstat(fileno(f_basics->file), &st) != 0) {
+        return EXIT_FAILURE;
+    }
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+    if (fstat(fd, &sidx_st) != 0 ||
+        (size_t)sidx_st.st_size < sizeof(struct sidx_header)) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    map = mmap(NULL, (size_t)sidx_st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        PERROR_FUNCTION("mmap");
+        return EXIT_FAILURE;
+    }
+
+    hdr = (const struct sidx_header *)map;
+    if (memcmp(hdr->magic, SIDX_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != SIDX_VERSION ||
+        hdr->flow_info_size != sizeof(struct flow_info) ||
+        hdr->src_size != (uint64_t)st.st_size ||
+        hdr->src_mtime_nsec != sidx_mtime_nsec(&st) ||
+        hdr->src_hash != sidx_source_hash(fileno(f_basics->file),
+                                          hdr->src_size) ||
+        !sidx_layout_fits(hdr, (uint64_t)sidx_st.st_size)) {
+        if (verbose) {
+            printf("sidecar index %s is stale, rebuilding it\n", name);
+        }
+        munmap(map, (size_t)sidx_st.st_size);
+        return EXIT_FAILURE;
+    }
+
+    sidx = (struct sidecar_index *)malloc(sizeof(*sidx));
+    f_basics->first_line_stats = (struct first_line_fields *)
+        malloc(sizeof(struct first_line_fields));
+    f_basics->last_line_stats = (struct last_line_fields *)
+        malloc(sizeof(struct last_line_fields));
+    f_basics->flow_list = (struct flow_info *)
+        calloc(hdr->flow_count, sizeof(struct flow_info));
+    if (sidx == NULL || f_basics->first_line_stats == NULL ||
+        f_basics->last_line_stats == NULL || f_basics->flow_list == NULL ||
+        flow_table_init(&f_basics->flow_table, hdr->flow_count) != EXIT_SUCCESS) {
+        PERROR_FUNCTION("malloc failed for the sidecar index");
+        munmap(map, (size_t)sidx_st.st_size);
+        free(sidx);
+        free(f_basics->first_line_stats);
+        free(f_basics->last_line_stats);
+        free(f_basics->flow_list);
+        f_basics->first_line_stats = NULL;
+        f_basics->last_line_stats = NULL;
+        f_basics->flow_list = NULL;
+        return EXIT_FAILURE;
+    }
+
+    *f_basics->first_line_stats = hdr->first_line;
+    *f_basics->last_line_stats = hdr->last_line;
+    f_basics->last_line_stats->flowid_list =
+        strdup((const char *)map + hdr->flowid_list_off);
+    f_basics->num_lines = hdr->num_lines;
+    f_basics->flow_count = hdr->flow_count;
+    memcpy(f_basics->flow_list, (const char *)map + hdr->flows_off,
+           hdr->flow_count * sizeof(struct flow_info));
+    for (uint32_t i = 0; i < hdr->flow_count; i++) {
+        /* pointers of the process that built the index */
+        f_basics->flow_list[i].stats = NULL;
+        f_basics->flow_list[i].cols = NULL;
+        f_basics->flow_list[i].buckets = NULL;
+        f_basics->flow_list[i].events = NULL;
+        f_basics->flow_list[i].occupancy = NULL;
+    }
+    for (uint32_t i = 0; i < hdr->flows_seen; i++) {
+        flow_table_insert(&f_basics->flow_table, f_basics->flow_list[i].flowid, i);
+    }
+
+    sidx->hdr = hdr;
+    sidx->size = (size_t)sidx_st.st_size;
+    f_basics->sidx = sidx;
+    profile_count(PROF_BYTES_READ, sidx->size);
+    if (show_metrics) {
+        sidx_flow_stats(f_basics);
+    }
+    if (bucket_usec > 0) {
+        sidx_flow_buckets(f_basics);
+    }
+    if (show_events) {
+        sidx_flow_events(f_basics);
+    }
+    if (show_occupancy) {
+        sidx_flow_occupancy(f_basics);
+    }
+    if (verbose) {
+        printf("loaded sidecar index %s, %" PRIu64 " records\n", name,
+               hdr->record_cnt);
+    }
+    return EXIT_SUCCESS;
+}
+
+void
+sidx_close(struct file_basic_stats *f_basics)
+{
+    if (f_basics->sidx != NULL) {
+        munmap((void *)f_basics->sidx->hdr, f_basics->sidx->size);
+        free(f_basics->sidx);
+        f_basics->sidx = NULL;
+    }
+}
+
+/* stats_into_plot_files() served from the columns of the sidecar index */
+void
+sidx_into_plot_files(struct file_basic_stats *f_basics,
+                     const uint32_t *flowids, uint32_t count)
+{
+    const struct sidecar_index *sidx = f_basics->sidx;
+    const int64_t *ts = (const int64_t *)sidx_column(sidx, TIMESTAMP);
+    const uint32_t *flow_idx = (const uint32_t *)sidx_column(sidx, FLOW_ID);
+    const uint8_t *direction = (const uint8_t *)sidx_column(sidx, DIRECTION);
+    const uint32_t *cwnd = (const uint32_t *)sidx_column(sidx, CWND);
+    const uint32_t *ssthresh = (const uint32_t *)sidx_column(sidx, SSTHRESH);
+    const uint32_t *t_flags = (const uint32_t *)sidx_column(sidx, FLAG);
+    const uint32_t *t_flags2 = (const uint32_t *)sidx_column(sidx, FLAG2);
+    uint64_t record_cnt = sidx->hdr->record_cnt;
+    struct plot_outputs plots;
+    uint32_t *out_of_flow;
+    int64_t first_ts;
+    int64_t lo, hi;
+
+    out_of_flow = (uint32_t *)calloc(f_basics->flow_count, sizeof(uint32_t));
+    if (out_of_flow == NULL) {
+        PERROR_FUNCTION("calloc failed for out_of_flow");
+        return;
+    }
+    if (plot_outputs_init(&plots, flowids, count,
+                          cwnd_plot_header()) != EXIT_SUCCESS) {
+        plot_outputs_close(&plots);
+        free(out_of_flow);
+        return;
+    }
+    cwnd_decimate_init(f_basics, &plots);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t idx;
+
+        if (flow_table_find(&f_basics->flow_table, flowids[i], &idx)) {
+            out_of_flow[idx] = i + 1;
+        }
+    }
+
+    first_ts = (record_cnt > 0) ? ts[0] : 0;
+    plot_window(f_basics, first_ts, &lo, &hi);
+    for (uint64_t r = usec_lower_bound(ts, record_cnt, lo);
+         r < record_cnt && ts[r] <= hi; r++) {
+        const char dir = (char)direction[r];
+
+        if (flow_idx[r] >= f_basics->flow_count ||
+            out_of_flow[flow_idx[r]] == 0) {
+            continue;
+        }
+        plot_cwnd_values(&plots, &plots.outs[out_of_flow[flow_idx[r]] - 1],
+                         &dir, 1, ts[r] - first_ts, cwnd[r], ssthresh[r],
+                         t_flags[r], t_flags2[r]);
+    }
+
+    cwnd_decimate_flush(&plots);
+    plot_outputs_close(&plots);
+    free(out_of_flow);
+}
+
+#endif /* SIFTR_INDEX_H_ */
@@ -0,0 +1,167 @@
+/*
+ ============================================================================
+ Name        : siftr_occupancy.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Share of the records and of the time each t_flags and
+               t_flags2 bit was set in a flow, for --occupancy
+ ============================================================================
+ */
+
+#ifndef SIFTR_OCCUPANCY_H_
+#define SIFTR_OCCUPANCY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum {
+    OCCUPANCY_BITS = 64,        /* t_flags, then t_flags2 above it */
+};
+
+extern bool show_occupancy;
+
+/*
+ * The flag bits of one flow. The records come in runs of the same flag
+ * state, and a run is added to its bits only once it ends, so a record that
+ * does not change the state costs one compare, and a change costs one add
+ * per set bit instead of a test of every bit. A record holds its state until
+ * the next record of the flow, the last one adds no time.
+ */
+struct flow_occupancy {
+    uint64_t    records;
+    int64_t     first_usec;
+    int64_t     last_usec;
+    uint64_t    run_state;      /* TFLAGS_STATE() of the current run */
+    int64_t     run_usec;       /* when the current run started */
+    uint64_t    run_records;
+    uint64_t    bit_records[OCCUPANCY_BITS];
+    int64_t     bit_usecs[OCCUPANCY_BITS];
+};
+
+/* Add the current run, which lasted until end_usec, to its set bits */
+static inline void
+occupancy_add_run(struct flow_occupancy *occ, int64_t end_usec)
+{
+    uint64_t state = occ->run_state;
+    int64_t usecs = end_usec - occ->run_usec;
+
+    while (state != 0) {
+        int bit = __builtin_ctzll(state);
+
+        state &= state - 1;
+        occ->bit_records[bit] += occ->run_records;
+        occ->bit_usecs[bit] += usecs;
+    }
+}
+
+static inline void
+flow_occupancy_add(struct flow_occupancy *occ, int64_t usec, uint32_t t_flags,
+                   uint32_t t_flags2)
+{
+    uint64_t state = TFLAGS_STATE(t_flags, t_flags2);
+
+    if (occ->records == 0) {
+        occ->first_usec = usec;
+        occ->run_state = state;
+        occ->run_usec = usec;
+    } else if (state != occ->run_state) {
+        occupancy_add_run(occ, usec);
+        occ->run_state = state;
+        occ->run_usec = usec;
+        occ->run_records = 0;
+    }
+    occ->run_records++;
+    occ->records++;
+    occ->last_usec = usec;
+}
+
+/*
+ * Add src, the records of the flow in a later part of the log, to dst. The
+ * run dst ends with lasts until the first record of src, which gives the
+ * same sums as if the runs were one.
+ */
+static inline void
+flow_occupancy_merge(struct flow_occupancy *dst,
+                     const struct flow_occupancy *src)
+{
+    if (src->records == 0) {
+        return;
+    }
+    if (dst->records == 0) {
+        *dst = *src;
+        return;
+    }
+    occupancy_add_run(dst, src->first_usec);
+    for (int bit = 0; bit < OCCUPANCY_BITS; bit++) {
+        dst->bit_records[bit] += src->bit_records[bit];
+        dst->bit_usecs[bit] += src->bit_usecs[bit];
+    }
+    dst->run_state = src->run_state;
+    dst->run_usec = src->run_usec;
+    dst->run_records = src->run_records;
+    dst->records += src->records;
+    dst->last_usec = src->last_usec;
+}
+
+/* Close the last run, once all the records are in */
+static inline void
+flow_occupancy_finish(struct flow_occupancy *occ)
+{
+    occupancy_add_run(occ, occ->last_usec);
+    occ->run_state = 0;
+    occ->run_records = 0;
+    occ->run_usec = occ->last_usec;
+}
+
+static inline void
+flow_occupancy_free(struct flow_occupancy *occ)
+{
+    free(occ);
+}
+
+/* One row per bit that was set at all, the flowid on the first one only */
+static inline void
+flow_occupancy_show(uint32_t flowid, const struct flow_occupancy *occ)
+{
+    int64_t span = occ->last_usec - occ->first_usec;
+    bool first = true;
+
+    for (int bit = 0; bit < OCCUPANCY_BITS; bit++) {
+        const struct tflag_name *name = (bit < TFLAGS_BITS) ?
+            &tflags_names[bit] : &tflags2_names[bit - TFLAGS_BITS];
+        char unnamed[24];
+
+        if (occ->bit_records[bit] == 0) {
+            continue;
+        }
+        if (first) {
+            printf(" %10u", flowid);
+            first = false;
+        } else {
+            printf(" %10s", "");
+        }
+        if (name->len > 0) {
+            /* without the " | " separator */
+            printf(" %-24.*s", (int)(name->len - 3), name->str);
+        } else {
+            snprintf(unnamed, sizeof(unnamed), "%s bit %d",
+                     (bit < TFLAGS_BITS) ? "t_flags" : "t_flags2",
+                     bit % TFLAGS_BITS);
+            printf(" %-24s", unnamed);
+        }
+        printf(" %8.2f", 100.0 * occ->bit_records[bit] / occ->records);
+        if (span > 0) {
+            printf(" %8.2f\n", 100.0 * occ->bit_usecs[bit] / span);
+        } else {
+            printf(" %8s\n", "-");
+        }
+    }
+    if (first) {
+        printf(" %10u %-24s\n", flowid, "-");
+    }
+}
+
+#endif /* SIFTR_OCCUPANCY_H_ */
@@ -0,0 +1,124 @@
+/*
+ ============================================================================
+ Name        : siftr_offsets.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Delta-encoded lists of per-flow record offsets
+ ============================================================================
+ */
+
+#ifndef SIFTR_OFFSETS_H_
+#define SIFTR_OFFSETS_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The byte offsets of the records of one flow, in file order. Each offset is
+ * stored as the distance from the previous one in LEB128, so a flow with
+ * records every few hundred bytes costs about two bytes per record.
+ */
+struct offset_list {
+    uint8_t     *buf;
+    size_t      len;
+    size_t      cap;
+    uint64_t    count;
+    uint64_t    last;       /* the last offset added */
+};
+
+static inline int
+offset_list_reserve(struct offset_list *list, size_t more)
+{
+    if (list->len + more > list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        uint8_t *buf;
+
+        while (cap < list->len + more) {
+            cap *= 2;
+        }
+        buf = (uint8_t *)realloc(list->buf, cap);
+        if (buf == NULL) {
+            PERROR_FUNCTION("realloc failed for list->buf");
+            return EXIT_FAILURE;
+        }
+        list->buf = buf;
+        list->cap = cap;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Offsets must be added in increasing order */
+static inline int
+offset_list_add(struct offset_list *list, uint64_t offset)
+{
+    uint64_t delta = offset - list->last;
+
+    if (offset_list_reserve(list, 10) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    while (delta >= 0x80) {
+        list->buf[list->len++] = (uint8_t)(delta | 0x80);
+        delta >>= 7;
+    }
+    list->buf[list->len++] = (uint8_t)delta;
+    list->last = offset;
+    list->count++;
+    return EXIT_SUCCESS;
+}
+
+/* Decode the next offset; *pos and *offset carry the state, both start at 0 */
+static inline bool
+offset_list_next(const struct offset_list *list, size_t *pos, uint64_t *offset)
+{
+    uint64_t delta = 0;
+    int shift = 0;
+
+    if (*pos >= list->len) {
+        return false;
+    }
+    do {
+        delta |= (uint64_t)(list->buf[*pos] & 0x7f) << shift;
+        shift += 7;
+    } while (list->buf[(*pos)++] & 0x80);
+    *offset += delta;
+    return true;
+}
+
+/* Move the offsets of src, which all follow the ones of dst, to its end */
+static inline int
+offset_list_append(struct offset_list *dst, struct offset_list *src)
+{
+    size_t pos = 0;
+    uint64_t first = 0;
+
+    if (!offset_list_next(src, &pos, &first)) {
+        return EXIT_SUCCESS;
+    }
+    /* only the first delta changes, the rest is copied as is */
+    if (offset_list_add(dst, first) != EXIT_SUCCESS ||
+        offset_list_reserve(dst, src->len - pos) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    memcpy(dst->buf + dst->len, src->buf + pos, src->len - pos);
+    dst->len += src->len - pos;
+    dst->count += src->count - 1;
+    dst->last = src->last;
+    free(src->buf);
+    memset(src, 0, sizeof(*src));
+    return EXIT_SUCCESS;
+}
+
+static inline void
+offset_lists_free(struct offset_list *lists, uint32_t count)
+{
+    if (lists != NULL) {
+        for (uint32_t i = 0; i < count; i++) {
+            free(lists[i].buf);
+        }
+        free(lists);
+    }
+}
+
+#endif /* SIFTR_OFFSETS_H_ */
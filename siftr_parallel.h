@@ -0,0 +1,420 @@
+/*
+ ============================================================================
+ Name        : siftr_parallel.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Multi-threaded body pass over newline aligned chunks
+ ============================================================================
+ */
+
+#ifndef SIFTR_PARALLEL_H_
+#define SIFTR_PARALLEL_H_
+
+#include <pthread.h>
+
+enum {
+    MAX_JOBS = 256,
+    MIN_CHUNK_SIZE = (1 << 20),     /* do not split the body finer than this */
+};
+
+/*
+ * One byte range of the body and what its thread found in it. The flows are
+ * kept in the order they first show up in the range, so merging the chunks
+ * in file order gives the same flow_list as the serial pass.
+ */
+struct body_chunk {
+    const char          *map;           /* offsets are relative to this */
+    const char          *data;
+    size_t              len;
+    pthread_t           thread;
+    bool                is_started;
+    struct flow_table   table;
+    struct flow_info    *flows;
+    struct offset_list  *offsets;       /* per flow, NULL if not wanted */
+    struct time_index   time_index;     /* of this range, if stride is set */
+    uint32_t            flow_cnt;
+    uint32_t            flow_cap;
+    uint32_t            line_cnt;
+    uint32_t            malformed;
+    uint64_t            probes;         /* flow_probe_cnt of the thread */
+    int64_t             first_usec;     /* of the whole log */
+    bool                failed;
+};
+
+static inline struct flow_info *
+chunk_add_flow(struct body_chunk *chunk, uint32_t flowid)
+{
+    if (chunk->flow_cnt == chunk->flow_cap) {
+        uint32_t cap = chunk->flow_cap ? chunk->flow_cap * 2 : 64;
+        struct flow_info *flows = (struct flow_info *)
+            realloc(chunk->flows, cap * sizeof(struct flow_info));
+
+        if (flows == NULL) {
+            PERROR_FUNCTION("realloc failed for chunk->flows");
+            return NULL;
+        }
+        chunk->flows = flows;
+
+        if (chunk->offsets != NULL) {
+            struct offset_list *offsets = (struct offset_list *)
+                realloc(chunk->offsets, cap * sizeof(struct offset_list));
+
+            if (offsets == NULL) {
+                PERROR_FUNCTION("realloc failed for chunk->offsets");
+                return NULL;
+            }
+            memset(offsets + chunk->flow_cap, 0,
+                   (cap - chunk->flow_cap) * sizeof(struct offset_list));
+            chunk->offsets = offsets;
+        }
+        chunk->flow_cap = cap;
+    }
+    if (flow_table_insert(&chunk->table, flowid, chunk->flow_cnt) !=
+        EXIT_SUCCESS) {
+        return NULL;
+    }
+    memset(&chunk->flows[chunk->flow_cnt], 0, sizeof(struct flow_info));
+    chunk->flows[chunk->flow_cnt].flowid = flowid;
+    return &chunk->flows[chunk->flow_cnt++];
+}
+
+static void *
+body_chunk_worker(void *arg)
+{
+    struct body_chunk *chunk = (struct body_chunk *)arg;
+    struct record_fields *records;
+    const char *data = chunk->data;
+    size_t left = chunk->len;
+
+    records = (struct record_fields *)
+        malloc(RECORD_BATCH_SIZE * sizeof(struct record_fields));
+    if (records == NULL) {
+        PERROR_FUNCTION("malloc failed for records");
+        chunk->failed = true;
+        return NULL;
+    }
+
+    /* a failed chunk throws the whole pass away, stop at once */
+    while (left > 0 && !chunk->failed) {
+        size_t consumed;
+        size_t count = split_records(data, left, records, RECORD_BATCH_SIZE,
+                                     &consumed);
+        if (count == 0) {
+            break;
+        }
+        for (size_t r = 0; r < count; r++) {
+            struct record_fields *rf = &records[r];
+            uint32_t flowid;
+            uint32_t idx;
+
+            chunk->line_cnt++;
+            if (rf->field_cnt != TOTAL_FIELDS ||
+                field_u32(rf, FLOW_ID, &flowid) != EXIT_SUCCESS) {
+                chunk->malformed++;
+                continue;
+            }
+
+            if (flow_table_find_cached(&chunk->table, flowid, &idx)) {
+                chunk->flows[idx].record_cnt++;
+            } else {
+                struct flow_info *flow = chunk_add_flow(chunk, flowid);
+
+                if (flow == NULL) {
+                    chunk->failed = true;
+                    break;
+                }
+                fill_flow_info_from_view(flow, rf);
+                flow->record_cnt = 1;
+                idx = chunk->flow_cnt - 1;
+            }
+            if (use_columns) {
+                if (flow_columns_record(&chunk->flows[idx], rf) !=
+                    EXIT_SUCCESS) {
+                    chunk->failed = true;
+                    break;
+                }
+            } else if (show_metrics) {
+                flow_stats_record(&chunk->flows[idx], rf);
+            }
+            if (bucket_usec > 0) {
+                flow_bucket_record(&chunk->flows[idx], rf, chunk->first_usec);
+            }
+            if (show_events) {
+                flow_events_record(&chunk->flows[idx], rf);
+            }
+            if (show_occupancy) {
+                flow_occupancy_record(&chunk->flows[idx], rf);
+            }
+            if (chunk->offsets != NULL &&
+                offset_list_add(&chunk->offsets[idx],
+                                (uint64_t)(rf->line - chunk->map)) !=
+                EXIT_SUCCESS) {
+                chunk->failed = true;
+                break;
+            }
+            if (chunk->time_index.stride > 0 &&
+                time_index_note(&chunk->time_index, rf, chunk->map) !=
+                EXIT_SUCCESS) {
+                chunk->failed = true;
+                break;
+            }
+        }
+        data += consumed;
+        left -= consumed;
+    }
+
+    free(records);
+    chunk->probes = flow_probe_cnt;
+    return NULL;
+}
+
+/* Fold the chunk results into f_basics->flow_list, in file order */
+static inline void
+merge_body_chunks(struct file_basic_stats *f_basics, struct body_chunk *chunks,
+                  uint32_t nchunks)
+{
+    uint8_t ipver = (strcmp(f_basics->first_line_stats->ipmode, "4") == 0) ?
+                    INP_IPV4 : INP_IPV6;
+
+    for (uint32_t c = 0; c < nchunks; c++) {
+        /* with marks missing a window only starts earlier */
+        time_index_append(&f_basics->time_index, &chunks[c].time_index);
+        for (uint32_t i = 0; i < chunks[c].flow_cnt; i++) {
+            struct flow_info *flow = &chunks[c].flows[i];
+            uint32_t idx;
+
+            if (flow_table_find(&f_basics->flow_table, flow->flowid, &idx)) {
+                struct flow_info *target = &f_basics->flow_list[idx];
+
+                target->record_cnt += flow->record_cnt;
+                if (target->stats == NULL) {
+                    target->stats = flow->stats;
+                } else if (flow->stats != NULL) {
+                    flow_stats_merge(target->stats, flow->stats);
+                    flow_stats_free(flow->stats);
+                }
+                if (target->buckets == NULL) {
+                    target->buckets = flow->buckets;
+                } else if (flow->buckets != NULL) {
+                    bucket_series_merge(target->buckets, flow->buckets);
+                    bucket_series_free(flow->buckets);
+                }
+                if (target->events == NULL) {
+                    target->events = flow->events;
+                } else if (flow->events != NULL) {
+                    flow_events_merge(target->events, flow->events);
+                    flow_events_free(flow->events);
+                }
+                if (target->occupancy == NULL) {
+                    target->occupancy = flow->occupancy;
+                } else if (flow->occupancy != NULL) {
+                    flow_occupancy_merge(target->occupancy, flow->occupancy);
+                    flow_occupancy_free(flow->occupancy);
+                }
+            } else if (f_basics->flow_table.count < f_basics->flow_count) {
+                idx = f_basics->flow_table.count;
+                f_basics->flow_list[idx] = *flow;
+                f_basics->flow_list[idx].ipver = ipver;
+                /* the columns are moved below */
+                f_basics->flow_list[idx].cols = NULL;
+                flow_table_insert(&f_basics->flow_table, flow->flowid, idx);
+            } else {
+                continue;
+            }
+            /* the stats, buckets, events and flag counts belong to
+               flow_list now */
+            flow->stats = NULL;
+            flow->buckets = NULL;
+            flow->events = NULL;
+            flow->occupancy = NULL;
+            if (f_basics->flow_offsets != NULL) {
+                offset_list_append(&f_basics->flow_offsets[idx],
+                                   &chunks[c].offsets[i]);
+            }
+        }
+    }
+
+    if (!use_columns) {
+        return;
+    }
+    /*
+     * The record counts are final now: the first columns of a flow are sized
+     * to all of its records once, the later ones are copied in after them.
+     */
+    for (uint32_t c = 0; c < nchunks; c++) {
+        for (uint32_t i = 0; i < chunks[c].flow_cnt; i++) {
+            struct flow_info *flow = &chunks[c].flows[i];
+            struct flow_info *target;
+            uint32_t idx;
+
+            if (flow->cols == NULL ||
+                !flow_table_find(&f_basics->flow_table, flow->flowid, &idx)) {
+                continue;
+            }
+            target = &f_basics->flow_list[idx];
+            if (target->cols == NULL) {
+                if (flow_columns_resize(flow->cols, target->record_cnt) !=
+                    EXIT_SUCCESS) {
+                    continue;
+                }
+                target->cols = flow->cols;
+            } else {
+                flow_columns_append(target->cols, flow->cols);
+                flow_columns_free(flow->cols);
+            }
+            flow->cols = NULL;
+        }
+    }
+}
+
+/* Timestamp of the first record of a mapped body, -1 if it has none */
+static inline int64_t
+body_first_usec(const struct log_reader *reader)
+{
+    size_t pos = reader->body_start;
+
+    while (pos < reader->footer_start) {
+        const char *line = reader->map + pos;
+        const char *nl = memchr(line, '\n', reader->footer_start - pos);
+        size_t len = (nl == NULL) ? reader->footer_start - pos :
+                                    (size_t)(nl - line);
+        struct record_fields rf;
+        int64_t usec = 0;
+
+        if (split_fields(line, strip_cr(line, len), &rf)) {
+            field_usec(&rf, TIMESTAMP, &usec);
+            return usec;
+        }
+        pos += len + 1;
+    }
+    return -1;
+}
+
+/*
+ * Parse the body with nthreads threads. The body between the head and the foot
+ * note is cut into newline aligned ranges, one per thread. Returns the number
+ * of records, or -1 if the body could not be parsed this way.
+ */
+int64_t
+get_body_stats_parallel(struct file_basic_stats *f_basics, uint32_t nthreads)
+{
+    const struct log_reader *reader = &f_basics->reader;
+    const char *body;
+    size_t body_len;
+    struct body_chunk *chunks;
+    uint32_t nchunks = 0;
+    int64_t line_cnt = 0;
+    bool failed = false;
+    size_t pos = 0;
+
+    if (!reader->is_mapped) {
+        return -1;
+    }
+    body = reader->map + reader->body_start;
+    body_len = reader->footer_start - reader->body_start;
+
+    if (nthreads > MAX_JOBS) {
+        nthreads = MAX_JOBS;
+    }
+    if (nthreads > body_len / MIN_CHUNK_SIZE) {
+        nthreads = (body_len / MIN_CHUNK_SIZE > 0) ?
+                   (uint32_t)(body_len / MIN_CHUNK_SIZE) : 1;
+    }
+
+    chunks = (struct body_chunk *)calloc(nthreads, sizeof(struct body_chunk));
+    if (chunks == NULL) {
+        PERROR_FUNCTION("calloc failed for chunks");
+        return -1;
+    }
+
+    /* pick the splitter kernel before the threads race to do it */
+    get_delim_bitmap(NULL);
+    /* every thread needs the origin of the --bucket intervals up front */
+    f_basics->first_usec = body_first_usec(reader);
+
+    for (uint32_t j = 0; j < nthreads && pos < body_len; j++) {
+        size_t end = body_len * (j + 1) / nthreads;
+        struct body_chunk *chunk = &chunks[nchunks];
+
+        if (end < pos) {
+            end = pos;
+        }
+        if (j + 1 < nthreads && end < body_len) {
+            const char *nl = memchr(body + end, '\n', body_len - end);
+            end = (nl == NULL) ? body_len : (size_t)(nl - body) + 1;
+        } else {
+            end = body_len;
+        }
+        chunk->map = reader->map;
+        chunk->first_usec = f_basics->first_usec;
+        chunk->time_index.stride = f_basics->time_index.stride;
+        chunk->data = body + pos;
+        chunk->len = end - pos;
+        pos = end;
+
+        if (flow_table_init(&chunk->table, 64) != EXIT_SUCCESS) {
+            failed = true;
+            break;
+        }
+        if (f_basics->flow_offsets != NULL) {
+            /* chunk_add_flow() grows it along with chunk->flows */
+            chunk->offsets = (struct offset_list *)
+                calloc(1, sizeof(struct offset_list));
+            if (chunk->offsets == NULL) {
+                PERROR_FUNCTION("calloc failed for chunk->offsets");
+                failed = true;
+                break;
+            }
+        }
+        nchunks++;
+        if (pthread_create(&chunk->thread, NULL, body_chunk_worker, chunk) != 0) {
+            PERROR_FUNCTION("pthread_create");
+            failed = true;
+            break;
+        }
+        chunk->is_started = true;
+    }
+
+    for (uint32_t c = 0; c < nchunks; c++) {
+        if (chunks[c].is_started && pthread_join(chunks[c].thread, NULL) != 0) {
+            PERROR_FUNCTION("pthread_join");
+            failed = true;
+        }
+        failed |= chunks[c].failed;
+        line_cnt += chunks[c].line_cnt;
+    }
+
+    if (!failed) {
+        /* the serial pass that follows a failure counts them itself */
+        for (uint32_t c = 0; c < nchunks; c++) {
+            profile_count(PROF_MALFORMED, chunks[c].malformed);
+            profile_count(PROF_HASH_PROBES, chunks[c].probes);
+        }
+        profile_count(PROF_BYTES_READ, body_len);
+        merge_body_chunks(f_basics, chunks, nchunks);
+    }
+
+    for (uint32_t c = 0; c < nchunks; c++) {
+        flow_table_free(&chunks[c].table);
+        offset_lists_free(chunks[c].offsets, chunks[c].flow_cnt);
+        time_index_free(&chunks[c].time_index);
+        for (uint32_t i = 0; i < chunks[c].flow_cnt; i++) {
+            flow_stats_free(chunks[c].flows[i].stats);
+            flow_columns_free(chunks[c].flows[i].cols);
+            bucket_series_free(chunks[c].flows[i].buckets);
+            flow_events_free(chunks[c].flows[i].events);
+            flow_occupancy_free(chunks[c].flows[i].occupancy);
+        }
+        free(chunks[c].flows);
+    }
+    free(chunks);
+
+    if (verbose && !failed) {
+        printf("body parsed by %u threads\n", nchunks);
+    }
+
+    return failed ? -1 : line_cnt;
+}
+
+#endif /* SIFTR_PARALLEL_H_ */
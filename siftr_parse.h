@@ -0,0 +1,156 @@
+/*
+ ============================================================================
+ Name        : siftr_parse.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Numeric field parsers for the fixed formats of siftr logs
+ ============================================================================
+ */
+
+#ifndef SIFTR_PARSE_H_
+#define SIFTR_PARSE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The fields of a siftr record are plain unsigned decimals and a
+ * "seconds.microseconds" timestamp, always in the C locale. These
+ * parsers take a field that is not NUL terminated, never allocate and never
+ * print: they return EXIT_SUCCESS, or EXIT_FAILURE on an empty field, a
+ * stray character or an overflow, and only then leave *value untouched.
+ */
+
+enum {
+    PARSE_U64_MAX_DIGITS = 20,
+    PARSE_U32_MAX_DIGITS = 10,
+    PARSE_USEC_DIGITS = 6,      /* siftr prints the fraction with "%06ld" */
+};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PARSE_HAVE_SWAR 1
+
+/* True if all 8 bytes of chunk are '0' to '9'. */
+static inline bool
+parse_is_8digits(uint64_t chunk)
+{
+    return (((chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+             (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+            0x3333333333333333ULL);
+}
+
+/* The value of 8 digits loaded little endian, the first digit in byte 0. */
+static inline uint32_t
+parse_8digits(uint64_t chunk)
+{
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 100 + (1000000ULL << 32);
+    const uint64_t mul2 = 1 + (10000ULL << 32);
+
+    chunk -= 0x3030303030303030ULL;
+    chunk = (chunk * 10) + (chunk >> 8);
+    return (uint32_t)((((chunk & mask) * mul1) +
+                       (((chunk >> 16) & mask) * mul2)) >> 32);
+}
+#endif
+
+/* An unsigned decimal of up to 20 digits. */
+static inline int
+parse_u64(const char *ptr, size_t len, uint64_t *value)
+{
+    uint64_t number = 0;
+    size_t i = 0;
+
+    if (len == 0 || len > PARSE_U64_MAX_DIGITS) {
+        return EXIT_FAILURE;
+    }
+#ifdef PARSE_HAVE_SWAR
+    /* the first 16 digits, 8 at a time */
+    for (; i + 8 <= len && i < 16; i += 8) {
+        uint64_t chunk;
+
+        memcpy(&chunk, ptr + i, sizeof(chunk));
+        if (!parse_is_8digits(chunk)) {
+            return EXIT_FAILURE;
+        }
+        number = number * 100000000 + parse_8digits(chunk);
+    }
+#endif
+    for (; i < len; i++) {
+        uint32_t digit = (uint32_t)(unsigned char)ptr[i] - '0';
+
+        if (digit > 9) {
+            return EXIT_FAILURE;
+        }
+        if (i + 1 < PARSE_U64_MAX_DIGITS) {
+            /* 19 digits can not overflow, only the 20th one is checked */
+            number = number * 10 + digit;
+        } else if (__builtin_mul_overflow(number, 10, &number) ||
+                   __builtin_add_overflow(number, digit, &number)) {
+            return EXIT_FAILURE;
+        }
+    }
+    *value = number;
+    return EXIT_SUCCESS;
+}
+
+/* An unsigned decimal that fits in 32 bits, like a flowid or t_flags. */
+static inline int
+parse_u32(const char *ptr, size_t len, uint32_t *value)
+{
+    uint64_t number;
+
+    if (len > PARSE_U32_MAX_DIGITS || parse_u64(ptr, len, &number) !=
+        EXIT_SUCCESS || number > UINT32_MAX) {
+        return EXIT_FAILURE;
+    }
+    *value = (uint32_t)number;
+    return EXIT_SUCCESS;
+}
+
+/*
+ * A "seconds.microseconds" timestamp, as fixed point microseconds. Exactly
+ * six fractional digits is the fast case; fewer are scaled up and more are
+ * truncated, so a hand edited log still parses the way strtod() would see it.
+ */
+static inline int
+parse_usec(const char *ptr, size_t len, int64_t *usec)
+{
+    static const uint32_t scale[PARSE_USEC_DIGITS + 1] = {
+        1000000, 100000, 10000, 1000, 100, 10, 1,
+    };
+    const char *dot = memchr(ptr, '.', len);
+    size_t int_len = (dot == NULL) ? len : (size_t)(dot - ptr);
+    size_t frac_len = (dot == NULL) ? 0 : len - int_len - 1;
+    uint64_t secs = 0;
+    uint32_t frac = 0;
+
+    if (int_len > 0 && parse_u64(ptr, int_len, &secs) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (frac_len > 0) {
+        size_t used = (frac_len > PARSE_USEC_DIGITS) ? PARSE_USEC_DIGITS :
+                                                       frac_len;
+
+        if (parse_u32(dot + 1, used, &frac) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+        for (size_t i = used; i < frac_len; i++) {
+            if ((uint32_t)(unsigned char)dot[1 + i] - '0' > 9) {
+                return EXIT_FAILURE;
+            }
+        }
+        frac *= scale[used];
+    }
+    if ((int_len == 0 && frac_len == 0) || secs > INT64_MAX / 1000000 - 1) {
+        return EXIT_FAILURE;
+    }
+    *usec = (int64_t)secs * 1000000 + frac;
+    return EXIT_SUCCESS;
+}
+
+#endif /* SIFTR_PARSE_H_ */
@@ -0,0 +1,614 @@
+/*
+ ============================================================================
+ Name        : siftr_plot.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Buffered per-flow plot files with a bound on open handles
+ ============================================================================
+ */
+
+#ifndef SIFTR_PLOT_H_
+#define SIFTR_PLOT_H_
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+enum {
+    PLOT_MAX_OPEN_FILES = 256,
+    PLOT_BUF_BUDGET = (64 << 20),   /* output buffers for all flows */
+    PLOT_MIN_BUF_SIZE = (4 << 10),
+    PLOT_MAX_BUF_SIZE = (256 << 10),
+    PLOT_MAX_LINE = 1280,           /* longest line appended at once, with
+                                       decoded t_flags and t_flags2 */
+    PLOT_SEEK_RATIO = 16,           /* seek to the records of flows having
+                                       less than 1/16 of all the records */
+    PLOT_USEC_MAX_LEN = 28,         /* "-9223372036854.775808" and then some */
+    PLOT_WRITER_QUEUE = 32,         /* full buffers waiting for the writer */
+};
+
+extern const char *out_dir;         /* NULL for the working directory */
+extern bool use_writer_thread;
+
+/*
+ * A plot file on disk. It is created (truncated) when it is opened first,
+ * and reopened for appending whenever it was closed to make room for another.
+ */
+struct plot_file {
+    char                *name;
+    FILE                *stream;        /* NULL while the file is closed */
+    bool                is_created;
+    struct plot_file    *next_open;     /* open files, oldest first */
+};
+
+struct cwnd_decimator;
+void cwnd_decimate_free(struct cwnd_decimator *dec);
+
+struct plot_output {
+    uint32_t            flowid;
+    struct plot_file    *file;
+    char                *buf;
+    size_t              len;
+    struct cwnd_decimator *decim;       /* with --max-points, or NULL */
+};
+
+/* A full buffer on its way to the writer thread. */
+struct plot_job {
+    struct plot_file    *file;
+    char                *buf;
+    size_t              len;
+};
+
+struct plot_writer {
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    struct plot_job     jobs[PLOT_WRITER_QUEUE];
+    uint32_t            job_head;
+    uint32_t            job_cnt;
+    char                *free_bufs[PLOT_WRITER_QUEUE];
+    uint32_t            free_cnt;
+    bool                stop;
+    bool                failed;
+};
+
+/*
+ * Output of many flows written in one pass. Lines are collected per flow and
+ * written out when a buffer fills. With thousands of flows not every file
+ * can stay open, so the oldest open file is closed to open another one.
+ * With a writer thread, full buffers are handed over to it and the files
+ * (the open_* fields included) belong to that thread alone, so formatting
+ * goes on while the last buffers are written.
+ */
+struct plot_outputs {
+    struct plot_output  *outs;
+    uint32_t            count;
+    uint32_t            cap;            /* room in outs */
+    size_t              buf_size;
+    uint32_t            open_cnt;
+    uint32_t            max_open;
+    struct plot_file    *open_head;
+    struct plot_file    *open_tail;
+    struct plot_writer  *writer;        /* NULL to write in this thread */
+    bool                is_live;        /* files are read while they grow */
+    const char          *kind;          /* files are named <kind>_<flowid>.txt */
+};
+
+static inline uint32_t
+plot_max_open_files(void)
+{
+    struct rlimit rl;
+    uint32_t max_open = PLOT_MAX_OPEN_FILES;
+
+    /* leave room for stdio and the input file */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+        rl.rlim_cur < (rlim_t)max_open + 16) {
+        max_open = (rl.rlim_cur > 24) ? (uint32_t)rl.rlim_cur - 16 : 8;
+    }
+    return max_open;
+}
+
+/* Close the oldest open file. */
+static inline int
+plot_close_oldest(struct plot_outputs *plots)
+{
+    struct plot_file *file = plots->open_head;
+    int ret = EXIT_SUCCESS;
+
+    plots->open_head = file->next_open;
+    if (plots->open_head == NULL) {
+        plots->open_tail = NULL;
+    }
+    file->next_open = NULL;
+    plots->open_cnt--;
+    if (fclose(file->stream) == EOF) {
+        PERROR_FUNCTION("Failed to close cwnd_file");
+        ret = EXIT_FAILURE;
+    }
+    file->stream = NULL;
+    return ret;
+}
+
+static inline int
+plot_open(struct plot_outputs *plots, struct plot_file *file)
+{
+    while (plots->open_cnt >= plots->max_open) {
+        if (plot_close_oldest(plots) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+    file->stream = fopen(file->name, file->is_created ? "a" : "w");
+    if (file->stream == NULL) {
+        PERROR_FUNCTION("Failed to open cwnd plot file for writing");
+        return EXIT_FAILURE;
+    }
+    file->is_created = true;
+    if (plots->open_tail != NULL) {
+        plots->open_tail->next_open = file;
+    } else {
+        plots->open_head = file;
+    }
+    plots->open_tail = file;
+    plots->open_cnt++;
+    return EXIT_SUCCESS;
+}
+
+static inline int
+plot_file_write(struct plot_outputs *plots, struct plot_file *file,
+                const char *buf, size_t len)
+{
+    if (file->stream == NULL && plot_open(plots, file) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (fwrite(buf, 1, len, file->stream) != len) {
+        PERROR_FUNCTION("Failed to write cwnd_file");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static inline int
+plot_files_sync(struct plot_outputs *plots)
+{
+    int ret = EXIT_SUCCESS;
+
+    for (struct plot_file *file = plots->open_head; file != NULL;
+         file = file->next_open) {
+        if (fflush(file->stream) == EOF) {
+            PERROR_FUNCTION("Failed to flush cwnd_file");
+            ret = EXIT_FAILURE;
+        }
+    }
+    return ret;
+}
+
+static void *
+plot_writer_main(void *arg)
+{
+    struct plot_outputs *plots = (struct plot_outputs *)arg;
+    struct plot_writer *writer = plots->writer;
+    bool is_dirty = false;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        struct plot_job job;
+
+        if (writer->job_cnt == 0) {
+            if (is_dirty) {
+                /* nothing queued, let readers of the files catch up */
+                pthread_mutex_unlock(&writer->lock);
+                if (plot_files_sync(plots) != EXIT_SUCCESS) {
+                    writer->failed = true;
+                }
+                is_dirty = false;
+                pthread_mutex_lock(&writer->lock);
+                continue;
+            }
+            if (writer->stop) {
+                break;
+            }
+            pthread_cond_wait(&writer->cond, &writer->lock);
+            continue;
+        }
+        job = writer->jobs[writer->job_head];
+        writer->job_head = (writer->job_head + 1) % PLOT_WRITER_QUEUE;
+        writer->job_cnt--;
+        pthread_cond_broadcast(&writer->cond);
+        pthread_mutex_unlock(&writer->lock);
+
+        if (plot_file_write(plots, job.file, job.buf, job.len) !=
+            EXIT_SUCCESS) {
+            writer->failed = true;
+        }
+        /* only a followed log has readers to keep up to date */
+        is_dirty = plots->is_live;
+
+        pthread_mutex_lock(&writer->lock);
+        if (writer->free_cnt < PLOT_WRITER_QUEUE) {
+            writer->free_bufs[writer->free_cnt++] = job.buf;
+        } else {
+            free(job.buf);
+        }
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+/* Queue the buffer of out for the writer and give out an empty one. */
+static inline int
+plot_writer_submit(struct plot_outputs *plots, struct plot_output *out)
+{
+    struct plot_writer *writer = plots->writer;
+    char *buf = NULL;
+
+    pthread_mutex_lock(&writer->lock);
+    while (writer->job_cnt == PLOT_WRITER_QUEUE) {
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    }
+    writer->jobs[(writer->job_head + writer->job_cnt) % PLOT_WRITER_QUEUE] =
+        (struct plot_job){ .file = out->file, .buf = out->buf, .len = out->len };
+    writer->job_cnt++;
+    if (writer->free_cnt > 0) {
+        buf = writer->free_bufs[--writer->free_cnt];
+    }
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    if (buf == NULL) {
+        buf = (char *)malloc(plots->buf_size);
+        if (buf == NULL) {
+            PERROR_FUNCTION("malloc failed for out->buf");
+            out->buf = NULL;
+            out->len = 0;
+            return EXIT_FAILURE;
+        }
+    }
+    out->buf = buf;
+    out->len = 0;
+    return EXIT_SUCCESS;
+}
+
+static inline int
+plot_writer_start(struct plot_outputs *plots)
+{
+    struct plot_writer *writer =
+        (struct plot_writer *)calloc(1, sizeof(struct plot_writer));
+
+    if (writer == NULL) {
+        PERROR_FUNCTION("calloc failed for writer");
+        return EXIT_FAILURE;
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    plots->writer = writer;
+    if (pthread_create(&writer->thread, NULL, plot_writer_main, plots) != 0) {
+        PERROR_FUNCTION("pthread_create");
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->cond);
+        free(writer);
+        plots->writer = NULL;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Let the writer finish the queued buffers, then stop it. */
+static inline int
+plot_writer_stop(struct plot_outputs *plots)
+{
+    struct plot_writer *writer = plots->writer;
+    bool failed;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = true;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    if (pthread_join(writer->thread, NULL) != 0) {
+        PERROR_FUNCTION("pthread_join");
+    }
+
+    failed = writer->failed;
+    for (uint32_t i = 0; i < writer->free_cnt; i++) {
+        free(writer->free_bufs[i]);
+    }
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->cond);
+    free(writer);
+    plots->writer = NULL;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int
+plot_flush(struct plot_outputs *plots, struct plot_output *out)
+{
+    if (out->len == 0) {
+        return EXIT_SUCCESS;
+    }
+    profile_count(PROF_OUTPUT_BYTES, out->len);
+    if (plots->writer != NULL) {
+        return plot_writer_submit(plots, out);
+    }
+    if (plot_file_write(plots, out->file, out->buf, out->len) !=
+        EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    out->len = 0;
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Make room for len more bytes in the buffer of out, writing it out first if
+ * needed. Returns where to append, or NULL if that can not be done.
+ */
+static inline char *
+plot_reserve(struct plot_outputs *plots, struct plot_output *out, size_t len)
+{
+    if (out->buf == NULL) {
+        return NULL;
+    }
+    if (plots->buf_size - out->len < len &&
+        (len > plots->buf_size || plot_flush(plots, out) != EXIT_SUCCESS ||
+         out->buf == NULL)) {
+        return NULL;
+    }
+    return out->buf + out->len;
+}
+
+/* Keep what was appended from plot_reserve() up to end. */
+static inline void
+plot_commit(struct plot_output *out, const char *end)
+{
+    out->len = (size_t)(end - out->buf);
+}
+
+static inline char *
+plot_put_str(char *dst, const char *str, size_t len)
+{
+    memcpy(dst, str, len);
+    return dst + len;
+}
+
+static inline char *
+plot_put_u64(char *dst, uint64_t value)
+{
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        *dst++ = digits[--n];
+    }
+    return dst;
+}
+
+/*
+ * Print microseconds as seconds with six decimals, the same text as "%.6f"
+ * gives for usec / 1e6, with integer math only.
+ */
+static inline char *
+plot_put_usec(char *dst, int64_t usec)
+{
+    uint64_t mag = (usec < 0) ? 0 - (uint64_t)usec : (uint64_t)usec;
+    uint32_t frac = (uint32_t)(mag % 1000000);
+
+    if (usec < 0) {
+        *dst++ = '-';
+    }
+    dst = plot_put_u64(dst, mag / 1000000);
+    *dst++ = '.';
+    for (int i = 5; i >= 0; i--) {
+        dst[i] = (char)('0' + frac % 10);
+        frac /= 10;
+    }
+    return dst + 6;
+}
+
+/* Append one formatted line, writing the buffer out first if it is full. */
+__attribute__((format(printf, 3, 4))) void
+plot_printf(struct plot_outputs *plots, struct plot_output *out,
+            const char *format, ...)
+{
+    va_list ap;
+    int n;
+
+    if (plot_reserve(plots, out, PLOT_MAX_LINE) == NULL) {
+        return;
+    }
+    va_start(ap, format);
+    n = vsnprintf(out->buf + out->len, plots->buf_size - out->len, format, ap);
+    va_end(ap);
+    if (n > 0) {
+        out->len += ((size_t)n < plots->buf_size - out->len) ?
+                    (size_t)n : plots->buf_size - out->len - 1;
+    }
+}
+
+/* Set up the plot file of one flow, starting with header. */
+static inline int
+plot_output_create(struct plot_outputs *plots, struct plot_output *out,
+                   uint32_t flowid, const char *header)
+{
+    int n;
+
+    out->flowid = flowid;
+    out->file = (struct plot_file *)calloc(1, sizeof(struct plot_file));
+    if (out->file == NULL) {
+        PERROR_FUNCTION("calloc failed for out->file");
+        return EXIT_FAILURE;
+    }
+    if (out_dir != NULL) {
+        n = asprintf(&out->file->name, "%s/%s_%u.txt", out_dir, plots->kind,
+                     flowid);
+    } else {
+        n = asprintf(&out->file->name, "%s_%u.txt", plots->kind, flowid);
+    }
+    if (n < 0) {
+        out->file->name = NULL;
+        PERROR_FUNCTION("asprintf failed for the plot file name");
+        return EXIT_FAILURE;
+    }
+    printf("%s_plot_file_name: %s\n", plots->kind, out->file->name);
+
+    out->buf = (char *)malloc(plots->buf_size);
+    if (out->buf == NULL) {
+        PERROR_FUNCTION("malloc failed for out->buf");
+        return EXIT_FAILURE;
+    }
+    if (plots->writer == NULL && plot_open(plots, out->file) != EXIT_SUCCESS) {
+        /* without a writer thread, fail early if it can not be created */
+        return EXIT_FAILURE;
+    }
+    plot_printf(plots, out, "%s", header);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Create (truncate) one plot file per flowid, each starting with header and
+ * named after kind.
+ */
+int
+plot_outputs_init_kind(struct plot_outputs *plots, const char *kind,
+                       const uint32_t *flowids, uint32_t count,
+                       const char *header)
+{
+    size_t buf_size = PLOT_BUF_BUDGET / (count > 0 ? count : 1);
+
+    if (buf_size < PLOT_MIN_BUF_SIZE) {
+        buf_size = PLOT_MIN_BUF_SIZE;
+    } else if (buf_size > PLOT_MAX_BUF_SIZE) {
+        buf_size = PLOT_MAX_BUF_SIZE;
+    }
+
+    memset(plots, 0, sizeof(*plots));
+    plots->kind = kind;
+    plots->buf_size = buf_size;
+    plots->max_open = plot_max_open_files();
+    if (use_writer_thread && plot_writer_start(plots) != EXIT_SUCCESS) {
+        PERROR_FUNCTION("no writer thread, write the files in place");
+    }
+    if (count == 0) {
+        /* outputs are added later by plot_outputs_add() */
+        return EXIT_SUCCESS;
+    }
+    plots->outs = (struct plot_output *)calloc(count, sizeof(struct plot_output));
+    if (plots->outs == NULL) {
+        PERROR_FUNCTION("calloc failed for plots->outs");
+        return EXIT_FAILURE;
+    }
+    plots->count = plots->cap = count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (plot_output_create(plots, &plots->outs[i], flowids[i],
+                               header) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/* The cwnd plot files, cwnd_<flowid>.txt */
+int
+plot_outputs_init(struct plot_outputs *plots, const uint32_t *flowids,
+                  uint32_t count, const char *header)
+{
+    return plot_outputs_init_kind(plots, "cwnd", flowids, count, header);
+}
+
+/*
+ * Add the output of a flow found after plot_outputs_init(). The outputs may
+ * move, so the new one is returned as an index into plots->outs, or -1.
+ */
+int64_t
+plot_outputs_add(struct plot_outputs *plots, uint32_t flowid,
+                 const char *header)
+{
+    if (plots->count == plots->cap) {
+        uint32_t cap = plots->cap ? plots->cap * 2 : 16;
+        struct plot_output *outs = (struct plot_output *)
+            realloc(plots->outs, cap * sizeof(struct plot_output));
+
+        if (outs == NULL) {
+            PERROR_FUNCTION("realloc failed for plots->outs");
+            return -1;
+        }
+        memset(outs + plots->cap, 0,
+               (cap - plots->cap) * sizeof(struct plot_output));
+        plots->outs = outs;
+        plots->cap = cap;
+    }
+    /* count it first, so that plot_outputs_close() also cleans up a failure */
+    plots->count++;
+    if (plot_output_create(plots, &plots->outs[plots->count - 1], flowid,
+                           header) != EXIT_SUCCESS) {
+        return -1;
+    }
+    return plots->count - 1;
+}
+
+/* Push everything written so far down to the files. */
+int
+plot_outputs_flush(struct plot_outputs *plots)
+{
+    int ret = EXIT_SUCCESS;
+
+    for (uint32_t i = 0; i < plots->count; i++) {
+        if (plot_flush(plots, &plots->outs[i]) != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+        }
+    }
+    /* the writer thread syncs the files itself once it runs out of work */
+    if (plots->writer == NULL && plots->is_live &&
+        plot_files_sync(plots) != EXIT_SUCCESS) {
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
+
+/* Write out what is left and close every file. */
+int
+plot_outputs_close(struct plot_outputs *plots)
+{
+    int ret = EXIT_SUCCESS;
+    int prev = profile_enter(PROF_FLUSH);
+
+    for (uint32_t i = 0; i < plots->count; i++) {
+        struct plot_output *out = &plots->outs[i];
+
+        /* skip what a failed plot_output_create() left behind */
+        if (out->buf != NULL && out->file != NULL && out->file->name != NULL &&
+            plot_flush(plots, out) != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+        }
+    }
+    if (plots->writer != NULL && plot_writer_stop(plots) != EXIT_SUCCESS) {
+        ret = EXIT_FAILURE;
+    }
+    while (plots->open_head != NULL) {
+        if (plot_close_oldest(plots) != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+        }
+    }
+    for (uint32_t i = 0; i < plots->count; i++) {
+        struct plot_output *out = &plots->outs[i];
+
+        if (out->file != NULL) {
+            free(out->file->name);
+            free(out->file);
+        }
+        free(out->buf);
+        cwnd_decimate_free(out->decim);
+    }
+    free(plots->outs);
+    memset(plots, 0, sizeof(*plots));
+    profile_leave(prev);
+    return ret;
+}
+
+#endif /* SIFTR_PLOT_H_ */
@@ -0,0 +1,178 @@
+/*
+ ============================================================================
+ Name        : siftr_profile.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Per-phase timers and counters of one run, for --profile
+ ============================================================================
+ */
+
+#ifndef SIFTR_PROFILE_H_
+#define SIFTR_PROFILE_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+enum profile_phase {
+    PROF_FIRST_LINE,
+    PROF_LAST_LINE,
+    PROF_FLOW_COUNT,
+    PROF_BODY,
+    PROF_INDEX,
+    PROF_PLOT,
+    PROF_FLUSH,
+    PROF_PHASES,
+};
+
+enum profile_counter {
+    PROF_BYTES_READ,
+    PROF_RECORDS,
+    PROF_MALFORMED,
+    PROF_HASH_PROBES,
+    PROF_OUTPUT_BYTES,
+    PROF_COUNTERS,
+};
+
+enum profile_format {
+    PROFILE_OFF,
+    PROFILE_TABLE,
+    PROFILE_JSON,
+};
+
+static const char *const profile_phase_names[PROF_PHASES] = {
+    "first_line", "last_line", "flow_count", "body", "index", "plot", "flush",
+};
+
+static const char *const profile_counter_names[PROF_COUNTERS] = {
+    "bytes_read", "records", "malformed_lines", "hash_probes", "output_bytes",
+};
+
+/*
+ * Time is charged to one phase at a time: entering a phase stops the clock
+ * of the one it is nested in, so the phases add up to the time they cover.
+ * The timers and counters belong to the main thread; worker threads keep
+ * their own counts and have them added once they are joined.
+ */
+struct run_profile {
+    double      start;
+    double      since;          /* when the current phase was entered */
+    int         cur;            /* current phase, -1 outside of all */
+    double      secs[PROF_PHASES];
+    uint64_t    counters[PROF_COUNTERS];
+};
+
+extern enum profile_format profile_format;
+extern struct run_profile run_profile;
+
+/* Set in threads that read whole logs of their own, they do not count */
+static _Thread_local bool profile_muted;
+
+static inline double
+profile_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void
+profile_init(void)
+{
+    memset(&run_profile, 0, sizeof(run_profile));
+    run_profile.start = run_profile.since = profile_now();
+    run_profile.cur = -1;
+}
+
+/* Start charging time to phase; returns what to hand to profile_leave(). */
+static inline int
+profile_enter(enum profile_phase phase)
+{
+    double now;
+    int prev;
+
+    if (profile_muted) {
+        return -1;
+    }
+    now = profile_now();
+    prev = run_profile.cur;
+    if (prev >= 0) {
+        run_profile.secs[prev] += now - run_profile.since;
+    }
+    run_profile.cur = phase;
+    run_profile.since = now;
+    return prev;
+}
+
+static inline void
+profile_leave(int prev)
+{
+    double now;
+
+    if (profile_muted) {
+        return;
+    }
+    now = profile_now();
+    if (run_profile.cur >= 0) {
+        run_profile.secs[run_profile.cur] += now - run_profile.since;
+    }
+    run_profile.cur = prev;
+    run_profile.since = now;
+}
+
+static inline void
+profile_count(enum profile_counter counter, uint64_t n)
+{
+    if (!profile_muted) {
+        run_profile.counters[counter] += n;
+    }
+}
+
+static inline void
+profile_report(void)
+{
+    double total = profile_now() - run_profile.start;
+    double other = total;
+
+    for (int p = 0; p < PROF_PHASES; p++) {
+        other -= run_profile.secs[p];
+    }
+
+    if (profile_format == PROFILE_JSON) {
+        printf("{\"total_secs\": %.6f, \"phases\": {", total);
+        for (int p = 0; p < PROF_PHASES; p++) {
+            printf("\"%s\": %.6f, ", profile_phase_names[p],
+                   run_profile.secs[p]);
+        }
+        printf("\"other\": %.6f}, \"counters\": {", other);
+        for (int c = 0; c < PROF_COUNTERS; c++) {
+            printf("%s\"%s\": %" PRIu64, (c > 0) ? ", " : "",
+                   profile_counter_names[c], run_profile.counters[c]);
+        }
+        printf("}}\n");
+        return;
+    }
+
+    printf("\nprofile:\n");
+    printf(" %-16s %12s %8s\n", "phase", "seconds", "share");
+    for (int p = 0; p < PROF_PHASES; p++) {
+        printf(" %-16s %12.6f %7.1f%%\n", profile_phase_names[p],
+               run_profile.secs[p],
+               (total > 0) ? 100.0 * run_profile.secs[p] / total : 0.0);
+    }
+    printf(" %-16s %12.6f %7.1f%%\n", "other", other,
+           (total > 0) ? 100.0 * other / total : 0.0);
+    printf(" %-16s %12.6f\n", "total", total);
+    printf(" %-16s %20s\n", "counter", "value");
+    for (int c = 0; c < PROF_COUNTERS; c++) {
+        printf(" %-16s %20" PRIu64 "\n", profile_counter_names[c],
+               run_profile.counters[c]);
+    }
+}
+
+#endif /* SIFTR_PROFILE_H_ */
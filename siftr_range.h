@@ -0,0 +1,184 @@
+/*
+ ============================================================================
+ Name        : siftr_range.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Time windows for --from/--to, and a sparse timestamp index
+               to find where a window starts in a mapped log
+ ============================================================================
+ */
+
+#ifndef SIFTR_RANGE_H_
+#define SIFTR_RANGE_H_
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    TIME_INDEX_STRIDE = 1024,   /* records between two marks */
+};
+
+/*
+ * The --from/--to options as given: seconds after the first record of the
+ * log, like the relative timestamps of the plot files, or a unix time if
+ * they are not before the enable_time of the head note.
+ */
+struct time_window {
+    bool        has_from;
+    bool        has_to;
+    int64_t     from_usec;
+    int64_t     to_usec;
+};
+
+extern struct time_window time_window;
+
+/* A record every TIME_INDEX_STRIDE, with the latest timestamp up to it */
+struct time_mark {
+    int64_t     usec;
+    uint64_t    offset;     /* of the record in the mapped log */
+};
+
+/* The marks of a mapped log, in file order, built by the body pass */
+struct time_index {
+    struct time_mark    *marks;
+    uint32_t            count;
+    uint32_t            cap;
+    uint32_t            stride;     /* 0 if the index is not built */
+    uint64_t            seen;       /* records looked at so far */
+};
+
+/* Parse a time such as "12.5" or "1700000012.5s", in seconds */
+static inline int
+parse_seconds(const char *arg, int64_t *usec)
+{
+    char *end;
+    double value;
+
+    errno = 0;
+    value = strtod(arg, &end);
+    if (errno != 0 || end == arg || (strcmp(end, "s") != 0 && *end != '\0')) {
+        return EXIT_FAILURE;
+    }
+    value = value * 1e6 + 0.5;
+    if (!(value >= 0 && value <= (double)INT64_MAX / 2)) {
+        return EXIT_FAILURE;
+    }
+    *usec = (int64_t)value;
+    return EXIT_SUCCESS;
+}
+
+static inline bool
+time_window_is_set(void)
+{
+    return time_window.has_from || time_window.has_to;
+}
+
+/*
+ * The absolute bounds of the window, both included. first_usec is the
+ * timestamp of the first record, enable_usec the one of the head note.
+ */
+static inline void
+time_window_bounds(int64_t first_usec, int64_t enable_usec, int64_t *lo,
+                   int64_t *hi)
+{
+    *lo = INT64_MIN;
+    *hi = INT64_MAX;
+    if (time_window.has_from) {
+        *lo = time_window.from_usec + ((time_window.from_usec >= enable_usec) ?
+                                       0 : first_usec);
+    }
+    if (time_window.has_to) {
+        *hi = time_window.to_usec + ((time_window.to_usec >= enable_usec) ?
+                                     0 : first_usec);
+    }
+}
+
+/* The first of n sorted timestamps that is not before lo */
+static inline uint64_t
+usec_lower_bound(const int64_t *ts, uint64_t n, int64_t lo)
+{
+    uint64_t low = 0, high = n;
+
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+
+        if (ts[mid] < lo) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static inline int
+time_index_push(struct time_index *ti, int64_t usec, uint64_t offset)
+{
+    if (ti->count == ti->cap) {
+        uint32_t cap = ti->cap ? ti->cap * 2 : 256;
+        struct time_mark *marks = (struct time_mark *)
+            realloc(ti->marks, cap * sizeof(struct time_mark));
+
+        if (marks == NULL) {
+            PERROR_FUNCTION("realloc failed for ti->marks");
+            return EXIT_FAILURE;
+        }
+        ti->marks = marks;
+        ti->cap = cap;
+    }
+    /* keep the marks sorted even if a record is a little out of order */
+    if (ti->count > 0 && usec < ti->marks[ti->count - 1].usec) {
+        usec = ti->marks[ti->count - 1].usec;
+    }
+    ti->marks[ti->count].usec = usec;
+    ti->marks[ti->count].offset = offset;
+    ti->count++;
+    return EXIT_SUCCESS;
+}
+
+/* Add the marks of src, a later part of the same log, after those of dst */
+static inline int
+time_index_append(struct time_index *dst, const struct time_index *src)
+{
+    for (uint32_t i = 0; i < src->count; i++) {
+        if (time_index_push(dst, src->marks[i].usec,
+                            src->marks[i].offset) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Offset of a record at or before the first one not before lo: the last mark
+ * whose records up to it are all before lo, or from if there is none.
+ */
+static inline uint64_t
+time_index_seek(const struct time_index *ti, int64_t lo, uint64_t from)
+{
+    uint32_t low = 0, high = ti->count;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+
+        if (ti->marks[mid].usec < lo) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return (low > 0) ? ti->marks[low - 1].offset : from;
+}
+
+static inline void
+time_index_free(struct time_index *ti)
+{
+    free(ti->marks);
+    memset(ti, 0, sizeof(*ti));
+}
+
+#endif /* SIFTR_RANGE_H_ */
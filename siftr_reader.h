@@ -0,0 +1,442 @@
+/*
+ ============================================================================
+ Name        : siftr_reader.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Zero-copy line reader for siftr logs, mmap backed
+ ============================================================================
+ */
+
+#ifndef SIFTR_READER_H_
+#define SIFTR_READER_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "siftr_decomp.h"
+
+enum {
+    READER_BUF_SIZE = (1 << 20),    /* initial size of the fallback buffer */
+    READER_BLOCK_SIZE = (1 << 20),  /* target size of a block of records */
+};
+
+/* A read-only view of one line, the line terminator is not included. */
+struct line_view {
+    const char  *ptr;
+    size_t      len;
+};
+
+/*
+ * The reader hands out views of the records between the head note and the
+ * foot note. A regular file is mapped as a whole, so a view points straight
+ * into the page cache and the foot note is located by its offset. Input that
+ * can not be mapped (pipes, sockets) falls back to buffered reads, where the
+ * foot note is found by holding back one line. A followed file is always
+ * read buffered, and a line is only handed out once its '\n' has been
+ * written. A compressed file is read buffered from its decompressor; as it
+ * can not be seeked in, copies of the head and the foot note are kept as
+ * they go by.
+ */
+struct log_reader {
+    FILE        *file;
+    bool        is_mapped;
+    /* mmap mode */
+    const char  *map;
+    size_t      map_size;
+    size_t      pos;            /* offset of the next unread byte */
+    size_t      body_start;     /* offset of the first record */
+    size_t      footer_start;   /* offset of the foot note */
+    /* buffered fallback mode */
+    char        *buf;
+    size_t      buf_size;
+    size_t      buf_len;        /* valid bytes in buf */
+    size_t      buf_pos;        /* offset of the next unread byte in buf */
+    size_t      pending_off;    /* held back line, as an offset into buf */
+    size_t      pending_len;
+    size_t      pending_raw_len;    /* including the line terminator */
+    bool        has_pending;
+    bool        eof;
+    bool        follow;         /* the file may still grow, never stop at EOF */
+    bool        is_at_body;     /* rewound, and no record taken yet */
+    bool        is_damaged;     /* the decompressor gave up */
+    struct decomp_stream *decomp;   /* NULL unless the file is compressed */
+    char        *head_note;     /* buffered mode, NULL until seen */
+    char        *foot_note;
+    uint64_t    bytes_read;     /* for --profile */
+};
+
+static inline size_t
+strip_cr(const char *ptr, size_t len)
+{
+    if (len > 0 && ptr[len - 1] == '\r') {
+        len--;
+    }
+    return len;
+}
+
+/* Find the offsets of the first record and of the foot note in the mapping */
+static inline void
+reader_locate_body(struct log_reader *reader)
+{
+    const char *map = reader->map;
+    size_t end = reader->map_size;
+    const char *nl;
+
+    nl = memchr(map, '\n', end);
+    reader->body_start = (nl == NULL) ? end : (size_t)(nl - map) + 1;
+
+    /* ignore the terminator(s) of the last line */
+    while (end > reader->body_start &&
+           (map[end - 1] == '\n' || map[end - 1] == '\r')) {
+        end--;
+    }
+    nl = (end > reader->body_start) ?
+         memrchr(map + reader->body_start, '\n', end - reader->body_start) :
+         NULL;
+    reader->footer_start = (nl == NULL) ? reader->body_start :
+                                          (size_t)(nl - map) + 1;
+}
+
+int
+reader_open(struct log_reader *reader, FILE *file)
+{
+    struct stat st;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->file = file;
+
+    if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+                         fileno(file), 0);
+        if (map != MAP_FAILED) {
+            if (madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL) != 0) {
+                PERROR_FUNCTION("madvise");
+            }
+            reader->map = map;
+            reader->map_size = (size_t)st.st_size;
+            reader->is_mapped = true;
+            reader_locate_body(reader);
+            reader->pos = reader->body_start;
+            return EXIT_SUCCESS;
+        }
+        PERROR_FUNCTION("mmap failed, fall back to buffered reads");
+    }
+
+    reader->buf_size = READER_BUF_SIZE;
+    reader->buf = (char *)malloc(reader->buf_size);
+    if (reader->buf == NULL) {
+        PERROR_FUNCTION("malloc failed for reader->buf");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Open a file that is still being written, in buffered mode. */
+int
+reader_open_follow(struct log_reader *reader, FILE *file)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->file = file;
+    reader->follow = true;
+
+    reader->buf_size = READER_BUF_SIZE;
+    reader->buf = (char *)malloc(reader->buf_size);
+    if (reader->buf == NULL) {
+        PERROR_FUNCTION("malloc failed for reader->buf");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Open a compressed file, read through a decompression thread. */
+int
+reader_open_decomp(struct log_reader *reader, FILE *file, enum decomp_kind kind)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->file = file;
+
+    reader->buf_size = READER_BUF_SIZE;
+    reader->buf = (char *)malloc(reader->buf_size);
+    if (reader->buf == NULL) {
+        PERROR_FUNCTION("malloc failed for reader->buf");
+        return EXIT_FAILURE;
+    }
+    reader->decomp = decomp_open(file, kind);
+    if (reader->decomp == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* True if the input can only be read from the start, in one go. */
+static inline bool
+reader_is_stream(const struct log_reader *reader)
+{
+    return reader->decomp != NULL;
+}
+
+/* Keep a copy of a head or foot note line. */
+static inline void
+reader_keep_note(char **note, const char *line, size_t len)
+{
+    free(*note);
+    *note = strndup(line, len);
+    if (*note == NULL) {
+        PERROR_FUNCTION("strndup failed for a note");
+    }
+}
+
+/* Slide the unread data to the front of the buffer and read more input. */
+static inline bool
+reader_fill(struct log_reader *reader)
+{
+    size_t keep_from = reader->buf_pos;
+    size_t nread;
+
+    if (reader->eof) {
+        return false;
+    }
+    if (reader->has_pending && reader->pending_off < keep_from) {
+        keep_from = reader->pending_off;
+    }
+    if (keep_from > 0) {
+        memmove(reader->buf, reader->buf + keep_from,
+                reader->buf_len - keep_from);
+        reader->buf_len -= keep_from;
+        reader->buf_pos -= keep_from;
+        reader->pending_off -= reader->has_pending ? keep_from : 0;
+    }
+    if (reader->buf_len == reader->buf_size) {
+        char *bigger = (char *)realloc(reader->buf, reader->buf_size * 2);
+        if (bigger == NULL) {
+            PERROR_FUNCTION("realloc failed for reader->buf");
+            return false;
+        }
+        reader->buf = bigger;
+        reader->buf_size *= 2;
+    }
+
+    if (reader->decomp != NULL) {
+        bool failed = false;
+
+        nread = decomp_read(reader->decomp, reader->buf + reader->buf_len,
+                            reader->buf_size - reader->buf_len, &failed);
+        if (failed && !reader->is_damaged) {
+            PERROR_FUNCTION("the compressed log is damaged");
+            reader->is_damaged = true;
+        }
+    } else {
+        nread = fread(reader->buf + reader->buf_len, 1,
+                      reader->buf_size - reader->buf_len, reader->file);
+    }
+    if (nread == 0) {
+        if (reader->follow) {
+            /* no more data for now, try again later */
+            clearerr(reader->file);
+        } else {
+            reader->eof = true;
+        }
+        return false;
+    }
+    reader->buf_len += nread;
+    reader->bytes_read += nread;
+    return true;
+}
+
+/* Get the next raw line from the fallback buffer, as offsets into it. */
+static inline bool
+reader_next_buffered_line(struct log_reader *reader, size_t *off, size_t *len,
+                          size_t *raw_len)
+{
+    for (;;) {
+        char *start = reader->buf + reader->buf_pos;
+        size_t avail = reader->buf_len - reader->buf_pos;
+        char *nl = memchr(start, '\n', avail);
+
+        if (nl != NULL) {
+            *off = reader->buf_pos;
+            *len = strip_cr(start, (size_t)(nl - start));
+            *raw_len = (size_t)(nl - start) + 1;
+            reader->buf_pos += *raw_len;
+            return true;
+        }
+        if (!reader_fill(reader)) {
+            if (avail == 0 || reader->follow) {
+                /* a partial line may still be completed */
+                return false;
+            }
+            /* the last line has no terminator */
+            *off = reader->buf_pos;
+            *len = strip_cr(start, avail);
+            *raw_len = avail;
+            reader->buf_pos = reader->buf_len;
+            return true;
+        }
+    }
+}
+
+/* Position the reader at the first record, right after the head note. */
+int
+reader_rewind_body(struct log_reader *reader)
+{
+    size_t off, len, raw_len;
+
+    if (reader->is_mapped) {
+        reader->pos = reader->body_start;
+        return EXIT_SUCCESS;
+    }
+    if (reader->is_at_body) {
+        /* a stream would have to be read again from the start */
+        return EXIT_SUCCESS;
+    }
+
+    if (reader->decomp != NULL) {
+        if (decomp_rewind(reader->decomp) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    } else if (fseek(reader->file, 0, SEEK_SET) != 0) {
+        PERROR_FUNCTION("input is not seekable");
+        return EXIT_FAILURE;
+    }
+    reader->buf_len = reader->buf_pos = 0;
+    reader->has_pending = reader->eof = reader->is_damaged = false;
+
+    /* keep the head note, then hold back the first line */
+    if (!reader_next_buffered_line(reader, &off, &len, &raw_len)) {
+        PERROR_FUNCTION("Failed to read first line");
+        return EXIT_FAILURE;
+    }
+    reader_keep_note(&reader->head_note, reader->buf + off, len);
+    reader->is_at_body = true;
+    if (reader_next_buffered_line(reader, &off, &len, &raw_len)) {
+        reader->pending_off = off;
+        reader->pending_len = len;
+        reader->pending_raw_len = raw_len;
+        reader->has_pending = true;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Hold back the next line and return the previous one, if any. */
+static inline bool
+reader_advance_pending(struct log_reader *reader, struct line_view *line,
+                       size_t *raw_len)
+{
+    size_t off, len, next_raw_len;
+
+    if (!reader->has_pending) {
+        return false;
+    }
+    reader->is_at_body = false;
+    if (!reader_next_buffered_line(reader, &off, &len, &next_raw_len)) {
+        /* the held back line is the foot note, unless the input broke off */
+        if (!reader->is_damaged) {
+            reader_keep_note(&reader->foot_note,
+                             reader->buf + reader->pending_off,
+                             reader->pending_len);
+        }
+        reader->has_pending = false;
+        return false;
+    }
+    line->ptr = reader->buf + reader->pending_off;
+    line->len = reader->pending_len;
+    *raw_len = reader->pending_raw_len;
+    reader->pending_off = off;
+    reader->pending_len = len;
+    reader->pending_raw_len = next_raw_len;
+    return true;
+}
+
+/*
+ * Get the next record of the body. The view stays valid until the next call
+ * on the same reader. Returns false when the foot note is reached.
+ */
+bool
+reader_next_record(struct log_reader *reader, struct line_view *record)
+{
+    if (reader->is_mapped) {
+        const char *start = reader->map + reader->pos;
+        const char *nl;
+
+        if (reader->pos >= reader->footer_start) {
+            return false;
+        }
+        nl = memchr(start, '\n', reader->footer_start - reader->pos);
+        /* a record before the foot note is always terminated */
+        record->ptr = start;
+        record->len = strip_cr(start, (size_t)(nl - start));
+        reader->pos += (size_t)(nl - start) + 1;
+        reader->bytes_read += (size_t)(nl - start) + 1;
+        return true;
+    } else {
+        size_t raw_len;
+
+        return reader_advance_pending(reader, record, &raw_len);
+    }
+}
+
+/*
+ * Get a block of whole records, each one still carrying its '\n', so that the
+ * block can be split in one pass. The view stays valid until the next call.
+ */
+bool
+reader_next_block(struct log_reader *reader, struct line_view *block)
+{
+    if (reader->is_mapped) {
+        size_t left = reader->footer_start - reader->pos;
+        const char *start = reader->map + reader->pos;
+        const char *nl;
+
+        if (left == 0) {
+            return false;
+        }
+        if (left > READER_BLOCK_SIZE) {
+            /* end the block at the last record that fits */
+            nl = memrchr(start, '\n', READER_BLOCK_SIZE);
+            if (nl == NULL) {
+                nl = memchr(start + READER_BLOCK_SIZE, '\n',
+                            left - READER_BLOCK_SIZE);
+            }
+            left = (size_t)(nl - start) + 1;
+        }
+        block->ptr = start;
+        block->len = left;
+        reader->pos += left;
+        reader->bytes_read += left;
+        return true;
+    } else {
+        size_t raw_len;
+
+        if (!reader_advance_pending(reader, block, &raw_len)) {
+            return false;
+        }
+        block->len = raw_len;
+        return true;
+    }
+}
+
+void
+reader_close(struct log_reader *reader)
+{
+    if (reader->is_mapped) {
+        if (munmap((void *)reader->map, reader->map_size) != 0) {
+            PERROR_FUNCTION("munmap");
+        }
+    }
+    free(reader->buf);
+    decomp_close(reader->decomp);
+    free(reader->head_note);
+    free(reader->foot_note);
+    profile_count(PROF_BYTES_READ, reader->bytes_read);
+    memset(reader, 0, sizeof(*reader));
+}
+
+#endif /* SIFTR_READER_H_ */
@@ -0,0 +1,226 @@
+/*
+ ============================================================================
+ Name        : siftr_split.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Vectorized comma/newline scanner for siftr records
+ ============================================================================
+ */
+
+#ifndef SIFTR_SPLIT_H_
+#define SIFTR_SPLIT_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPLIT_HAVE_X86  1
+#endif
+
+enum {
+    SPLIT_WINDOW = 4096,        /* bytes classified per kernel call */
+    RECORD_BATCH_SIZE = 256,    /* records split per batch */
+};
+
+/*
+ * A kernel sets bit (i % 64) of bits[i / 64] for every ',' or '\n' at p[i].
+ * The caller provides (len + 63) / 64 words; they are cleared here.
+ */
+typedef void (*delim_bitmap_fn)(const char *p, size_t len, uint64_t *bits);
+
+static void
+delim_bitmap_scalar(const char *p, size_t len, uint64_t *bits)
+{
+    memset(bits, 0, ((len + 63) / 64) * sizeof(*bits));
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == ',' || p[i] == '\n') {
+            bits[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }
+}
+
+#ifdef SPLIT_HAVE_X86
+__attribute__((target("sse2"))) static void
+delim_bitmap_sse2(const char *p, size_t len, uint64_t *bits)
+{
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t i = 0;
+
+    memset(bits, 0, ((len + 63) / 64) * sizeof(*bits));
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, comma),
+                                   _mm_cmpeq_epi8(v, newline));
+        uint64_t m = (uint32_t)_mm_movemask_epi8(hit);
+        bits[i / 64] |= m << (i % 64);
+    }
+    for (; i < len; i++) {
+        if (p[i] == ',' || p[i] == '\n') {
+            bits[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }
+}
+
+__attribute__((target("avx2"))) static void
+delim_bitmap_avx2(const char *p, size_t len, uint64_t *bits)
+{
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t i = 0;
+
+    memset(bits, 0, ((len + 63) / 64) * sizeof(*bits));
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, comma),
+                                      _mm256_cmpeq_epi8(v, newline));
+        uint64_t m = (uint32_t)_mm256_movemask_epi8(hit);
+        bits[i / 64] |= m << (i % 64);
+    }
+    for (; i < len; i++) {
+        if (p[i] == ',' || p[i] == '\n') {
+            bits[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }
+}
+#endif /* SPLIT_HAVE_X86 */
+
+/* Pick the widest kernel the running CPU supports, once. */
+static inline delim_bitmap_fn
+get_delim_bitmap(const char **name)
+{
+    static delim_bitmap_fn kernel = NULL;
+    static const char *kernel_name = NULL;
+
+    if (kernel == NULL) {
+        kernel = delim_bitmap_scalar;
+        kernel_name = "scalar";
+#ifdef SPLIT_HAVE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            kernel = delim_bitmap_avx2;
+            kernel_name = "avx2";
+        } else if (__builtin_cpu_supports("sse2")) {
+            kernel = delim_bitmap_sse2;
+            kernel_name = "sse2";
+        }
+#endif
+    }
+    if (name != NULL) {
+        *name = kernel_name;
+    }
+    return kernel;
+}
+
+/*
+ * Close the current record: the last field ends at line_len. The callers
+ * count the records with field_cnt != TOTAL_FIELDS as malformed.
+ */
+static inline void
+finish_record(struct record_fields *rf, uint32_t field_cnt, size_t line_len)
+{
+    if (line_len > 0 && rf->line[line_len - 1] == '\r') {
+        line_len--;
+    }
+    if (line_len >= UINT16_MAX) {
+        /* the field starts do not fit in 16 bits */
+        rf->field_cnt = 0;
+        return;
+    }
+    rf->field_cnt = field_cnt;
+    rf->start[field_cnt < TOTAL_FIELDS ? field_cnt : TOTAL_FIELDS] =
+        (uint16_t)(line_len + 1);
+}
+
+/*
+ * Split the '\n' terminated records at the front of data into rfs, at most
+ * max_records of them. A trailing partial line is left alone. Sets *consumed
+ * to the bytes covered by the returned records.
+ */
+size_t
+split_records(const char *data, size_t len, struct record_fields *rfs,
+              size_t max_records, size_t *consumed)
+{
+    delim_bitmap_fn kernel = get_delim_bitmap(NULL);
+    uint64_t bits[SPLIT_WINDOW / 64];
+    size_t nrecords = 0;
+    size_t line_start = 0;
+    uint32_t field_cnt = 1;
+
+    *consumed = 0;
+    if (max_records == 0) {
+        return 0;
+    }
+    rfs[0].line = data;
+    rfs[0].start[0] = 0;
+
+    for (size_t base = 0; base < len; base += SPLIT_WINDOW) {
+        size_t window = (len - base < SPLIT_WINDOW) ? len - base : SPLIT_WINDOW;
+
+        kernel(data + base, window, bits);
+        for (size_t w = 0; w < (window + 63) / 64; w++) {
+            uint64_t mask = bits[w];
+
+            while (mask != 0) {
+                size_t pos = base + w * 64 + (size_t)__builtin_ctzll(mask);
+                struct record_fields *rf = &rfs[nrecords];
+
+                mask &= mask - 1;
+                if (data[pos] == ',') {
+                    if (field_cnt < TOTAL_FIELDS) {
+                        rf->start[field_cnt] = (uint16_t)(pos - line_start + 1);
+                    }
+                    field_cnt++;
+                    continue;
+                }
+
+                finish_record(rf, field_cnt, pos - line_start);
+                nrecords++;
+                line_start = pos + 1;
+                *consumed = line_start;
+                if (nrecords == max_records) {
+                    return nrecords;
+                }
+                field_cnt = 1;
+                rfs[nrecords].line = data + line_start;
+                rfs[nrecords].start[0] = 0;
+            }
+        }
+    }
+
+    return nrecords;
+}
+
+/* Split one record, which carries no line terminator. */
+bool
+split_fields(const char *line, size_t len, struct record_fields *rf)
+{
+    delim_bitmap_fn kernel = get_delim_bitmap(NULL);
+    uint64_t bits[SPLIT_WINDOW / 64];
+    uint32_t field_cnt = 1;
+
+    rf->line = line;
+    rf->start[0] = 0;
+    for (size_t base = 0; base < len; base += SPLIT_WINDOW) {
+        size_t window = (len - base < SPLIT_WINDOW) ? len - base : SPLIT_WINDOW;
+
+        kernel(line + base, window, bits);
+        for (size_t w = 0; w < (window + 63) / 64; w++) {
+            for (uint64_t mask = bits[w]; mask != 0; mask &= mask - 1) {
+                size_t pos = base + w * 64 + (size_t)__builtin_ctzll(mask);
+
+                if (field_cnt < TOTAL_FIELDS) {
+                    rf->start[field_cnt] = (uint16_t)(pos + 1);
+                }
+                field_cnt++;
+            }
+        }
+    }
+    finish_record(rf, field_cnt, len);
+
+    return rf->field_cnt == TOTAL_FIELDS;
+}
+
+#endif /* SIFTR_SPLIT_H_ */
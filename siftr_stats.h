@@ -0,0 +1,374 @@
+/*
+ ============================================================================
+ Name        : siftr_stats.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Streaming per-flow aggregates with a mergeable quantile sketch
+ ============================================================================
+ */
+
+#ifndef SIFTR_STATS_H_
+#define SIFTR_STATS_H_
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum {
+    METRIC_CWND,
+    METRIC_SRTT,
+    METRIC_RTO,
+    METRIC_INFLIGHT,
+    METRIC_SNDWIN,
+    METRIC_RCVWIN,
+    METRIC_SND_BUF_CC,
+    METRIC_COUNT,
+};
+
+static const char *const metric_names[METRIC_COUNT] = {
+    "cwnd", "srtt", "rto", "inflight", "sndwin", "rcvwin", "snd_buf_cc",
+};
+
+enum {
+    SKETCH_SUB_BITS = 6,        /* 64 bins per power of two, <= 1.6% wide */
+    SKETCH_SUB_BINS = (1 << SKETCH_SUB_BITS),
+    SKETCH_MIN_BINS = 64,
+    SKETCH_MAX_BINS = 1024,     /* 16 powers of two at full resolution */
+};
+
+/*
+ * A log-linear histogram of unsigned values. Values below 64 have a bin of
+ * their own, larger ones fall in one of 64 equal bins per power of two, so a
+ * quantile is off by less than 1% of its value. The bins are kept for a
+ * window of indexes that grows as needed; past SKETCH_MAX_BINS the lowest
+ * bins are folded together, which keeps the upper quantiles exact. Two
+ * sketches merge by adding their bins, so per-thread sketches combine.
+ */
+struct stat_sketch {
+    uint32_t    *bins;
+    int32_t     lo;             /* index of bins[0] */
+    uint32_t    cap;
+    uint64_t    count;
+};
+
+static inline int32_t
+sketch_index(uint64_t value)
+{
+    int exp;
+
+    if (value < SKETCH_SUB_BINS) {
+        return (int32_t)value;
+    }
+    exp = 63 - __builtin_clzll(value);
+    return ((exp - SKETCH_SUB_BITS + 1) << SKETCH_SUB_BITS) +
+           (int32_t)((value >> (exp - SKETCH_SUB_BITS)) & (SKETCH_SUB_BINS - 1));
+}
+
+/* The middle of the values of a bin. */
+static inline uint64_t
+sketch_value(int32_t idx)
+{
+    int shift;
+
+    if (idx < SKETCH_SUB_BINS) {
+        return (uint64_t)idx;
+    }
+    shift = (idx >> SKETCH_SUB_BITS) - 1;
+    return (((uint64_t)SKETCH_SUB_BINS + (idx & (SKETCH_SUB_BINS - 1))) << shift) +
+           ((1ULL << shift) >> 1);
+}
+
+/* Move the window so that it holds idx, folding the lowest bins if needed. */
+static inline int
+sketch_extend(struct stat_sketch *sk, int32_t idx)
+{
+    int32_t old_hi = sk->lo + (int32_t)sk->cap - 1;
+    int32_t lo = (sk->cap == 0 || idx < sk->lo) ? idx : sk->lo;
+    int32_t hi = (sk->cap == 0 || idx > old_hi) ? idx : old_hi;
+    uint32_t cap = SKETCH_MIN_BINS;
+    uint32_t *bins;
+
+    while (cap < (uint32_t)(hi - lo + 1) && cap < SKETCH_MAX_BINS) {
+        cap *= 2;
+    }
+    /* the room to spare goes the way the window is growing */
+    if (sk->cap > 0 && idx < sk->lo) {
+        lo = hi - (int32_t)cap + 1;
+    } else {
+        hi = lo + (int32_t)cap - 1;
+        if (hi < idx) {
+            lo = idx - (int32_t)cap + 1;
+        }
+    }
+
+    bins = (uint32_t *)calloc(cap, sizeof(uint32_t));
+    if (bins == NULL) {
+        PERROR_FUNCTION("calloc failed for sketch bins");
+        return EXIT_FAILURE;
+    }
+    for (uint32_t i = 0; i < sk->cap; i++) {
+        int32_t old = sk->lo + (int32_t)i;
+
+        bins[(old < lo) ? 0 : old - lo] += sk->bins[i];
+    }
+    free(sk->bins);
+    sk->bins = bins;
+    sk->lo = lo;
+    sk->cap = cap;
+    return EXIT_SUCCESS;
+}
+
+static inline void
+sketch_add_n(struct stat_sketch *sk, int32_t idx, uint32_t n)
+{
+    if ((uint32_t)(idx - sk->lo) >= sk->cap &&
+        (idx > sk->lo || sk->cap < SKETCH_MAX_BINS) &&
+        sketch_extend(sk, idx) != EXIT_SUCCESS) {
+        return;
+    }
+    /* below a full window, the lowest bin takes it */
+    sk->bins[(idx < sk->lo) ? 0 : idx - sk->lo] += n;
+    sk->count += n;
+}
+
+static inline void
+sketch_add(struct stat_sketch *sk, uint64_t value)
+{
+    sketch_add_n(sk, sketch_index(value), 1);
+}
+
+static inline void
+sketch_merge(struct stat_sketch *dst, const struct stat_sketch *src)
+{
+    for (uint32_t i = 0; i < src->cap; i++) {
+        if (src->bins[i] != 0) {
+            sketch_add_n(dst, src->lo + (int32_t)i, src->bins[i]);
+        }
+    }
+}
+
+/* The value at quantile q, 0 <= q <= 1. */
+static inline uint64_t
+sketch_quantile(const struct stat_sketch *sk, double q)
+{
+    uint64_t rank = (uint64_t)(q * (double)(sk->count - 1));
+    uint64_t seen = 0;
+
+    if (sk->count == 0) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < sk->cap; i++) {
+        seen += sk->bins[i];
+        if (seen > rank) {
+            return sketch_value(sk->lo + (int32_t)i);
+        }
+    }
+    return sketch_value(sk->lo + (int32_t)sk->cap - 1);
+}
+
+/*
+ * Running aggregates of one metric. Per sample: min, max and sum. Over time:
+ * every value is taken to hold until the next record of the flow, so
+ * time_sum / duration is the time-weighted mean.
+ */
+struct metric_agg {
+    uint64_t            min;
+    uint64_t            max;
+    double              sum;
+    double              time_sum;   /* value x usecs it held */
+    uint64_t            last;
+    struct stat_sketch  sketch;
+};
+
+struct flow_stats {
+    uint64_t            count;
+    int64_t             first_usec;
+    int64_t             last_usec;
+    struct metric_agg   metrics[METRIC_COUNT];
+};
+
+static inline void
+flow_stats_add(struct flow_stats *st, int64_t usec,
+               const uint64_t values[METRIC_COUNT])
+{
+    int64_t held = 0;
+
+    if (st->count == 0) {
+        st->first_usec = st->last_usec = usec;
+        for (int m = 0; m < METRIC_COUNT; m++) {
+            st->metrics[m].min = UINT64_MAX;
+        }
+    } else if (usec > st->last_usec) {
+        held = usec - st->last_usec;
+        st->last_usec = usec;
+    }
+
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        struct metric_agg *agg = &st->metrics[m];
+        uint64_t value = values[m];
+
+        agg->time_sum += (double)agg->last * (double)held;
+        agg->min = (value < agg->min) ? value : agg->min;
+        agg->max = (value > agg->max) ? value : agg->max;
+        agg->sum += (double)value;
+        agg->last = value;
+        sketch_add(&agg->sketch, value);
+    }
+    st->count++;
+}
+
+/*
+ * flow_stats_add() of rows records at once, from a column per metric. Each
+ * metric takes its own passes over its column: min and max in one that the
+ * compiler can vectorize, the sums in file order so that they come out the
+ * same as adding the records one by one.
+ */
+static inline int
+flow_stats_add_columns(struct flow_stats *st, const int64_t *usec,
+                       const uint32_t *const values[METRIC_COUNT], uint32_t rows)
+{
+    int64_t *held;
+    int64_t last_usec;
+
+    if (rows == 0) {
+        return EXIT_SUCCESS;
+    }
+    held = (int64_t *)malloc(rows * sizeof(int64_t));
+    if (held == NULL) {
+        PERROR_FUNCTION("malloc failed for held");
+        return EXIT_FAILURE;
+    }
+    if (st->count == 0) {
+        st->first_usec = st->last_usec = usec[0];
+        for (int m = 0; m < METRIC_COUNT; m++) {
+            st->metrics[m].min = UINT64_MAX;
+        }
+    }
+    last_usec = st->last_usec;
+    for (uint32_t r = 0; r < rows; r++) {
+        held[r] = (usec[r] > last_usec) ? usec[r] - last_usec : 0;
+        last_usec = (usec[r] > last_usec) ? usec[r] : last_usec;
+    }
+    st->last_usec = last_usec;
+
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        struct metric_agg *agg = &st->metrics[m];
+        const uint32_t *col = values[m];
+        uint32_t lo = UINT32_MAX, hi = 0;
+        uint64_t last = agg->last;
+        double sum = agg->sum, time_sum = agg->time_sum;
+
+        for (uint32_t r = 0; r < rows; r++) {
+            lo = (col[r] < lo) ? col[r] : lo;
+            hi = (col[r] > hi) ? col[r] : hi;
+        }
+        for (uint32_t r = 0; r < rows; r++) {
+            time_sum += (double)last * (double)held[r];
+            sum += (double)col[r];
+            last = col[r];
+        }
+        for (uint32_t r = 0; r < rows; r++) {
+            sketch_add(&agg->sketch, col[r]);
+        }
+        agg->min = (lo < agg->min) ? lo : agg->min;
+        agg->max = (hi > agg->max) ? hi : agg->max;
+        agg->sum = sum;
+        agg->time_sum = time_sum;
+        agg->last = last;
+    }
+    st->count += rows;
+    free(held);
+    return EXIT_SUCCESS;
+}
+
+/* Fold the stats of later records of the same flow, src, into dst. */
+static inline void
+flow_stats_merge(struct flow_stats *dst, const struct flow_stats *src)
+{
+    int64_t gap;
+
+    if (src->count == 0) {
+        return;
+    }
+    if (dst->count == 0) {
+        /* an empty dst has empty sketches */
+        for (int m = 0; m < METRIC_COUNT; m++) {
+            struct stat_sketch sketch = dst->metrics[m].sketch;
+
+            dst->metrics[m] = src->metrics[m];
+            dst->metrics[m].sketch = sketch;
+            sketch_merge(&dst->metrics[m].sketch, &src->metrics[m].sketch);
+        }
+        dst->count = src->count;
+        dst->first_usec = src->first_usec;
+        dst->last_usec = src->last_usec;
+        return;
+    }
+
+    /* the last value of dst holds until the first record of src */
+    gap = (src->first_usec > dst->last_usec) ?
+          src->first_usec - dst->last_usec : 0;
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        struct metric_agg *agg = &dst->metrics[m];
+        const struct metric_agg *from = &src->metrics[m];
+
+        agg->time_sum += (double)agg->last * (double)gap + from->time_sum;
+        agg->min = (from->min < agg->min) ? from->min : agg->min;
+        agg->max = (from->max > agg->max) ? from->max : agg->max;
+        agg->sum += from->sum;
+        agg->last = from->last;
+        sketch_merge(&agg->sketch, &from->sketch);
+    }
+    dst->count += src->count;
+    if (src->last_usec > dst->last_usec) {
+        dst->last_usec = src->last_usec;
+    }
+}
+
+static inline void
+flow_stats_free(struct flow_stats *st)
+{
+    if (st != NULL) {
+        for (int m = 0; m < METRIC_COUNT; m++) {
+            free(st->metrics[m].sketch.bins);
+        }
+        free(st);
+    }
+}
+
+/* A quantile of the sketch, kept within the exact min and max */
+static inline uint64_t
+metric_quantile(const struct metric_agg *agg, double q)
+{
+    uint64_t value = sketch_quantile(&agg->sketch, q);
+
+    return (value < agg->min) ? agg->min :
+           (value > agg->max) ? agg->max : value;
+}
+
+static inline void
+show_flow_stats(uint32_t flowid, const struct flow_stats *st)
+{
+    double duration = (double)(st->last_usec - st->first_usec);
+
+    printf(" flowid:%10u samples:%" PRIu64 " duration:%.6f seconds\n",
+           flowid, st->count, duration / 1000000.0);
+    printf("   %-10s %12s %12s %14s %14s %12s %12s %12s\n", "metric",
+           "min", "max", "mean", "time_mean", "p50", "p95", "p99");
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        const struct metric_agg *agg = &st->metrics[m];
+        double mean = agg->sum / (double)st->count;
+
+        printf("   %-10s %12" PRIu64 " %12" PRIu64 " %14.2f %14.2f %12" PRIu64
+               " %12" PRIu64 " %12" PRIu64 "\n", metric_names[m],
+               agg->min, agg->max, mean,
+               (duration > 0) ? agg->time_sum / duration : mean,
+               metric_quantile(agg, 0.50),
+               metric_quantile(agg, 0.95),
+               metric_quantile(agg, 0.99));
+    }
+}
+
+#endif /* SIFTR_STATS_H_ */
@@ -0,0 +1,153 @@
+/*
+ ============================================================================
+ Name        : siftr_tflags.h
+ Author      : Cheng Cui
+ Version     :
+ Copyright   : see the LICENSE file
+ Description : Table driven decoding of tp->t_flags and tp->t_flags2
+ ============================================================================
+ */
+
+#ifndef SIFTR_TFLAGS_H_
+#define SIFTR_TFLAGS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+enum {
+    TFLAGS_BITS = 32,
+    TFLAGS_CACHE_BITS = 6,      /* of the hash that picks the cache slot */
+    TFLAGS_CACHE_SIZE = 1 << TFLAGS_CACHE_BITS, /* flag words kept decoded */
+};
+
+/* t_flags2 goes above t_flags, so one XOR or AND covers both words */
+#define TFLAGS_STATE(t_flags, t_flags2) \
+    ((uint64_t)(t_flags2) << 32 | (uint32_t)(t_flags))
+
+/* The name of one flag bit, as it is printed: "NAME | " */
+struct tflag_name {
+    const char  *str;
+    uint8_t     len;
+};
+
+#define TFLAG_NAME(name)    { #name " | ", sizeof(#name " | ") - 1 }
+
+/* indexed by bit number, the unnamed bits are skipped */
+static const struct tflag_name tflags_names[TFLAGS_BITS] = {
+    TFLAG_NAME(TF_ACKNOW),          TFLAG_NAME(TF_DELACK),
+    TFLAG_NAME(TF_NODELAY),         TFLAG_NAME(TF_NOOPT),
+    TFLAG_NAME(TF_SENTFIN),         TFLAG_NAME(TF_REQ_SCALE),
+    TFLAG_NAME(TF_RCVD_SCALE),      TFLAG_NAME(TF_REQ_TSTMP),
+    TFLAG_NAME(TF_RCVD_TSTMP),      TFLAG_NAME(TF_SACK_PERMIT),
+    TFLAG_NAME(TF_NEEDSYN),         TFLAG_NAME(TF_NEEDFIN),
+    TFLAG_NAME(TF_NOPUSH),          TFLAG_NAME(TF_PREVVALID),
+    TFLAG_NAME(TF_WAKESOR),         TFLAG_NAME(TF_GPUTINPROG),
+    TFLAG_NAME(TF_MORETOCOME),      TFLAG_NAME(TF_SONOTCONN),
+    TFLAG_NAME(TF_LASTIDLE),        TFLAG_NAME(TF_RXWIN0SENT),
+    TFLAG_NAME(TF_FASTRECOVERY),    TFLAG_NAME(TF_WASFRECOVERY),
+    TFLAG_NAME(TF_SIGNATURE),       TFLAG_NAME(TF_FORCEDATA),
+    TFLAG_NAME(TF_TSO),             TFLAG_NAME(TF_TOE),
+    TFLAG_NAME(TF_CLOSED),          TFLAG_NAME(TF_SENTSYN),
+    TFLAG_NAME(TF_LRD),             TFLAG_NAME(TF_CONGRECOVERY),
+    TFLAG_NAME(TF_WASCRECOVERY),    TFLAG_NAME(TF_FASTOPEN),
+};
+
+static const struct tflag_name tflags2_names[TFLAGS_BITS] = {
+    TFLAG_NAME(TF2_PLPMTU_BLACKHOLE),   TFLAG_NAME(TF2_PLPMTU_PMTUD),
+    TFLAG_NAME(TF2_PLPMTU_MAXSEGSNT),   TFLAG_NAME(TF2_LOG_AUTO),
+    TFLAG_NAME(TF2_DROP_AF_DATA),       TFLAG_NAME(TF2_ECN_PERMIT),
+    TFLAG_NAME(TF2_ECN_SND_CWR),        TFLAG_NAME(TF2_ECN_SND_ECE),
+    TFLAG_NAME(TF2_ACE_PERMIT),         TFLAG_NAME(TF2_HPTS_CPU_SET),
+    TFLAG_NAME(TF2_FBYTES_COMPLETE),    TFLAG_NAME(TF2_ECN_USE_ECT1),
+    TFLAG_NAME(TF2_TCP_ACCOUNTING),     TFLAG_NAME(TF2_HPTS_CALLS),
+    TFLAG_NAME(TF2_MBUF_L_ACKS),        TFLAG_NAME(TF2_MBUF_ACKCMP),
+    TFLAG_NAME(TF2_SUPPORTS_MBUFQ),     TFLAG_NAME(TF2_MBUF_QUEUE_READY),
+    TFLAG_NAME(TF2_DONT_SACK_QUEUE),    TFLAG_NAME(TF2_CANNOT_DO_ECN),
+    TFLAG_NAME(TF2_PROC_SACK_PROHIBIT), TFLAG_NAME(TF2_IPSEC_TSO),
+    TFLAG_NAME(TF2_NO_ISS_CHECK),
+};
+
+/*
+ * Write the names of the set bits of word to out, lowest bit first. Only the
+ * set bits are visited, and each name is copied to a known offset, so there
+ * is no rescan of out. Returns the length written, out is NUL terminated.
+ */
+static inline size_t
+tflags_decode(uint32_t word, const struct tflag_name names[TFLAGS_BITS],
+              char *out)
+{
+    size_t len = 0;
+
+    while (word != 0) {
+        const struct tflag_name *name = &names[__builtin_ctz(word)];
+
+        word &= word - 1;
+        if (name->len > 0) {
+            memcpy(out + len, name->str, name->len);
+            len += name->len;
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+struct tflags_cache_entry {
+    uint32_t    word;
+    bool        is_valid;
+    char        str[TF2_ARRAY_MAX_LENGTH];
+};
+
+/*
+ * Decoded flag words, direct mapped. A flow goes through a handful of flag
+ * values over millions of records, so nearly every lookup is a hit.
+ */
+struct tflags_cache {
+    struct tflags_cache_entry   entries[TFLAGS_CACHE_SIZE];
+};
+
+/*
+ * The flags of word as one plot column: the names joined by " | ", or "-"
+ * if no named bit is set. The string stays valid until the next call.
+ */
+static inline const char *
+tflags_cache_get(struct tflags_cache *cache,
+                 const struct tflag_name names[TFLAGS_BITS], uint32_t word)
+{
+    /* Fibonacci hashing, the top bits pick the slot */
+    struct tflags_cache_entry *entry =
+        &cache->entries[(word * 2654435769u) >> (32 - TFLAGS_CACHE_BITS)];
+    size_t len;
+
+    if (entry->is_valid && entry->word == word) {
+        return entry->str;
+    }
+    len = tflags_decode(word, names, entry->str);
+    if (len == 0) {
+        strcpy(entry->str, "-");
+    } else {
+        /* drop the separator after the last name */
+        entry->str[len - strlen(" | ")] = '\0';
+    }
+    entry->word = word;
+    entry->is_valid = true;
+    return entry->str;
+}
+
+/* One cache per thread, plot files are written by a single thread each. */
+static _Thread_local struct tflags_cache tflags_column_cache;
+static _Thread_local struct tflags_cache tflags2_column_cache;
+
+static inline const char *
+tflags_column(uint32_t t_flags)
+{
+    return tflags_cache_get(&tflags_column_cache, tflags_names, t_flags);
+}
+
+static inline const char *
+tflags2_column(uint32_t t_flags2)
+{
+    return tflags_cache_get(&tflags2_column_cache, tflags2_names, t_flags2);
+}
+
+#endif /* SIFTR_TFLAGS_H_ */